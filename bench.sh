@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+#  bench.sh
+#  graphics-start
+#
+#  Builds every benchmark scene with GRAPHICS_BENCH and runs it along the same camera path
+#  (see graphics-start/custom/include/my/bench.h). One JSON result per scene goes to $BENCH_DIR,
+#  and all of them are collected in $BENCH_DIR/bench.json. Variants run a built scene again with other
+#  settings, e.g. the clustered ch07-4 scene shaded forward and deferred.
+#
+#  ./bench.sh [frames]
+#
+#  CXX, CXXFLAGS, LDFLAGS   compiler and extra flags, e.g. the glad/glfw include and library paths
+#  GLAD                     glad.c to link (default graphics-start/glad.c)
+#  BENCH_DIR                output directory (default _bench)
+#  BENCH_PATH               recorded camera path to use instead of the generated one
+#  BENCH_HEADLESS           1 to render offscreen through EGL (the default on Linux)
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+SRC="$ROOT/graphics-start"
+OUT=${BENCH_DIR:-"$ROOT/_bench"}
+FRAMES=${1:-${BENCH_FRAMES:-600}}
+WARMUP=${BENCH_WARMUP:-60}
+CXX=${CXX:-c++}
+GLAD=${GLAD:-"$SRC/glad.c"}
+
+SCENES="ch05-2 Coordinate Depth
+ch06-2 Camera Keyboard
+ch07-4 Lighting Specular"
+
+# name, scene binary, environment
+VARIANTS="ch07-4-forward ch07-4 CLUSTERED_LIGHTS=1024 CLUSTERED_LAYERS=6 DEFERRED=0
+ch07-4-deferred ch07-4 CLUSTERED_LIGHTS=1024 CLUSTERED_LAYERS=6 DEFERRED=1
+ch07-4-shadows ch07-4 CLUSTERED_LIGHTS=256 CLUSTERED_LAYERS=2 SHADOW_CASCADES=4
+ch07-4-point-shadows ch07-4 POINT_SHADOWS=1
+ch07-4-point-shadows-nocache ch07-4 POINT_SHADOWS=1 POINT_SHADOW_CACHE=0
+ch07-4-ibl ch07-4 IBL=1
+ch07-4-model ch07-4 MODEL=nanosuit/nanosuit.obj"
+
+if [ -z "$BENCH_HEADLESS" ] && [ "$(uname)" != "Darwin" ]; then
+    BENCH_HEADLESS=1
+fi
+if [ "$BENCH_HEADLESS" = "1" ]; then
+    MODE_FLAGS="-DGRAPHICS_HEADLESS"
+    MODE_LIBS="-lEGL -lOpenGL -lpthread"
+elif [ "$(uname)" = "Darwin" ]; then
+    MODE_FLAGS=""
+    MODE_LIBS="-lglfw -framework OpenGL"
+else
+    MODE_FLAGS=""
+    MODE_LIBS="-lglfw -lGL"
+fi
+
+mkdir -p "$OUT"
+echo "$SCENES" | while IFS= read -r SCENE; do
+    NAME=${SCENE%% *}
+    echo "bench: $SCENE"
+    # shellcheck disable=SC2086
+    "$CXX" -std=c++17 -O2 -DNDEBUG -DGRAPHICS_BENCH $MODE_FLAGS -DGRAPHICS_PROJECT_PATH="\"$ROOT\"" \
+        -I"$SRC/custom/include" $CXXFLAGS "$SRC/$SCENE/main.cpp" "$GLAD" -o "$OUT/$NAME" $MODE_LIBS $LDFLAGS
+    (cd "$OUT" && BENCH_SCENE="$NAME" BENCH_FRAMES="$FRAMES" BENCH_WARMUP="$WARMUP" BENCH_OUT="$OUT/$NAME.json" \
+        HEADLESS_FRAMES=$((FRAMES + WARMUP + 1)) "./$NAME" > "$OUT/$NAME.log")
+done
+
+echo "$VARIANTS" | while read -r NAME BINARY SETTINGS; do
+    echo "bench: $NAME ($SETTINGS)"
+    # shellcheck disable=SC2086
+    (cd "$OUT" && env $SETTINGS BENCH_SCENE="$NAME" BENCH_FRAMES="$FRAMES" BENCH_WARMUP="$WARMUP" BENCH_OUT="$OUT/$NAME.json" \
+        HEADLESS_FRAMES=$((FRAMES + WARMUP + 1)) "./$BINARY" > "$OUT/$NAME.log")
+done
+
+{
+    echo "["
+    FIRST=1
+    { echo "$SCENES" | while IFS= read -r SCENE; do echo "${SCENE%% *}"; done
+      echo "$VARIANTS" | while read -r NAME REST; do echo "$NAME"; done; } | while read -r NAME; do
+        [ $FIRST = 1 ] || echo ","
+        FIRST=0
+        cat "$OUT/$NAME.json"
+    done
+    echo "]"
+} > "$OUT/bench.json"
+
+cat "$OUT/bench.json"
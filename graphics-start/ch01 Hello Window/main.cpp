@@ -7,6 +7,7 @@
 #define GL_SILENCE_DEPRECATION
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <my/headless.h>
 #include<iostream>
 using namespace std;
 
@@ -8,7 +8,7 @@
 
 #include "common-gl.h"
 #include <my/shader_s.h>
-#include <stb-master/stb_image.h>
+#include <my/texture_manager.h>
 #include <my/path.h>
 
 const std::string texturePath = std::string(projectPath + "/resources/textures");
@@ -65,29 +65,12 @@ int main()
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
     
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    
-    // wrapping texture
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    int width, height, nrChannels;
-    const std::string containerTexturePath = texturePath + "/container.jpg";
-    unsigned char *data = stbi_load(containerTexturePath.c_str(), &width, &height, &nrChannels, 0);
-    
-    if(data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else{
-        std::cout << "Failed to load texture";
-    }
-    stbi_image_free(data);
+    // decoded on the texture manager's threads, the quad shows a placeholder until the upload is done
+    // color textures are sRGB: filtered and mipmapped in linear light, shader.fs encodes the result back
+    TextureManager textures;
+    TextureOptions color;
+    color.srgb = true;
+    TextureHandle container = textures.load(texturePath + "/container.jpg", color);
     
     
     while (!glfwWindowShouldClose(window))
@@ -97,9 +80,10 @@ int main()
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
         
+        textures.update();
+        
         // The default texture number is 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        glState.bindTexture(0, GL_TEXTURE_2D, textures.texture(container));
         
         ourShader.use();
         
@@ -116,6 +100,7 @@ int main()
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &EBO);
     glDeleteBuffers(1, &VBO);
+    textures.release();
     
     glfwTerminate();
     return 0;
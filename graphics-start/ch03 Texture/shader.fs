@@ -1,13 +1,16 @@
 #version 330 core
+#include "../custom/shaders/srgb.glsl"
 out vec4 FragColor;
 
 in vec3 ourColor;
 in vec2 TexCoord;
 
-// texture sampler
+// texture sampler, sRGB: the sample is linear
 uniform sampler2D ourTexture;
 
 void main()
 {
-    FragColor = texture(ourTexture, TexCoord) * vec4(ourColor, 1.0);
+    // the vertex colors are sRGB values like the texture, the product goes back to sRGB for the framebuffer
+    vec4 texel = texture(ourTexture, TexCoord);
+    FragColor = vec4(linearToSrgb(texel.rgb * srgbToLinear(ourColor)), texel.a);
 }
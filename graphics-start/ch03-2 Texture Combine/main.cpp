@@ -8,8 +8,9 @@
 
 #include "common-gl.h"
 #include <my/shader_s.h>
-#include <stb-master/stb_image.h>
+#include <my/texture_manager.h>
 #include <my/path.h>
+#include <filesystem>
 
 const std::string texturePath = std::string(projectPath + "/resources/textures");
 const std::string vertexShaderPath = std::string(srcPath + "/ch03-2 Texture Combine/shader.vs");
@@ -69,56 +70,45 @@ int main()
     /**
         Textures
      */
-    unsigned int texture1, texture2;
-    
-    // Texture1: load container image texture
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    int width, height, nrChannels;
-    
-    const std::string containerTexturePath = texturePath + "/container.jpg";
-    unsigned char *data = stbi_load(containerTexturePath.c_str(), &width, &height, &nrChannels, 0);
-    
-    if(data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else{
-        std::cout << "Failed to load texture";
-    }
-    stbi_image_free(data);
-    
-    
-    // Texture2: load smile image texture
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    stbi_set_flip_vertically_on_load(true);
-    const std::string smileTexturePath = texturePath + "/awesomeface.png";
-    data = stbi_load(smileTexturePath.c_str(), &width, &height, &nrChannels, 0);
-    
-    if(data)
+    // decoded on the texture manager's threads, both show a placeholder until their upload is done
+    // sRGB color textures: filtered and blended in linear light, shader.fs encodes the result back
+    TextureManager textures;
+    TextureOptions color;
+    color.srgb = true;
+    TextureHandle texture1 = textures.load(texturePath + "/container.jpg", color);
+    
+    TextureOptions flipped = color;
+    flipped.flipVertically = true;
+    TextureHandle texture2 = textures.load(texturePath + "/awesomeface.png", flipped);
+    
+    // LOAD_ALL_TEXTURES=1 also queues everything under resources/textures, the quad keeps rendering meanwhile;
+    // color maps are sRGB and block compressed, normal and other data maps stay linear and uncompressed
+    if (const char* all = getenv("LOAD_ALL_TEXTURES"))
     {
-        // awesomeface.png has an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBAs
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else{
-        std::cout << "Failed to load texture";
+        if (atoi(all) != 0)
+        {
+            for (const auto &file : std::filesystem::recursive_directory_iterator(texturePath))
+            {
+                // the 8-bit path would clamp HDR images, those are baked by ibl_bake.h
+                if (!file.is_regular_file() || file.path().extension() == ".hdr")
+                {
+                    continue;
+                }
+                std::string stem = file.path().stem().string();
+                bool data = false;
+                for (const char* kind : { "normal", "disp", "specular", "roughness", "metallic", "ao" })
+                {
+                    data |= stem == kind || stem.find(std::string("_") + kind) != std::string::npos;
+                }
+                TextureOptions options;
+                options.srgb = !data;
+                options.compress = !data;
+                // the alpha tested ones keep their coverage down the mip chain
+                options.alphaCutoff = stem == "grass" || stem == "window" ? 0.5f : 0.0f;
+                textures.load(file.path().string(), options);
+            }
+        }
     }
-    stbi_image_free(data);
     
     
     ourShader.use(); // activate shader is required before set uniforms.
@@ -135,25 +125,31 @@ int main()
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
         
-        // bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture2);
+        // finish decoded uploads within the frame budget
+        textures.update();
+        
+        // bind texture, the state cache skips the binds that are already current
+        glState.bindTexture(0, GL_TEXTURE_2D, textures.texture(texture1));
+        glState.bindTexture(1, GL_TEXTURE_2D, textures.texture(texture2));
         
         // render container
         ourShader.use();
-        glBindVertexArray(VAO);
+        glState.bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glState.newFrame();
         
         // double buffering & poll IO events
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
     
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &EBO);
-    glDeleteBuffers(1, &VBO);
+    glState.printStats();
+    textures.printStats();
+    
+    glState.deleteVertexArrays(1, &VAO);
+    glState.deleteBuffers(1, &EBO);
+    glState.deleteBuffers(1, &VBO);
+    textures.release();
     
     glfwTerminate();
     return 0;
@@ -1,15 +1,17 @@
 #version 330 core
+#include "../custom/shaders/srgb.glsl"
 out vec4 FragColor;
 
 in vec3 ourColor;
 in vec2 TexCoord;
 
-// texture sampler
+// texture samplers, sRGB: the samples are linear
 uniform sampler2D texture1;
 uniform sampler2D texture2;
 
 void main()
 {
-    // linearly interpolate between both textures (80% container, 20% awesomeface)
-    FragColor = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), 0.2);
+    // linearly interpolate between both textures (80% container, 20% awesomeface), in linear light
+    vec4 color = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), 0.2);
+    FragColor = vec4(linearToSrgb(color.rgb), color.a);
 }
@@ -10,6 +10,7 @@
 #include <my/shader_s.h>
 #include <stb-master/stb_image.h>
 #include <my/path.h>
+#include <my/mesh.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -90,26 +91,10 @@ int main()
     
     Shader ourShader(vertexShaderPath.c_str(), fragmentShaderPath.c_str());
     
-    unsigned int VBO, VAO, EBO;
-    
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    
-    // bind array first, and configure attributes
-    glBindVertexArray(VAO);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    
-    
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // welded into an indexed, cache-ordered mesh
+    Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 5, "cube");
+    // position, texture coord
+    unsigned int VAO = cube.createVertexArray({ { 0, 3 }, { 1, 2 } });
     
     
     /**
@@ -178,15 +163,13 @@ int main()
         handleEscOnClose(window);
         
         // clear
-        glEnable(GL_DEPTH_TEST);
+        glState.enable(GL_DEPTH_TEST);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         // bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture2);
+        glState.bindTexture(0, GL_TEXTURE_2D, texture1);
+        glState.bindTexture(1, GL_TEXTURE_2D, texture2);
         
         ourShader.use();
         
@@ -201,7 +184,7 @@ int main()
         
         
         // render container
-        glBindVertexArray(VAO);
+        glState.bindVertexArray(VAO);
         for (unsigned int i = 0; i < 10; i++)
         {
             // calculate the model matrix for each object and pass it to shader before drawing
@@ -211,16 +194,16 @@ int main()
             model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
             ourShader.setMat4("model", model);
             
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+            cube.draw();
         }
+        glState.newFrame();
         
         // double buffering & poll IO events
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
     
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    cube.release();
     
     glfwTerminate();
     return 0;
@@ -10,11 +10,21 @@
 #include <my/shader_s.h>
 #include <stb-master/stb_image.h>
 #include <my/path.h>
+#include <my/mesh.h>
+#include <my/render_queue.h>
+#include <my/cpu_profiler.h>
+#include <my/frustum.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn);
 void processInput(GLFWwindow *window);
@@ -40,6 +50,12 @@ float fov   =  45.0f;
 float deltaTime = 0.0f;    // time between current frame and last frame
 float lastFrame = 0.0f;
 
+// stress mode: STRESS_CUBES=<n> draws a random field of n cubes (10^4 to 10^6) instead of the ten below
+// and prints the frame time every second. PER_OBJECT_DRAWS=1 draws one cube per draw call through the
+// render queue instead of one instanced draw for the whole field.
+const unsigned int STRESS_MIN_CUBES = 10000;
+const unsigned int STRESS_MAX_CUBES = 1000000;
+
 
 int main()
 {
@@ -112,28 +128,53 @@ int main()
         glm::vec3(-1.3f,  1.0f, -1.5f)
     };
     
-    Shader ourShader(currentPath + "/shader.vs", currentPath + "/shader.fs");
-    
-    unsigned int VBO, VAO, EBO;
-    
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    
-    // bind array first, and configure attributes
-    glBindVertexArray(VAO);
+    std::vector<glm::vec3> positions(std::begin(cubePositions), std::end(cubePositions));
+    bool stress = false;
+    if (const char* value = getenv("STRESS_CUBES"))
+    {
+        unsigned int count = (unsigned int)std::min<long>(std::max<long>(atol(value), STRESS_MIN_CUBES), STRESS_MAX_CUBES);
+        // about one cube per 27 units^3, in a cube around the origin; fixed seed so runs compare
+        float halfSide = 1.5f * std::cbrt((float)count);
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> coordinate(-halfSide, halfSide);
+        positions.resize(count);
+        for (glm::vec3 &position : positions)
+            position = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+        stress = true;
+    }
+    const char* perObject = getenv("PER_OBJECT_DRAWS");
+    bool instanced = perObject == NULL || atoi(perObject) == 0;
     
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // the model matrices never change, so they are computed once
+    std::vector<glm::mat4> models(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, positions[i]);
+        float angle = 20.0f * i;
+        models[i] = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+    }
     
+    Shader ourShader(currentPath + "/shader.vs", currentPath + "/shader.fs");
+    // same shader, with the model matrix as a per-instance attribute
+    Shader instancedShader(currentPath + "/shader.vs", currentPath + "/shader.fs", "#define INSTANCED 1\n");
     
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // welded into an indexed, cache-ordered mesh
+    Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 5, "cube");
+    // position, texture coord
+    unsigned int VAO = cube.createVertexArray({ { 0, 3 }, { 1, 2 } });
     
-    // texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // instance model matrix attribute, a mat4 takes four vec4 locations; refilled with the visible cubes every frame
+    unsigned int instanceVBO;
+    glGenBuffers(1, &instanceVBO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+    for (unsigned int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribDivisor(2 + column, 1);
+    }
     
     
     /**
@@ -153,7 +194,11 @@ int main()
     int width, height, nrChannels;
     
     const std::string containerTexturePath = texturePath + "/container.jpg";
-    unsigned char *data = stbi_load(containerTexturePath.c_str(), &width, &height, &nrChannels, 0);
+    unsigned char *data;
+    {
+        CPU_ZONE("stbi_load");
+        data = stbi_load(containerTexturePath.c_str(), &width, &height, &nrChannels, 0);
+    }
     
     if(data)
     {
@@ -177,7 +222,10 @@ int main()
     
     stbi_set_flip_vertically_on_load(true);
     const std::string smileTexturePath = texturePath + "/awesomeface.png";
-    data = stbi_load(smileTexturePath.c_str(), &width, &height, &nrChannels, 0);
+    {
+        CPU_ZONE("stbi_load");
+        data = stbi_load(smileTexturePath.c_str(), &width, &height, &nrChannels, 0);
+    }
     
     if(data)
     {
@@ -191,17 +239,38 @@ int main()
     stbi_image_free(data);
     
     
-    ourShader.use(); // activate shader is required before set uniforms.
-    ourShader.setInt("texture1", 0);
-    ourShader.setInt("texture2", 1);
-    
     // pass projection matrix to shader (as projection matrix rarely changes there's no need to do this per frame)
     glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    ourShader.setMat4("projection", projection);
+    for (Shader* shader : { &ourShader, &instancedShader })
+    {
+        shader->use(); // activate shader is required before set uniforms.
+        shader->setInt("texture1", 0);
+        shader->setInt("texture2", 1);
+        shader->setMat4("projection", projection);
+    }
+    
+    // draws are sorted by program, textures and VAO before they are issued
+    RenderQueue renderQueue;
+    
+    // a unit cube fits in a sphere of radius sqrt(3) / 2 however it is rotated
+    BoundingSpheres cubeBounds;
+    for (const glm::vec3 &position : positions)
+        cubeBounds.push_back(position, 0.8661f);
+    std::vector<uint32_t> visibleCubes;
+    std::vector<glm::mat4> instanceModels;
+    instanceModels.reserve(models.size());
+    
+    // stress report, wall clock time so it stays real in bench mode too
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point reportStart = Clock::now(), runStart = reportStart;
+    unsigned int reportFrames = 0, runFrames = 0;
+    size_t reportVisible = 0;
     
     
     while (!glfwWindowShouldClose(window))
     {
+        CPU_ZONE("frame");
+        
         // per-frame time logic
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
@@ -211,43 +280,104 @@ int main()
         processInput(window);
         
         // clear
-        glEnable(GL_DEPTH_TEST);
+        glState.enable(GL_DEPTH_TEST);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
-        // bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture2);
-        
-        ourShader.use();
-        
-        // camera/view transformation
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        ourShader.setMat4("view", view);
+        Shader &shader = instanced ? instancedShader : ourShader;
+        {
+            CPU_ZONE("uniform setup");
+            shader.use();
+            
+            // camera/view transformation
+            shader.setMat4("view", view);
+        }
+        
+        // only the cubes inside the view frustum are drawn
+        {
+            CPU_ZONE("cull");
+            cullSpheres(Frustum::fromMatrix(projection * view), cubeBounds, visibleCubes);
+        }
         
         // render container
-        glBindVertexArray(VAO);
-        for (unsigned int i = 0; i < 10; i++)
+        if (instanced && !visibleCubes.empty())
+        {
+            CPU_ZONE("instanced draw");
+            instanceModels.clear();
+            for (unsigned int i : visibleCubes)
+                instanceModels.push_back(models[i]);
+            
+            // orphan the buffer so the upload does not wait for last frame's draw
+            glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instanceModels.size() * sizeof(glm::mat4), instanceModels.data());
+            
+            glState.bindTexture(0, GL_TEXTURE_2D, texture1);
+            glState.bindTexture(1, GL_TEXTURE_2D, texture2);
+            glState.bindVertexArray(VAO);
+            cube.drawInstanced((GLsizei)instanceModels.size());
+        }
+        else if (!instanced)
         {
-            // calculate the model matrix for each object and pass it to shader before drawing
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePositions[i]);
-            float angle = 20.0f * i;
-            model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            ourShader.setMat4("model", model);
+            CPU_ZONE("draws");
+            for (unsigned int i : visibleCubes)
+            {
+                // submit each object with the state it needs
+                DrawPacket packet;
+                packet.shader = &ourShader;
+                packet.vao = VAO;
+                packet.textures[0] = texture1;
+                packet.textures[1] = texture2;
+                packet.count = cube.indexCount();
+                packet.indexType = cube.indexType();
+                packet.depth = glm::length(positions[i] - cameraPos);
+                packet.model = models[i];
             
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+                renderQueue.submit(packet);
+            }
+            renderQueue.flush();
         }
+        glState.newFrame();
         
         // double buffering & poll IO events
-        glfwSwapBuffers(window);
+        {
+            CPU_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
+        
+        if (stress)
+        {
+            reportFrames++;
+            runFrames++;
+            reportVisible += visibleCubes.size();
+            double seconds = std::chrono::duration<double>(Clock::now() - reportStart).count();
+            if (seconds >= 1.0)
+            {
+                std::cout << "STRESS::FRAME cubes=" << positions.size() << " visible=" << reportVisible / reportFrames
+                          << " frame=" << seconds * 1000.0 / reportFrames << "ms fps=" << reportFrames / seconds
+                          << (instanced ? " instanced" : " per-object") << std::endl;
+                reportStart = Clock::now();
+                reportFrames = 0;
+                reportVisible = 0;
+            }
+        }
+    }
+    
+    if (stress && runFrames > 0)
+    {
+        double seconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+        std::cout << "STRESS::TOTAL cubes=" << positions.size() << " frames=" << runFrames
+                  << " frame=" << seconds * 1000.0 / runFrames << "ms" << std::endl;
     }
+    glState.printStats();
+    cpuProfiler.writeFromEnvironment();
     
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    cube.release();
+    glState.deleteBuffers(1, &instanceVBO);
+    glState.deleteTextures(1, &texture1);
+    glState.deleteTextures(1, &texture2);
     
     glfwTerminate();
     return 0;
@@ -256,6 +386,7 @@ int main()
 /** keyboard input */
 void processInput(GLFWwindow *window)
 {
+    CPU_ZONE("processInput");
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
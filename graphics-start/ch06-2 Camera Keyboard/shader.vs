@@ -1,15 +1,23 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
+#ifdef INSTANCED
+layout (location = 2) in mat4 aModel;
+#endif
 
 out vec2 TexCoord;
 
+#ifndef INSTANCED
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
+#ifdef INSTANCED
+    mat4 model = aModel;
+#endif
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     TexCoord = vec2(aTexCoord.x, aTexCoord.y);
 }
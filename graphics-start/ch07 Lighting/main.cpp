@@ -9,6 +9,7 @@
 #include <my/shader_s.h>
 #include <stb-master/stb_image.h>
 #include <my/path.h>
+#include <my/mesh.h>
 #include <my/camera.h>
 
 #include <glm/glm.hpp>
@@ -54,6 +55,14 @@ int main()
     // configure global opengl state
     glEnable(GL_DEPTH_TEST);
 
+    // the projection only changes with the zoom and the window's aspect, the camera rebuilds it when one does
+    camera.SetPerspective((float)SCR_WIDTH / (float)SCR_HEIGHT);
+    framebufferResizeHandler = [](int width, int height)
+    {
+        if (height > 0)
+            camera.SetPerspective((float)width / (float)height);
+    };
+
     // build and compile our shader zprogram
     Shader lightingShader(currentPath + "/color.vs", currentPath + "/color.fs");
     Shader lightCubeShader(currentPath + "/light.vs", currentPath + "/light.fs");
@@ -103,28 +112,11 @@ int main()
         -0.5f,  0.5f, -0.5f,
     };
     
-    // VBO
-    unsigned int VBO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // cubeVAO
-    unsigned int cubeVAO;
-    glGenVertexArrays(1, &cubeVAO);
-    glBindVertexArray(cubeVAO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // lightCubeVAO
-    unsigned int lightCubeVAO;
-    glGenVertexArrays(1, &lightCubeVAO);
-    glBindVertexArray(lightCubeVAO);
-    
-    // we only need to bind to the VBO (to link it with glVertexAttribPointer), it's already bound, but we do it again for educational purposes
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // welded into an indexed, cache-ordered mesh
+    Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 3, "cube");
+    unsigned int cubeVAO = cube.createVertexArray({ { 0, 3 } }); // position
+    // lightCubeVAO: same buffers, the lamp only reads the position
+    unsigned int lightCubeVAO = cube.createVertexArray({ { 0, 3 } });
 
 
     // render loop
@@ -148,8 +140,8 @@ int main()
         lightingShader.setVec3("lightColor",  1.0f, 1.0f, 1.0f);
 
         // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
+        const glm::mat4 &projection = camera.GetProjectionMatrix();
+        const glm::mat4 &view = camera.GetViewMatrix();
         lightingShader.setMat4("projection", projection);
         lightingShader.setMat4("view", view);
 
@@ -158,8 +150,8 @@ int main()
         lightingShader.setMat4("model", model);
 
         // render the cube
-        glBindVertexArray(cubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glState.bindVertexArray(cubeVAO);
+        cube.draw();
 
 
         // also draw the lamp object
@@ -171,8 +163,8 @@ int main()
         model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
         lightCubeShader.setMat4("model", model);
 
-        glBindVertexArray(lightCubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glState.bindVertexArray(lightCubeVAO);
+        cube.draw();
 
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -181,9 +173,7 @@ int main()
     }
 
     // optional: de-allocate all resources once they've outlived their purpose:
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &lightCubeVAO);
-    glDeleteBuffers(1, &VBO);
+    cube.release();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
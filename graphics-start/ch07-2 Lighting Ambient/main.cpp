@@ -7,9 +7,12 @@
 
 #include "common-gl.h"
 #include <my/shader_s.h>
+#include <my/shader_permutations.h>
 #include <stb-master/stb_image.h>
 #include <my/path.h>
+#include <my/mesh.h>
 #include <my/camera.h>
+#include <my/camera_buffer.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -55,9 +58,20 @@ int main()
     glEnable(GL_DEPTH_TEST);
 
     // build and compile our shader zprogram
-    Shader lightingShader(currentPath + "/shader.vs", currentPath + "/shader.fs");
+    // the lighting shader is the ambient only variant of the shared phong uber-shader
+    ShaderPermutations phongShaders(shaderPath + "/phong.vs", shaderPath + "/phong.fs", { "LIGHT_AMBIENT", "LIGHT_DIFFUSE", "LIGHT_SPECULAR" });
+    Shader &lightingShader = phongShaders.get({ "LIGHT_AMBIENT" });
     Shader lightCubeShader(currentPath + "/light.vs", currentPath + "/light.fs");
 
+    // view/projection/viewPos are shared by both shaders through the Camera uniform block
+    CameraUniformBuffer cameraBuffer;
+    camera.SetPerspective((float)SCR_WIDTH / (float)SCR_HEIGHT);
+    framebufferResizeHandler = [](int width, int height)
+    {
+        if (height > 0)
+            camera.SetPerspective((float)width / (float)height);
+    };
+
     // set up vertex data (and buffer(s)) and configure vertex attributes
     float vertices[] = {
         -0.5f, -0.5f, -0.5f,
@@ -103,28 +117,11 @@ int main()
         -0.5f,  0.5f, -0.5f,
     };
     
-    // VBO
-    unsigned int VBO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // cubeVAO
-    unsigned int cubeVAO;
-    glGenVertexArrays(1, &cubeVAO);
-    glBindVertexArray(cubeVAO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // lightCubeVAO
-    unsigned int lightCubeVAO;
-    glGenVertexArrays(1, &lightCubeVAO);
-    glBindVertexArray(lightCubeVAO);
-    
-    // we only need to bind to the VBO (to link it with glVertexAttribPointer), it's already bound, but we do it again for educational purposes
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // welded into an indexed, cache-ordered mesh
+    Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 3, "cube");
+    unsigned int cubeVAO = cube.createVertexArray({ { 0, 3 } }); // position
+    // lightCubeVAO: same buffers, the lamp only reads the position
+    unsigned int lightCubeVAO = cube.createVertexArray({ { 0, 3 } });
 
 
     // render loop
@@ -141,38 +138,33 @@ int main()
         // render
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // view/projection transformations, uploaded once for every shader when the camera changed
+        cameraBuffer.update(camera);
         
         // be sure to activate shader when setting uniforms/drawing objects
         lightingShader.use();
         lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
         lightingShader.setVec3("lightColor",  1.0f, 1.0f, 1.0f);
 
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-
         // world transformation
         glm::mat4 model = glm::mat4(1.0f);
         lightingShader.setMat4("model", model);
 
         // render the cube
-        glBindVertexArray(cubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glState.bindVertexArray(cubeVAO);
+        cube.draw();
 
 
         // also draw the lamp object
         lightCubeShader.use();
-        lightCubeShader.setMat4("projection", projection);
-        lightCubeShader.setMat4("view", view);
         model = glm::mat4(1.0f);
         model = glm::translate(model, lightPos);
         model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
         lightCubeShader.setMat4("model", model);
 
-        glBindVertexArray(lightCubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glState.bindVertexArray(lightCubeVAO);
+        cube.draw();
 
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -181,9 +173,8 @@ int main()
     }
 
     // optional: de-allocate all resources once they've outlived their purpose:
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &lightCubeVAO);
-    glDeleteBuffers(1, &VBO);
+    cube.release();
+    glDeleteBuffers(1, &cameraBuffer.ID);
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
@@ -7,17 +7,34 @@
 
 #include "common-gl.h"
 #include <my/shader_s.h>
+#include <my/shader_permutations.h>
+#include <my/shader_reload.h>
+#include <my/gpu_profiler.h>
+#include <my/cpu_profiler.h>
 #include <stb-master/stb_image.h>
 #include <my/path.h>
+#include <my/mesh.h>
+#include <my/mesh_cache.h>
 #include <my/camera.h>
+#include <my/camera_buffer.h>
+#include <my/light_clusters.h>
+#include <my/deferred.h>
+#include <my/shadow_cascades.h>
+#include <my/point_shadows.h>
+#include <my/image_based_lighting.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <memory>
+#include <random>
+#include <string>
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
+float cubeBoundingRadius(const glm::mat4 &model);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -36,6 +53,24 @@ float lastFrame = 0.0f;
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
+// POINT_SHADOWS scene: the cube on a floor with a ring of pillars around the lamp, and cubes orbiting the lamp
+const int POINT_SHADOW_PILLARS = 10;
+const int POINT_SHADOW_MOVERS = 4;
+
+// CLUSTERED_LIGHTS scene: a floor with a grid of cubes, lit only by moving point lights
+const unsigned int CLUSTERED_MAX_LIGHTS = 65535;
+const int CLUSTERED_GRID = 16;
+const float CLUSTERED_SPACING = 3.0f;
+const int CLUSTERED_MAX_LAYERS = 32;
+
+// SHADOW_CASCADES: a directional sun over the clustered scene, with cascaded shadows
+const glm::vec3 sunDirection(-0.4f, 1.0f, -0.3f);  // towards the sun
+const glm::vec3 sunColor(0.6f, 0.55f, 0.5f);
+
+// the clustered scene renders forward or deferred, G switches at runtime
+bool deferredShading = false;
+bool deferredKeyHeld = false;
+
 const std::string currentPath = std::string(srcPath + "/ch07-4 Lighting Specular");
 
 int main()
@@ -55,9 +90,94 @@ int main()
     glEnable(GL_DEPTH_TEST);
 
     // build and compile our shader zprogram
-    Shader lightingShader(currentPath + "/shader.vs", currentPath + "/shader.fs");
+    // the lighting shader is the ambient + diffuse + specular variant of the shared phong uber-shader
+    // CLUSTERED_LIGHTS=N replaces the single light with N point lights, binned into clusters every frame
+    unsigned int clusteredLightCount = 0;
+    if (const char* value = getenv("CLUSTERED_LIGHTS"))
+        clusteredLightCount = (unsigned int)std::min<long>(std::max<long>(atol(value), 0), CLUSTERED_MAX_LIGHTS);
+    bool clustered = clusteredLightCount > 0;
+    // CLUSTERED_LAYERS=N stacks N layers of cubes, drawn back to front for overdraw; DEFERRED=1 starts deferred
+    int clusteredLayers = 1;
+    if (const char* value = getenv("CLUSTERED_LAYERS"))
+        clusteredLayers = std::min(std::max(atoi(value), 1), CLUSTERED_MAX_LAYERS);
+    if (const char* value = getenv("DEFERRED"))
+        deferredShading = atoi(value) != 0;
+    // SHADOW_CASCADES=N (1-4) adds the shadowed sun to the clustered scene, SHADOW_MAP_SIZE is the resolution per cascade
+    int shadowCascadeCount = 0;
+    if (const char* value = getenv("SHADOW_CASCADES"))
+        shadowCascadeCount = clustered ? std::min(std::max(atoi(value), 0), ShadowCascades::MAX_CASCADES) : 0;
+    int shadowMapSize = 2048;
+    if (const char* value = getenv("SHADOW_MAP_SIZE"))
+        shadowMapSize = std::min(std::max(atoi(value), 256), 8192);
+
+    // POINT_SHADOWS=1 shadows the single lamp with a cube map rendered in one layered pass; POINT_SHADOW_CACHE=0
+    // renders the static casters every frame instead of only when the lamp moved, POINT_LIGHT_ORBIT=1 moves it
+    bool pointShadowed = false;
+    if (const char* value = getenv("POINT_SHADOWS"))
+        pointShadowed = !clustered && atoi(value) != 0;
+    bool pointShadowCache = true;
+    if (const char* value = getenv("POINT_SHADOW_CACHE"))
+        pointShadowCache = atoi(value) != 0;
+    bool pointLightOrbit = false;
+    if (const char* value = getenv("POINT_LIGHT_ORBIT"))
+        pointLightOrbit = atoi(value) != 0;
+
+    // IBL=1 lights the ambient term and reflections of every scene with the newport_loft environment, baked on
+    // the CPU once and cached, and draws it behind the scene; IBL_MAP bakes another equirectangular HDR instead
+    std::unique_ptr<ImageBasedLighting> ibl;
+    if (const char* value = getenv("IBL"))
+    {
+        if (atoi(value) != 0)
+        {
+            const char* map = getenv("IBL_MAP");
+            ibl.reset(new ImageBasedLighting(map ? std::string(map) : projectPath + "/resources/textures/hdr/newport_loft.hdr"));
+            if (!ibl->loaded())
+                ibl.reset();
+        }
+    }
+
+    // MODEL=path lights an OBJ model instead of the cube in the single lamp scene, scaled into the cube's place;
+    // relative paths are under resources/objects, e.g. MODEL=nanosuit/nanosuit.obj
+    std::string modelPath;
+    if (const char* value = getenv("MODEL"))
+    {
+        if (!clustered && !pointShadowed && *value)
+            modelPath = value[0] == '/' ? std::string(value) : projectPath + "/resources/objects/" + value;
+    }
+
+    ShaderPermutations phongShaders(shaderPath + "/phong.vs", shaderPath + "/phong.fs", { "LIGHT_AMBIENT", "LIGHT_DIFFUSE", "LIGHT_SPECULAR", "LIGHT_CLUSTERED", "SHADOWS_CASCADED", "SHADOWS_POINT", "LIGHT_IBL" });
+    std::vector<std::string> lightingFeatures = { "LIGHT_AMBIENT", "LIGHT_DIFFUSE", "LIGHT_SPECULAR" };
+    if (clustered)
+        lightingFeatures.push_back("LIGHT_CLUSTERED");
+    if (shadowCascadeCount > 0)
+        lightingFeatures.push_back("SHADOWS_CASCADED");
+    if (pointShadowed)
+        lightingFeatures.push_back("SHADOWS_POINT");
+    if (ibl)
+        lightingFeatures.push_back("LIGHT_IBL");
+    Shader &lightingShader = phongShaders.get(lightingFeatures);
+    if (ibl)
+        ibl->setSamplers(lightingShader);
     Shader lightCubeShader(currentPath + "/light.vs", currentPath + "/light.fs");
 
+    // view/projection/viewPos are shared by both shaders through the Camera uniform block
+    // the aspect follows the window, the clusters and the cascades rebuild from the camera's projection
+    CameraUniformBuffer cameraBuffer;
+    camera.SetPerspective((float)SCR_WIDTH / (float)SCR_HEIGHT);
+    framebufferResizeHandler = [](int width, int height)
+    {
+        if (height > 0)
+            camera.SetPerspective((float)width / (float)height);
+    };
+
+    // recompile the shaders in the background whenever their files are saved
+    ShaderReloader shaderReloader(window);
+    shaderReloader.watch(lightingShader);
+    shaderReloader.watch(lightCubeShader);
+
+    // GPU time of the lighting cube and lamp draws, read back a few frames late so it never stalls
+    GpuProfiler gpuProfiler;
+
     // set up vertex data (and buffer(s)) and configure vertex attributes
     float vertices[] = {
             -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
@@ -103,96 +223,393 @@ int main()
             -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
         };
     
-    // VBO
-    unsigned int VBO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    
-    // cubeVAO
-    unsigned int cubeVAO;
-    glGenVertexArrays(1, &cubeVAO);
-    glBindVertexArray(cubeVAO);
-    
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    
-    
-    // lightCubeVAO: VBO stays the same;
-    unsigned int lightCubeVAO;
-    glGenVertexArrays(1, &lightCubeVAO);
-    glBindVertexArray(lightCubeVAO);
-    
-    // we only need to bind to the VBO (to link it with glVertexAttribPointer), it's already bound, but we do it again for educational purposes
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // welded into an indexed, cache-ordered mesh
+    Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 6, "cube");
+    unsigned int cubeVAO = cube.createVertexArray({ { 0, 3 }, { 1, 3 } }); // position, normal
+    // lightCubeVAO: same buffers, the lamp only reads the position
+    unsigned int lightCubeVAO = cube.createVertexArray({ { 0, 3 } });
+
+    // the OBJ model is parsed once and mapped from the mesh cache afterwards; it shares the cube's position and
+    // normal locations, its texcoords are unused
+    std::unique_ptr<ObjModel> objModel;
+    unsigned int objModelVAO = 0;
+    glm::mat4 objModelTransform(1.0f);
+    if (!modelPath.empty())
+    {
+        objModel.reset(new ObjModel());
+        if (loadObjCached(modelPath, *objModel))
+        {
+            objModelVAO = objModel->createVertexArray();
+            glm::vec3 extent = objModel->boundsMax - objModel->boundsMin;
+            float scale = 1.0f / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+            objModelTransform = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)), -0.5f * (objModel->boundsMin + objModel->boundsMax));
+        }
+        else
+        {
+            objModel.reset();
+        }
+    }
+
+    // the clustered scene: lights orbit their anchor at their own speed, fixed seed so runs compare
+    std::unique_ptr<LightClusters> lightClusters;
+    std::unique_ptr<DeferredRenderer> deferred;
+    std::unique_ptr<Shader> gbufferShader;
+    std::unique_ptr<ShadowCascades> shadows;
+    std::vector<std::string> cascadeNames;
+    BoundingSpheres casterBounds;
+    std::vector<PointLight> pointLights;
+    std::vector<glm::vec4> lightOrbits;
+    std::vector<glm::mat4> sceneModels;
+    if (clustered)
+    {
+        lightClusters.reset(new LightClusters());
+        LightClusters::setSamplers(lightingShader);
+        // the lighting pass gets the same features as the forward variant
+        deferred.reset(new DeferredRenderer(phongShaders.definesOf(phongShaders.maskOf(lightingFeatures))));
+        if (ibl)
+            ibl->setSamplers(deferred->lightingShader());
+        // same vertex stage as the forward path, the fragment stage only writes the G-buffer
+        gbufferShader.reset(new Shader(shaderPath + "/phong.vs", shaderPath + "/gbuffer.fs"));
+        shaderReloader.watch(*gbufferShader);
+        shaderReloader.watch(deferred->lightingShader());
+
+        float halfSide = CLUSTERED_GRID * CLUSTERED_SPACING * 0.5f;
+        sceneModels.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.6f, 0.0f)), glm::vec3(halfSide * 2.0f, 0.2f, halfSide * 2.0f)));
+        // rows from the far end towards the camera, so every nearer cube is shaded over the ones behind it
+        for (int z = 0; z < CLUSTERED_GRID; z++)
+            for (int layer = 0; layer < clusteredLayers; layer++)
+                for (int x = 0; x < CLUSTERED_GRID; x++)
+                    sceneModels.push_back(glm::translate(glm::mat4(1.0f), glm::vec3((x + 0.5f) * CLUSTERED_SPACING - halfSide, layer * 1.5f, (z + 0.5f) * CLUSTERED_SPACING - halfSide)));
+
+        if (shadowCascadeCount > 0)
+        {
+            shadows.reset(new ShadowCascades(shadowCascadeCount, shadowMapSize));
+            ShadowCascades::setSamplers(lightingShader);
+            ShadowCascades::setSamplers(deferred->lightingShader());
+            shaderReloader.watch(shadows->depthShader());
+            for (int i = 0; i < shadowCascadeCount; i++)
+                cascadeNames.push_back("shadow cascade " + std::to_string(i));
+            // every model is a (scaled) unit cube: half the diagonal of its scaled axes
+            for (const glm::mat4 &sceneModel : sceneModels)
+                casterBounds.push_back(glm::vec3(sceneModel[3]), cubeBoundingRadius(sceneModel));
+        }
+
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        pointLights.resize(clusteredLightCount);
+        lightOrbits.resize(clusteredLightCount);
+        for (unsigned int i = 0; i < clusteredLightCount; i++)
+        {
+            // anchor xz, orbit radius, angular speed
+            lightOrbits[i] = glm::vec4((unit(random) * 2.0f - 1.0f) * halfSide, (unit(random) * 2.0f - 1.0f) * halfSide, 0.5f + unit(random) * 2.0f, (unit(random) - 0.5f) * 2.0f);
+            pointLights[i].radius = 2.0f + unit(random) * 3.0f + clusteredLayers * 0.5f;
+            pointLights[i].color = glm::vec3(unit(random), unit(random), unit(random)) * 4.0f;
+        }
+
+        camera.Position = glm::vec3(0.0f, 8.0f, halfSide + 6.0f);
+        camera.Pitch = -20.0f;
+        camera.MarkDirty();
+    }
+
+    // the point shadow scene: sceneModels holds the static casters, then the movers, updated every frame
+    std::unique_ptr<PointShadows> pointShadows;
+    BoundingSpheres staticBounds;
+    BoundingSpheres dynamicBounds;
+    size_t staticModelCount = 0;
+    glm::vec3 lightCenter = lightPos;
+    if (pointShadowed)
+    {
+        pointShadows.reset(new PointShadows(1024, 25.0f, pointShadowCache));
+        pointShadows->setSamplers(lightingShader);
+        shaderReloader.watch(pointShadows->depthShader());
+
+        sceneModels.push_back(glm::mat4(1.0f));
+        sceneModels.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.6f, 0.0f)), glm::vec3(16.0f, 0.2f, 16.0f)));
+        for (int i = 0; i < POINT_SHADOW_PILLARS; i++)
+        {
+            float angle = glm::radians(360.0f) * i / POINT_SHADOW_PILLARS;
+            float height = 1.0f + 0.5f * (i % 3);
+            glm::vec3 position = lightCenter + glm::vec3(cos(angle) * 3.5f, 0.0f, sin(angle) * 3.5f);
+            position.y = -0.5f + height * 0.5f;
+            sceneModels.push_back(glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.6f, height, 0.6f)));
+        }
+        staticModelCount = sceneModels.size();
+        for (const glm::mat4 &sceneModel : sceneModels)
+            staticBounds.push_back(glm::vec3(sceneModel[3]), cubeBoundingRadius(sceneModel));
+        // zero until the first frame places them, so that frame counts as a move
+        sceneModels.resize(staticModelCount + POINT_SHADOW_MOVERS, glm::mat4(0.0f));
+
+        camera.Position = lightCenter + glm::vec3(0.0f, 4.0f, 8.0f);
+        camera.Pitch = -25.0f;
+        camera.MarkDirty();
+    }
 
 
     // render loop
     while (!glfwWindowShouldClose(window))
     {
+        CPU_ZONE("frame");
+
         // per-frame time logic
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // swap in shaders edited since the last frame
+        shaderReloader.apply();
+
         // input
         processInput(window);
 
+        gpuProfiler.beginFrame();
+
         // render
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        // be sure to activate shader when setting uniforms/drawing objects
-        lightingShader.use();
-        lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
-        lightingShader.setVec3("lightColor",  1.0f, 1.0f, 1.0f);
-        lightingShader.setVec3("lightPos", lightPos);
-
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-        lightingShader.setVec3("viewPos", camera.Position);
-
-        // world transformation
-        glm::mat4 model = glm::mat4(1.0f);
-        lightingShader.setMat4("model", model);
+
+        glm::mat4 model;
+        {
+            CPU_ZONE("uniform setup");
+
+            // view/projection transformations, uploaded once for every shader when the camera changed
+            cameraBuffer.update(camera);
+
+            if (clustered)
+            {
+                CPU_ZONE("light clusters");
+                for (size_t i = 0; i < pointLights.size(); i++)
+                {
+                    const glm::vec4 &orbit = lightOrbits[i];
+                    float angle = currentFrame * orbit.w + (float)i;
+                    float height = 0.6f + (clusteredLayers - 1) * 1.5f * (0.5f + 0.5f * sin(angle * 0.3f)) + 0.4f * sin(angle * 1.7f);
+                    pointLights[i].position = glm::vec3(orbit.x + cos(angle) * orbit.z, height, orbit.y + sin(angle) * orbit.z);
+                }
+                lightClusters->update(camera, pointLights);
+                lightClusters->bind();
+            }
+
+            if (shadows)
+            {
+                shadows->update(camera, sunDirection, sunColor, casterBounds);
+            }
+
+            if (pointShadows)
+            {
+                if (pointLightOrbit)
+                    lightPos = lightCenter + glm::vec3(cos(currentFrame * 0.5f) * 1.0f, 0.0f, sin(currentFrame * 0.5f) * 1.0f);
+                dynamicBounds.clear();
+                bool moversMoved = false;
+                for (int i = 0; i < POINT_SHADOW_MOVERS; i++)
+                {
+                    float angle = currentFrame * 0.8f + glm::radians(360.0f) * i / POINT_SHADOW_MOVERS;
+                    glm::vec3 position = lightPos + glm::vec3(cos(angle) * 1.4f, -0.3f + 0.2f * sin(angle * 2.0f), sin(angle) * 1.4f);
+                    glm::mat4 moved = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.35f));
+                    glm::mat4 &mover = sceneModels[staticModelCount + i];
+                    moversMoved = moversMoved || moved != mover;
+                    mover = moved;
+                    dynamicBounds.push_back(position, cubeBoundingRadius(mover));
+                }
+                // the static set never changes, the movers only count as moved when a model matrix changed
+                pointShadows->update(lightPos, staticBounds, 1, dynamicBounds, moversMoved);
+            }
+
+            // be sure to activate shader when setting uniforms/drawing objects
+            lightingShader.use();
+            lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
+            lightingShader.setVec3("lightColor",  1.0f, 1.0f, 1.0f);
+            lightingShader.setVec3("lightPos", lightPos);
+
+            // world transformation
+            model = glm::mat4(1.0f);
+            lightingShader.setMat4("model", model);
+        }
+
+        // depth of the sun's casters, one layer per cascade
+        if (shadows)
+        {
+            CPU_ZONE("draw shadow cascades");
+            GpuProfileScope scope(gpuProfiler, "shadows");
+            glState.bindVertexArray(cubeVAO);
+            for (int i = 0; i < shadows->cascadeCount(); i++)
+            {
+                GpuProfileScope cascadeScope(gpuProfiler, cascadeNames[i]);
+                shadows->beginCascade(i);
+                for (uint32_t caster : shadows->casters(i))
+                {
+                    shadows->depthShader().setMat4("model", sceneModels[caster]);
+                    cube.draw();
+                }
+            }
+            shadows->end();
+            shadows->bind();
+        }
+
+        // the lamp's cube map, the static casters only when the cache is out of date
+        if (pointShadows)
+        {
+            CPU_ZONE("draw point shadows");
+            GpuProfileScope scope(gpuProfiler, "point shadows");
+            glState.bindVertexArray(lightCubeVAO);
+            if (pointShadows->beginStatic())
+            {
+                for (const PointShadowCaster &caster : pointShadows->staticCasters())
+                {
+                    pointShadows->setCaster(sceneModels[caster.index], caster.faces);
+                    cube.draw();
+                }
+            }
+            if (pointShadows->beginDynamic())
+            {
+                for (const PointShadowCaster &caster : pointShadows->dynamicCasters())
+                {
+                    pointShadows->setCaster(sceneModels[staticModelCount + caster.index], caster.faces);
+                    cube.draw();
+                }
+            }
+            pointShadows->end();
+            pointShadows->bind();
+        }
+
+        // the environment under everything, the scene is drawn over it
+        if (ibl)
+        {
+            CPU_ZONE("draw environment");
+            GpuProfileScope scope(gpuProfiler, "environment");
+            ibl->bind();
+            ibl->drawBackground(camera);
+        }
 
         // render the cube
-        glBindVertexArray(cubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (clustered && deferredShading)
+        {
+            {
+                CPU_ZONE("draw geometry pass");
+                GpuProfileScope scope(gpuProfiler, "deferred geometry");
+                deferred->beginGeometry();
+                gbufferShader->use();
+                gbufferShader->setVec3("objectColor", 1.0f, 0.5f, 0.31f);
+                glState.bindVertexArray(cubeVAO);
+                for (const glm::mat4 &sceneModel : sceneModels)
+                {
+                    gbufferShader->setMat4("model", sceneModel);
+                    cube.draw();
+                }
+            }
+            {
+                CPU_ZONE("draw lighting pass");
+                GpuProfileScope scope(gpuProfiler, "deferred lighting");
+                deferred->light(camera, glm::vec3(1.0f));
+            }
+        }
+        else if (clustered)
+        {
+            CPU_ZONE("draw clustered scene");
+            GpuProfileScope scope(gpuProfiler, "clustered scene");
+            // the shadow pass left its depth program current
+            lightingShader.use();
+            glState.bindVertexArray(cubeVAO);
+            for (const glm::mat4 &sceneModel : sceneModels)
+            {
+                lightingShader.setMat4("model", sceneModel);
+                cube.draw();
+            }
+        }
+        else
+        {
+            CPU_ZONE("draw lighting cube");
+            GpuProfileScope scope(gpuProfiler, "lighting cube");
+            lightingShader.use();
+            glState.bindVertexArray(cubeVAO);
+            if (pointShadows)
+            {
+                for (const glm::mat4 &sceneModel : sceneModels)
+                {
+                    lightingShader.setMat4("model", sceneModel);
+                    cube.draw();
+                }
+            }
+            else if (objModel)
+            {
+                // one draw per material, tinted with its diffuse color
+                glState.bindVertexArray(objModelVAO);
+                lightingShader.setMat4("model", objModelTransform);
+                for (size_t i = 0; i < objModel->mesh.sections.size(); i++)
+                {
+                    uint32_t material = objModel->mesh.sections[i].material;
+                    if (material < objModel->materials.size())
+                        lightingShader.setVec3("objectColor", objModel->materials[material].diffuse);
+                    objModel->mesh.drawSection(i);
+                }
+            }
+            else
+            {
+                cube.draw();
+            }
+        }
 
 
         // also draw the lamp object
-        lightCubeShader.use();
-        lightCubeShader.setMat4("projection", projection);
-        lightCubeShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, lightPos);
-        model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
-        lightCubeShader.setMat4("model", model);
-
-        glBindVertexArray(lightCubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (!clustered)
+        {
+            CPU_ZONE("uniform setup");
+            lightCubeShader.use();
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, lightPos);
+            model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
+            lightCubeShader.setMat4("model", model);
+        }
+
+        if (!clustered)
+        {
+            CPU_ZONE("draw lamp");
+            GpuProfileScope scope(gpuProfiler, "lamp");
+            glState.bindVertexArray(lightCubeVAO);
+            cube.draw();
+        }
+        gpuProfiler.endFrame();
+        glState.newFrame();
 
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        glfwSwapBuffers(window);
+        {
+            CPU_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
 
     // optional: de-allocate all resources once they've outlived their purpose:
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &lightCubeVAO);
-    glDeleteBuffers(1, &VBO);
+    cube.release();
+    if (objModel)
+    {
+        objModel->mesh.release();
+    }
+    if (lightClusters)
+    {
+        lightClusters->printStats();
+        lightClusters->release();
+        deferred->release();
+    }
+    if (shadows)
+    {
+        shadows->printStats();
+        shadows->release();
+    }
+    if (pointShadows)
+    {
+        pointShadows->printStats();
+        pointShadows->release();
+    }
+    if (ibl)
+    {
+        ibl->release();
+    }
+    glDeleteBuffers(1, &cameraBuffer.ID);
+    shaderReloader.stop();
+    gpuProfiler.printReport();
+    gpuProfiler.writeFromEnvironment();
+    gpuProfiler.release();
+    cpuProfiler.writeFromEnvironment();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
@@ -202,9 +619,19 @@ int main()
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void processInput(GLFWwindow *window)
 {
+    CPU_ZONE("processInput");
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    // G toggles forward and deferred shading of the clustered scene, once per press
+    bool deferredKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (deferredKey && !deferredKeyHeld)
+    {
+        deferredShading = !deferredShading;
+        std::cout << "RENDERER::" << (deferredShading ? "DEFERRED" : "FORWARD") << std::endl;
+    }
+    deferredKeyHeld = deferredKey;
+
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -216,6 +643,12 @@ void processInput(GLFWwindow *window)
 }
 
 
+// bounding sphere radius of a (scaled) unit cube: half the diagonal of its scaled axes
+float cubeBoundingRadius(const glm::mat4 &model)
+{
+    return 0.5f * glm::length(glm::vec3(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+}
+
 // glfw: whenever the mouse moves, this callback is called
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
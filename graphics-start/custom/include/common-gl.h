@@ -11,6 +11,9 @@
 #define GL_SILENCE_DEPRECATION
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <my/headless.h>
+#include "gl-state.h"
+#include <my/bench.h>
 #include<iostream>
 using namespace std;
 
@@ -20,6 +23,10 @@ GLFWwindow* myOpenGLInit(unsigned width, unsigned height, const char* title);
 void checkShaderCompile(unsigned int shader);
 void checkProgramLink(unsigned int shaderProgram);
 
+// called by framebufferSizeCallback after the viewport, e.g. to keep the camera's aspect in step with the window
+typedef void (*FramebufferResizeHandler)(int width, int height);
+FramebufferResizeHandler framebufferResizeHandler = NULL;
+
 
 ///
 
@@ -38,6 +45,9 @@ void handleEscOnClose(GLFWwindow* window){
  */
 void framebufferSizeCallback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
+    if(framebufferResizeHandler != NULL){
+        framebufferResizeHandler(width, height);
+    }
 }
 
 
@@ -0,0 +1,419 @@
+//
+//  gl-state.h
+//  graphics-start
+//
+//  Shadow copy of the GL state the chapters touch every frame.
+//  Calls that would set a value which is already current are skipped, everything else is forwarded
+//  to GL and remembered. Each call is counted as issued or elided so the savings show up per frame.
+//
+//  The cache only sees calls that go through it. After raw GL calls that change the tracked state,
+//  call glState.invalidate() (or the invalidate of that kind) so the next call is issued again.
+//  Deleting objects through the cache keeps deleted names from staying "bound" in the shadow.
+//
+
+#ifndef gl_state_h
+#define gl_state_h
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <iostream>
+
+struct GLStateCounters
+{
+    unsigned int issued = 0;
+    unsigned int elided = 0;
+    unsigned int draws = 0;
+};
+
+class GLStateCache
+{
+public:
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+    static const unsigned int MAX_BUFFER_BINDINGS = 32;
+
+    GLStateCache() { invalidate(); }
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+
+    // unit is the index (0, 1, ...), not GL_TEXTUREi
+    void activeTexture(GLuint unit);
+    // binds to the given unit and only switches the active unit when the binding actually changes
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    void enable(GLenum cap) { setEnabled(cap, true); }
+    void disable(GLenum cap) { setEnabled(cap, false); }
+    void setEnabled(GLenum cap, bool enabled);
+    void depthFunc(GLenum func);
+    void depthMask(GLboolean mask);
+    void blendFunc(GLenum sfactor, GLenum dfactor);
+
+    // draw calls are not state, they only go through the cache to be counted
+    void drawArrays(GLenum mode, GLint first, GLsizei count);
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+    void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+    void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances);
+
+    // delete through the cache so a recycled name is not mistaken for the one that was bound
+    void deleteProgram(GLuint program);
+    void deleteVertexArrays(GLsizei n, const GLuint *vaos);
+    void deleteBuffers(GLsizei n, const GLuint *buffers);
+    void deleteTextures(GLsizei n, const GLuint *textures);
+
+    // forget the shadowed state, the next call of that kind is issued
+    void invalidate();
+    void invalidateProgram() { program = UNKNOWN; }
+    void invalidateTextures();
+
+    // call once per frame, moves the counters of the frame that just ended into lastFrame
+    void newFrame();
+    void printStats() const;
+
+    GLStateCounters frame;
+    GLStateCounters lastFrame;
+    GLStateCounters total;
+    unsigned int frames = 0;
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    enum BufferTarget { ARRAY, ELEMENT_ARRAY, UNIFORM, PIXEL_UNPACK, PIXEL_PACK, COPY_READ, COPY_WRITE, TEXTURE_BUFFER_DATA, BUFFER_TARGET_COUNT };
+    enum TextureTarget { TEXTURE_2D, TEXTURE_CUBE_MAP, TEXTURE_2D_ARRAY, TEXTURE_3D, TEXTURE_BUFFER, TEXTURE_TARGET_COUNT };
+    enum Capability { DEPTH_TEST, BLEND, CULL_FACE, STENCIL_TEST, SCISSOR_TEST, CAPABILITY_COUNT };
+
+    static int bufferIndex(GLenum target);
+    static int textureIndex(GLenum target);
+    static int capabilityIndex(GLenum cap);
+
+    // true if the call has to be issued; counts it either way
+    bool change(GLuint &shadow, GLuint value);
+    void issued() { frame.issued++; }
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffers[BUFFER_TARGET_COUNT];
+    GLuint indexedUniformBuffers[MAX_BUFFER_BINDINGS];
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+    GLuint capabilities[CAPABILITY_COUNT];
+    GLuint depthFuncValue;
+    GLuint depthMaskValue;
+    GLuint blendSource;
+    GLuint blendDestination;
+};
+
+// the state of the main context; other contexts (e.g. the shader reload thread) call GL directly
+GLStateCache glState;
+
+
+bool GLStateCache::change(GLuint &shadow, GLuint value)
+{
+    if (shadow == value)
+    {
+        frame.elided++;
+        return false;
+    }
+    shadow = value;
+    frame.issued++;
+    return true;
+}
+
+int GLStateCache::bufferIndex(GLenum target)
+{
+    switch (target)
+    {
+        case GL_ARRAY_BUFFER: return ARRAY;
+        case GL_ELEMENT_ARRAY_BUFFER: return ELEMENT_ARRAY;
+        case GL_UNIFORM_BUFFER: return UNIFORM;
+        case GL_PIXEL_UNPACK_BUFFER: return PIXEL_UNPACK;
+        case GL_PIXEL_PACK_BUFFER: return PIXEL_PACK;
+        case GL_COPY_READ_BUFFER: return COPY_READ;
+        case GL_COPY_WRITE_BUFFER: return COPY_WRITE;
+        case GL_TEXTURE_BUFFER: return TEXTURE_BUFFER_DATA;
+        default: return -1;
+    }
+}
+
+int GLStateCache::textureIndex(GLenum target)
+{
+    switch (target)
+    {
+        case GL_TEXTURE_2D: return TEXTURE_2D;
+        case GL_TEXTURE_CUBE_MAP: return TEXTURE_CUBE_MAP;
+        case GL_TEXTURE_2D_ARRAY: return TEXTURE_2D_ARRAY;
+        case GL_TEXTURE_3D: return TEXTURE_3D;
+        case GL_TEXTURE_BUFFER: return TEXTURE_BUFFER;
+        default: return -1;
+    }
+}
+
+int GLStateCache::capabilityIndex(GLenum cap)
+{
+    switch (cap)
+    {
+        case GL_DEPTH_TEST: return DEPTH_TEST;
+        case GL_BLEND: return BLEND;
+        case GL_CULL_FACE: return CULL_FACE;
+        case GL_STENCIL_TEST: return STENCIL_TEST;
+        case GL_SCISSOR_TEST: return SCISSOR_TEST;
+        default: return -1;
+    }
+}
+
+void GLStateCache::useProgram(GLuint id)
+{
+    if (change(program, id))
+    {
+        glUseProgram(id);
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+    if (change(vertexArray, vao))
+    {
+        glBindVertexArray(vao);
+        // the element array binding is part of the vertex array object
+        buffers[ELEMENT_ARRAY] = UNKNOWN;
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    int index = bufferIndex(target);
+    if (index < 0)
+    {
+        issued();
+        glBindBuffer(target, buffer);
+    }
+    else if (change(buffers[index], buffer))
+    {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GLStateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    if (target != GL_UNIFORM_BUFFER || index >= MAX_BUFFER_BINDINGS)
+    {
+        issued();
+        glBindBufferBase(target, index, buffer);
+        int generic = bufferIndex(target);
+        if (generic >= 0)
+        {
+            buffers[generic] = buffer;
+        }
+    }
+    else if (change(indexedUniformBuffers[index], buffer))
+    {
+        glBindBufferBase(target, index, buffer);
+        // also binds the generic target
+        buffers[UNIFORM] = buffer;
+    }
+}
+
+void GLStateCache::activeTexture(GLuint unit)
+{
+    if (change(activeUnit, unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    int index = textureIndex(target);
+    if (index < 0 || unit >= MAX_TEXTURE_UNITS)
+    {
+        activeTexture(unit);
+        issued();
+        glBindTexture(target, texture);
+        return;
+    }
+
+    if (textures[unit][index] == texture)
+    {
+        frame.elided++;
+        return;
+    }
+    activeTexture(unit);
+    change(textures[unit][index], texture);
+    glBindTexture(target, texture);
+}
+
+void GLStateCache::setEnabled(GLenum cap, bool enabled)
+{
+    int index = capabilityIndex(cap);
+    if (index >= 0 && !change(capabilities[index], enabled ? 1 : 0))
+    {
+        return;
+    }
+    if (index < 0)
+    {
+        issued();
+    }
+
+    if (enabled)
+    {
+        glEnable(cap);
+    }
+    else
+    {
+        glDisable(cap);
+    }
+}
+
+void GLStateCache::depthFunc(GLenum func)
+{
+    if (change(depthFuncValue, func))
+    {
+        glDepthFunc(func);
+    }
+}
+
+void GLStateCache::depthMask(GLboolean mask)
+{
+    if (change(depthMaskValue, mask ? 1 : 0))
+    {
+        glDepthMask(mask);
+    }
+}
+
+void GLStateCache::blendFunc(GLenum sfactor, GLenum dfactor)
+{
+    if (blendSource == sfactor && blendDestination == dfactor)
+    {
+        frame.elided++;
+        return;
+    }
+    blendSource = sfactor;
+    blendDestination = dfactor;
+    issued();
+    glBlendFunc(sfactor, dfactor);
+}
+
+void GLStateCache::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    frame.draws++;
+    glDrawArrays(mode, first, count);
+}
+
+void GLStateCache::drawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    frame.draws++;
+    glDrawElements(mode, count, type, indices);
+}
+
+void GLStateCache::drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    frame.draws++;
+    glDrawArraysInstanced(mode, first, count, instances);
+}
+
+void GLStateCache::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances)
+{
+    frame.draws++;
+    glDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+void GLStateCache::deleteProgram(GLuint id)
+{
+    glDeleteProgram(id);
+    // a deleted program stays in use until another one is bound, but its name may be reused
+    if (program == id)
+    {
+        program = UNKNOWN;
+    }
+}
+
+void GLStateCache::deleteVertexArrays(GLsizei n, const GLuint *vaos)
+{
+    glDeleteVertexArrays(n, vaos);
+    for (GLsizei i = 0; i < n; i++)
+    {
+        if (vertexArray == vaos[i])
+        {
+            vertexArray = 0;
+            buffers[ELEMENT_ARRAY] = 0;
+        }
+    }
+}
+
+void GLStateCache::deleteBuffers(GLsizei n, const GLuint *names)
+{
+    glDeleteBuffers(n, names);
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (GLuint &buffer : buffers)
+        {
+            if (buffer == names[i]) buffer = 0;
+        }
+        for (GLuint &buffer : indexedUniformBuffers)
+        {
+            if (buffer == names[i]) buffer = 0;
+        }
+    }
+}
+
+void GLStateCache::deleteTextures(GLsizei n, const GLuint *names)
+{
+    glDeleteTextures(n, names);
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+        {
+            for (GLuint &texture : textures[unit])
+            {
+                if (texture == names[i]) texture = 0;
+            }
+        }
+    }
+}
+
+void GLStateCache::invalidate()
+{
+    program = UNKNOWN;
+    vertexArray = UNKNOWN;
+    for (GLuint &buffer : buffers) buffer = UNKNOWN;
+    for (GLuint &buffer : indexedUniformBuffers) buffer = UNKNOWN;
+    invalidateTextures();
+    for (GLuint &capability : capabilities) capability = UNKNOWN;
+    depthFuncValue = UNKNOWN;
+    depthMaskValue = UNKNOWN;
+    blendSource = UNKNOWN;
+    blendDestination = UNKNOWN;
+}
+
+void GLStateCache::invalidateTextures()
+{
+    activeUnit = UNKNOWN;
+    for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+    {
+        for (GLuint &texture : textures[unit]) texture = UNKNOWN;
+    }
+}
+
+void GLStateCache::newFrame()
+{
+    lastFrame = frame;
+    total.issued += frame.issued;
+    total.elided += frame.elided;
+    total.draws += frame.draws;
+    frame = GLStateCounters();
+    frames++;
+}
+
+void GLStateCache::printStats() const
+{
+    std::cout << "GL_STATE::CALLS last frame issued=" << lastFrame.issued << " elided=" << lastFrame.elided << " draws=" << lastFrame.draws;
+    if (frames > 0)
+    {
+        std::cout << ", per frame over " << frames << " frames issued=" << (double)total.issued / frames
+                  << " elided=" << (double)total.elided / frames << " draws=" << (double)total.draws / frames;
+    }
+    std::cout << std::endl;
+}
+
+#endif /* gl_state_h */
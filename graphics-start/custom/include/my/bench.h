@@ -0,0 +1,496 @@
+//
+//  bench.h
+//  graphics-start
+//
+//  Deterministic benchmark mode, active when GRAPHICS_BENCH is defined (see bench.sh).
+//  Like headless.h it sits behind the GLFW calls the chapters already make: glfwGetKey, the cursor and
+//  scroll callbacks and glfwGetTime are fed from a camera path instead of the user, time advances by a
+//  fixed step per frame, and glfwSwapBuffers measures the frame. The chapters need no bench code.
+//
+//  The path is read from BENCH_PATH, or generated (a fixed walk and look around) when that is not set.
+//  A path is recorded from a live run with BENCH_RECORD=<file>; input then stays live.
+//
+//  path file: one line per frame, "<key mask> <cursor x> <cursor y> <scroll>", the bits of the key mask
+//  follow benchKeys. Lines starting with # are comments.
+//
+//  BENCH_FRAMES   measured frames (default 600)
+//  BENCH_WARMUP   frames run before measuring (default 60)
+//  BENCH_SCENE    name written into the result
+//  BENCH_OUT      result file, the result goes to stdout when not set
+//
+//  Per measured frame it takes the CPU time from the end of one swap to the next, the GPU time of the
+//  same span (GL_TIME_ELAPSED, read back three frames late), and draw calls plus issued and elided
+//  state changes from glState. The result is JSON with mean/p50/p95/p99/max of each.
+//
+
+#ifndef my_bench_h
+#define my_bench_h
+
+#ifdef GRAPHICS_BENCH
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <gl-state.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// keys a path can hold, bit i of the key mask is benchKeys[i]
+const int benchKeys[] = {
+    GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D,
+};
+const int BENCH_KEY_COUNT = sizeof(benchKeys) / sizeof(benchKeys[0]);
+
+struct BenchInput
+{
+    uint32_t keys = 0;
+    double cursorX = 0.0;
+    double cursorY = 0.0;
+    double scroll = 0.0;
+};
+
+class Bench
+{
+public:
+    static const int QUERY_FRAMES = 3;
+    static constexpr double FRAME_TIME = 1.0 / 60.0;
+
+    Bench();
+
+    int getKey(GLFWwindow* window, int key);
+    double getTime();
+    GLFWcursorposfun setCursorPosCallback(GLFWwindow* window, GLFWcursorposfun callback);
+    GLFWscrollfun setScrollCallback(GLFWwindow* window, GLFWscrollfun callback);
+    void pollEvents();
+    void swapBuffers(GLFWwindow* window);
+    void terminate();
+
+    static BenchInput generatedInput(unsigned frame);
+
+private:
+    struct Samples
+    {
+        std::vector<double> values;
+        void write(std::ostream &out, const char* name) const;
+    };
+
+    bool loadPath(const std::string &path);
+    void savePath(const std::string &path) const;
+    const BenchInput& currentInput() const;
+    void beginGpuFrame();
+    // false while the result is not available yet and wait is false, the query then stays issued
+    bool readQuery(int index, bool wait);
+    void endGpuFrame();
+    void writeResult() const;
+
+    static void recordCursor(GLFWwindow* window, double x, double y);
+    static void recordScroll(GLFWwindow* window, double xoffset, double yoffset);
+
+    bool recording = false;
+    std::string recordPath;
+    std::string pathName = "generated";
+    std::vector<BenchInput> path;
+    BenchInput live;
+
+    unsigned frame = 0;
+    unsigned warmup = 60;
+    unsigned frames = 600;
+    std::string scene = "scene";
+
+    GLFWcursorposfun cursorCallback = NULL;
+    GLFWscrollfun scrollCallback = NULL;
+    GLFWwindow* window = NULL;
+
+    std::chrono::steady_clock::time_point frameStart;
+    bool frameStarted = false;
+
+    GLuint queries[QUERY_FRAMES] = { 0, 0, 0 };
+    bool queryIssued[QUERY_FRAMES] = { false, false, false };
+    bool queryMeasured[QUERY_FRAMES] = { false, false, false };
+    int queryIndex = 0;
+    bool queryActive = false;
+    // frames without a GPU sample because the query ring had not drained yet
+    unsigned gpuFramesSkipped = 0;
+    unsigned lastStateFrames = 0;
+
+    Samples cpuMs, gpuMs, drawCalls, stateChanges, elidedStateChanges;
+};
+
+Bench bench;
+
+
+Bench::Bench()
+{
+    if (const char* value = getenv("BENCH_FRAMES")) frames = (unsigned)std::max(1, atoi(value));
+    if (const char* value = getenv("BENCH_WARMUP")) warmup = (unsigned)std::max(0, atoi(value));
+    if (const char* value = getenv("BENCH_SCENE")) scene = value;
+
+    if (const char* value = getenv("BENCH_RECORD"))
+    {
+        recording = true;
+        recordPath = value;
+    }
+    else if (const char* value = getenv("BENCH_PATH"))
+    {
+        if (loadPath(value))
+        {
+            pathName = value;
+        }
+    }
+}
+
+/**
+ Walks forward, left, back and right (W, A, S, D) for two seconds each while the view sweeps left/right and
+ up/down, and zooms in and out once per loop. Purely a function of the frame index.
+ */
+BenchInput Bench::generatedInput(unsigned frame)
+{
+    const double pi = 3.14159265358979323846;
+    BenchInput input;
+    input.keys = 1u << ((frame / 120) % BENCH_KEY_COUNT);
+    input.cursorX = 400.0 + 300.0 * std::sin(frame * 2.0 * pi / 480.0);
+    input.cursorY = 300.0 + 100.0 * std::sin(frame * 2.0 * pi / 240.0);
+    unsigned phase = frame % 480;
+    input.scroll = (phase >= 60 && phase < 90) ? 1.0 : (phase >= 180 && phase < 210) ? -1.0 : 0.0;
+    return input;
+}
+
+bool Bench::loadPath(const std::string &file)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        std::cout << "ERROR::BENCH::PATH_NOT_READ: " << file << ", using the generated path" << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        BenchInput input;
+        fields >> std::hex >> input.keys >> std::dec >> input.cursorX >> input.cursorY >> input.scroll;
+        if (fields)
+        {
+            path.push_back(input);
+        }
+    }
+    return !path.empty();
+}
+
+void Bench::savePath(const std::string &file) const
+{
+    std::ofstream out(file);
+    if (!out)
+    {
+        std::cout << "ERROR::BENCH::PATH_NOT_WRITTEN: " << file << std::endl;
+        return;
+    }
+    out << "# graphics-start bench path: key mask (W A S D), cursor x, cursor y, scroll\n";
+    for (const BenchInput &input : path)
+    {
+        out << std::hex << input.keys << std::dec << ' ' << input.cursorX << ' ' << input.cursorY << ' ' << input.scroll << '\n';
+    }
+    std::cout << "BENCH::PATH_RECORDED " << path.size() << " frames to " << file << std::endl;
+}
+
+const BenchInput& Bench::currentInput() const
+{
+    static BenchInput generated;
+    if (path.empty())
+    {
+        generated = generatedInput(frame);
+        return generated;
+    }
+    // a recorded path shorter than the run loops
+    return path[frame % path.size()];
+}
+
+int Bench::getKey(GLFWwindow* window, int key)
+{
+    if (recording)
+    {
+        int state = glfwGetKey(window, key);
+        for (int i = 0; i < BENCH_KEY_COUNT; i++)
+        {
+            if (benchKeys[i] == key && state == GLFW_PRESS)
+            {
+                live.keys |= 1u << i;
+            }
+        }
+        return state;
+    }
+
+    for (int i = 0; i < BENCH_KEY_COUNT; i++)
+    {
+        if (benchKeys[i] == key)
+        {
+            return (currentInput().keys & (1u << i)) ? GLFW_PRESS : GLFW_RELEASE;
+        }
+    }
+    return GLFW_RELEASE;
+}
+
+double Bench::getTime()
+{
+    return recording ? glfwGetTime() : frame * FRAME_TIME;
+}
+
+void Bench::recordCursor(GLFWwindow* window, double x, double y)
+{
+    bench.live.cursorX = x;
+    bench.live.cursorY = y;
+    if (bench.cursorCallback) bench.cursorCallback(window, x, y);
+}
+
+void Bench::recordScroll(GLFWwindow* window, double xoffset, double yoffset)
+{
+    bench.live.scroll += yoffset;
+    if (bench.scrollCallback) bench.scrollCallback(window, xoffset, yoffset);
+}
+
+GLFWcursorposfun Bench::setCursorPosCallback(GLFWwindow* window, GLFWcursorposfun callback)
+{
+    GLFWcursorposfun previous = cursorCallback;
+    cursorCallback = callback;
+    this->window = window;
+    if (recording)
+    {
+        glfwSetCursorPosCallback(window, recordCursor);
+    }
+    return previous;
+}
+
+GLFWscrollfun Bench::setScrollCallback(GLFWwindow* window, GLFWscrollfun callback)
+{
+    GLFWscrollfun previous = scrollCallback;
+    scrollCallback = callback;
+    this->window = window;
+    if (recording)
+    {
+        glfwSetScrollCallback(window, recordScroll);
+    }
+    return previous;
+}
+
+void Bench::pollEvents()
+{
+    glfwPollEvents();
+    if (recording)
+    {
+        return;
+    }
+
+    // the input of the frame that starts now
+    const BenchInput &input = currentInput();
+    if (cursorCallback)
+    {
+        cursorCallback(window, input.cursorX, input.cursorY);
+    }
+    if (scrollCallback && input.scroll != 0.0)
+    {
+        scrollCallback(window, 0.0, input.scroll);
+    }
+}
+
+void Bench::beginGpuFrame()
+{
+    if (queries[0] == 0)
+    {
+        glGenQueries(QUERY_FRAMES, queries);
+    }
+
+    // this query was issued QUERY_FRAMES frames ago and is normally done; when the GPU is further
+    // behind, this frame goes unmeasured rather than waiting, which would time the bench's own stall
+    if (!readQuery(queryIndex, false))
+    {
+        gpuFramesSkipped++;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, queries[queryIndex]);
+    queryActive = true;
+}
+
+bool Bench::readQuery(int index, bool wait)
+{
+    if (!queryIssued[index])
+    {
+        return true;
+    }
+    if (!wait)
+    {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            return false;
+        }
+    }
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &elapsed);
+    if (queryMeasured[index])
+    {
+        gpuMs.values.push_back(elapsed / 1.0e6);
+    }
+    queryIssued[index] = false;
+    return true;
+}
+
+void Bench::endGpuFrame()
+{
+    if (!queryActive)
+    {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    queryActive = false;
+    queryIssued[queryIndex] = true;
+    queryMeasured[queryIndex] = frame >= warmup;
+    queryIndex = (queryIndex + 1) % QUERY_FRAMES;
+}
+
+void Bench::swapBuffers(GLFWwindow* window)
+{
+    bool measured = !recording && frame >= warmup;
+    if (frameStarted && measured)
+    {
+        cpuMs.values.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+    }
+    endGpuFrame();
+
+    // chapters that do not close their glState frame get it closed here
+    if (glState.frames == lastStateFrames)
+    {
+        glState.newFrame();
+    }
+    lastStateFrames = glState.frames;
+    if (frameStarted && measured)
+    {
+        drawCalls.values.push_back(glState.lastFrame.draws);
+        stateChanges.values.push_back(glState.lastFrame.issued);
+        elidedStateChanges.values.push_back(glState.lastFrame.elided);
+    }
+
+    glfwSwapBuffers(window);
+
+    if (recording)
+    {
+        path.push_back(live);
+        live.scroll = 0.0;
+        live.keys = 0;
+    }
+
+    frame++;
+    if (!recording && frame >= warmup + frames)
+    {
+        glfwSetWindowShouldClose(window, true);
+    }
+
+    if (!recording)
+    {
+        beginGpuFrame();
+    }
+    frameStart = std::chrono::steady_clock::now();
+    frameStarted = true;
+}
+
+void Bench::Samples::write(std::ostream &out, const char* name) const
+{
+    std::vector<double> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+        return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()))];
+    };
+    double sum = 0.0;
+    for (double value : sorted) sum += value;
+
+    out << "\"" << name << "\":{\"samples\":" << sorted.size()
+        << ",\"mean\":" << (sorted.empty() ? 0.0 : sum / sorted.size())
+        << ",\"p50\":" << percentile(50.0) << ",\"p95\":" << percentile(95.0) << ",\"p99\":" << percentile(99.0)
+        << ",\"max\":" << (sorted.empty() ? 0.0 : sorted.back()) << "}";
+}
+
+void Bench::writeResult() const
+{
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+
+    std::ostringstream json;
+    json << "{\"scene\":\"" << scene << "\",\"path\":\"" << pathName << "\",\"renderer\":\"" << (renderer ? renderer : "") << "\""
+         << ",\"warmup\":" << warmup << ",\"frames\":" << frames << ",\"gpuFramesSkipped\":" << gpuFramesSkipped << ",";
+    cpuMs.write(json, "cpuMs"); json << ",";
+    gpuMs.write(json, "gpuMs"); json << ",";
+    drawCalls.write(json, "drawCalls"); json << ",";
+    stateChanges.write(json, "stateChanges"); json << ",";
+    elidedStateChanges.write(json, "elidedStateChanges");
+    json << "}";
+
+    if (const char* out = getenv("BENCH_OUT"))
+    {
+        std::ofstream file(out);
+        file << json.str() << "\n";
+        if (!file)
+        {
+            std::cout << "ERROR::BENCH::RESULT_NOT_WRITTEN: " << out << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "BENCH::RESULT " << json.str() << std::endl;
+    }
+}
+
+void Bench::terminate()
+{
+    if (recording)
+    {
+        savePath(recordPath);
+    }
+    else if (queries[0] != 0)
+    {
+        // the query opened after the last swap covers no measured frame
+        if (queryActive)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        for (int i = 0; i < QUERY_FRAMES; i++)
+        {
+            readQuery((queryIndex + i) % QUERY_FRAMES, true);
+        }
+        writeResult();
+        glDeleteQueries(QUERY_FRAMES, queries);
+    }
+    glfwTerminate();
+}
+
+int benchGetKey(GLFWwindow* window, int key) { return bench.getKey(window, key); }
+double benchGetTime(void) { return bench.getTime(); }
+GLFWcursorposfun benchSetCursorPosCallback(GLFWwindow* window, GLFWcursorposfun callback) { return bench.setCursorPosCallback(window, callback); }
+GLFWscrollfun benchSetScrollCallback(GLFWwindow* window, GLFWscrollfun callback) { return bench.setScrollCallback(window, callback); }
+void benchPollEvents(void) { bench.pollEvents(); }
+void benchSwapBuffers(GLFWwindow* window) { bench.swapBuffers(window); }
+void benchTerminate(void) { bench.terminate(); }
+
+// everything below this header talks to the bench instead of GLFW
+#define glfwGetKey benchGetKey
+#define glfwGetTime benchGetTime
+#define glfwSetCursorPosCallback benchSetCursorPosCallback
+#define glfwSetScrollCallback benchSetScrollCallback
+#define glfwPollEvents benchPollEvents
+#define glfwSwapBuffers benchSwapBuffers
+#define glfwTerminate benchTerminate
+
+#endif /* GRAPHICS_BENCH */
+
+#endif /* my_bench_h */
@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <my/frustum.h>
 
 #include <vector>
 
@@ -21,9 +22,14 @@ const float PITCH       =  0.0f;
 const float SPEED       =  2.5f;
 const float SENSITIVITY =  0.1f;
 const float ZOOM        =  45.0f;
+const float NEAR_PLANE  =  0.1f;
+const float FAR_PLANE   =  100.0f;
 
 
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+// The matrices are cached and only rebuilt after the camera changed; Version() changes with every change, so
+// code that derives data from the camera (uniform buffers, culling) can skip work while it stays the same.
+// After writing the attributes directly, call MarkDirty().
 class Camera
 {
 public:
@@ -40,9 +46,13 @@ public:
     float MovementSpeed;
     float MouseSensitivity;
     float Zoom;
+    // projection
+    float Aspect;
+    float NearPlane;
+    float FarPlane;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), Aspect(4.0f / 3.0f), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE)
     {
         Position = position;
         WorldUp = up;
@@ -51,7 +61,7 @@ public:
         updateCameraVectors();
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), Aspect(4.0f / 3.0f), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
@@ -61,15 +71,72 @@ public:
     }
 
     // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix()
+    const glm::mat4& GetViewMatrix()
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        updateMatrices();
+        return view;
+    }
+
+    // returns the perspective projection for Zoom, Aspect, NearPlane and FarPlane
+    const glm::mat4& GetProjectionMatrix()
+    {
+        updateMatrices();
+        return projection;
+    }
+
+    // projection * view
+    const glm::mat4& GetViewProjectionMatrix()
+    {
+        updateMatrices();
+        return viewProjection;
+    }
+
+    const glm::mat4& GetInverseViewProjectionMatrix()
+    {
+        updateMatrices();
+        return inverseViewProjection;
+    }
+
+    // world space clip planes of the view projection, for cullSpheres / cullBoxes
+    const Frustum& GetFrustum()
+    {
+        updateMatrices();
+        return frustum;
+    }
+
+    // changes with every change of the camera
+    unsigned int Version() const
+    {
+        return version;
+    }
+
+    // sets the projection parameters, e.g. from the framebuffer size callback
+    void SetPerspective(float aspect, float nearPlane = NEAR_PLANE, float farPlane = FAR_PLANE)
+    {
+        if (aspect == Aspect && nearPlane == NearPlane && farPlane == FarPlane)
+            return;
+        Aspect = aspect;
+        NearPlane = nearPlane;
+        FarPlane = farPlane;
+        projectionDirty = true;
+        version++;
+    }
+
+    // call after changing Position, Yaw, Pitch, Zoom etc. directly
+    void MarkDirty()
+    {
+        updateCameraVectors();
+        viewDirty = true;
+        projectionDirty = true;
+        version++;
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
         float velocity = MovementSpeed * deltaTime;
+        if (velocity == 0.0f)
+            return;
         if (direction == FORWARD)
             Position += Front * velocity;
         if (direction == BACKWARD)
@@ -78,6 +145,8 @@ public:
             Position -= Right * velocity;
         if (direction == RIGHT)
             Position += Right * velocity;
+        viewDirty = true;
+        version++;
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -86,6 +155,7 @@ public:
         xoffset *= MouseSensitivity;
         yoffset *= MouseSensitivity;
 
+        float oldYaw = Yaw, oldPitch = Pitch;
         Yaw   += xoffset;
         Pitch += yoffset;
 
@@ -98,21 +168,56 @@ public:
                 Pitch = -89.0f;
         }
 
+        if (Yaw == oldYaw && Pitch == oldPitch)
+            return;
+
         // update Front, Right and Up Vectors using the updated Euler angles
         updateCameraVectors();
+        viewDirty = true;
+        version++;
     }
 
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
+        float oldZoom = Zoom;
         Zoom -= (float)yoffset;
         if (Zoom < 1.0f)
             Zoom = 1.0f;
         if (Zoom > 45.0f)
             Zoom = 45.0f;
+        if (Zoom == oldZoom)
+            return;
+        projectionDirty = true;
+        version++;
     }
 
 private:
+    // cached matrices, rebuilt on the next Get after a change
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    Frustum frustum;
+    bool viewDirty = true;
+    bool projectionDirty = true;
+    unsigned int version = 1;
+
+    void updateMatrices()
+    {
+        if (!viewDirty && !projectionDirty)
+            return;
+        if (viewDirty)
+            view = glm::lookAt(Position, Position + Front, Up);
+        if (projectionDirty)
+            projection = glm::perspective(glm::radians(Zoom), Aspect, NearPlane, FarPlane);
+        viewProjection = projection * view;
+        inverseViewProjection = glm::inverse(viewProjection);
+        frustum = Frustum::fromMatrix(viewProjection);
+        viewDirty = false;
+        projectionDirty = false;
+    }
+
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
     {
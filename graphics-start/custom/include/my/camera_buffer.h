@@ -0,0 +1,74 @@
+//
+//  camera_buffer.h
+//  graphics-start
+//
+//  Per-frame camera uniform buffer.
+//  The view/projection data is uploaded once per frame into a std140 uniform block bound to
+//  CAMERA_BLOCK_BINDING, and every program that declares the Camera block (custom/shaders/camera.glsl)
+//  reads it from there, so the upload cost does not grow with the number of programs.
+//
+
+#ifndef my_camera_buffer_h
+#define my_camera_buffer_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <my/camera.h>
+#include <my/shader_s.h>
+
+// std140 layout of the Camera block
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProj;
+    glm::vec4 viewPos;
+};
+static_assert(sizeof(CameraBlock) == 3 * 64 + 16, "CameraBlock has to match the std140 layout in camera.glsl");
+
+class CameraUniformBuffer
+{
+public:
+    unsigned int ID;
+
+    // like the other GL objects of a chapter, ID is deleted by the caller before glfwTerminate
+    CameraUniformBuffer();
+
+    // uploads the camera state if it changed since the last update and binds the buffer to CAMERA_BLOCK_BINDING, call once per frame
+    void update(Camera &camera);
+
+    // the data of the last update, e.g. for CPU side culling
+    const CameraBlock& data() const { return block; }
+
+private:
+    CameraBlock block;
+    unsigned int uploadedVersion = 0;
+};
+
+
+CameraUniformBuffer::CameraUniformBuffer()
+{
+    glGenBuffers(1, &ID);
+    glState.bindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+    glState.bindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, ID);
+}
+
+void CameraUniformBuffer::update(Camera &camera)
+{
+    if (camera.Version() != uploadedVersion)
+    {
+        block.view = camera.GetViewMatrix();
+        block.projection = camera.GetProjectionMatrix();
+        block.viewProj = camera.GetViewProjectionMatrix();
+        block.viewPos = glm::vec4(camera.Position, 1.0f);
+
+        glState.bindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &block);
+        uploadedVersion = camera.Version();
+    }
+    glState.bindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, ID);
+}
+
+#endif /* my_camera_buffer_h */
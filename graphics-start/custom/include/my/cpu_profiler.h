@@ -0,0 +1,202 @@
+//
+//  cpu_profiler.h
+//  graphics-start
+//
+//  Scoped CPU zones exported as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//  Recording is off unless CPU_TRACE names the output file; a disabled zone costs one branch.
+//  Every thread records into its own ring buffer, so the hot path takes no lock: the slot is written
+//  and then published with a release store of the head. When a ring is full the oldest events are
+//  overwritten. The trace is written by writeTrace(), after the other threads have stopped.
+//
+//  void processInput(GLFWwindow *window)
+//  {
+//      CPU_ZONE("processInput");
+//      ...
+//  }
+//
+
+#ifndef my_cpu_profiler_h
+#define my_cpu_profiler_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CPU_ZONE_CONCAT_(a, b) a##b
+#define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_(a, b)
+// name has to outlive the trace, i.e. a string literal
+#define CPU_ZONE(name) CpuZone CPU_ZONE_CONCAT(cpuZone, __LINE__)(name)
+
+class CpuProfiler
+{
+public:
+    // events per thread, power of two
+    static const uint32_t RING_SIZE = 1 << 16;
+
+    struct Event
+    {
+        const char *name;
+        uint64_t begin;   // ns since the profiler started
+        uint64_t end;
+    };
+
+    struct ThreadRing
+    {
+        int id;
+        std::string name;
+        std::atomic<uint64_t> head { 0 };
+        std::unique_ptr<Event[]> events { new Event[RING_SIZE] };
+    };
+
+    CpuProfiler();
+
+    bool enabled() const { return enabledFlag; }
+    uint64_t now() const;
+
+    void record(const char *name, uint64_t begin, uint64_t end);
+    // shows up as the track name in the trace
+    void setThreadName(const std::string &name);
+
+    bool writeTrace(const std::string &path);
+    // writes to CPU_TRACE, if set
+    void writeFromEnvironment();
+
+    // text as a quoted JSON string, quotes, backslashes and control characters escaped
+    static void writeJsonString(std::ostream &out, const std::string &text);
+
+private:
+    ThreadRing& threadRing();
+
+    bool enabledFlag;
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex registryMutex;   // only taken the first time a thread records
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+};
+
+CpuProfiler cpuProfiler;
+
+class CpuZone
+{
+public:
+    CpuZone(const char *name) : name(name), begin(cpuProfiler.enabled() ? cpuProfiler.now() : 0) {}
+    ~CpuZone()
+    {
+        if (cpuProfiler.enabled())
+        {
+            cpuProfiler.record(name, begin, cpuProfiler.now());
+        }
+    }
+
+private:
+    const char *name;
+    uint64_t begin;
+};
+
+
+CpuProfiler::CpuProfiler() : enabledFlag(std::getenv("CPU_TRACE") != NULL), start(std::chrono::steady_clock::now())
+{
+}
+
+uint64_t CpuProfiler::now() const
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+CpuProfiler::ThreadRing& CpuProfiler::threadRing()
+{
+    thread_local ThreadRing *ring = nullptr;
+    if (ring == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        rings.emplace_back(new ThreadRing());
+        ring = rings.back().get();
+        ring->id = (int)rings.size();
+        ring->name = ring->id == 1 ? "main" : "thread " + std::to_string(ring->id);
+    }
+    return *ring;
+}
+
+void CpuProfiler::record(const char *name, uint64_t begin, uint64_t end)
+{
+    ThreadRing &ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head & (RING_SIZE - 1)] = Event { name, begin, end };
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void CpuProfiler::setThreadName(const std::string &name)
+{
+    if (enabledFlag)
+    {
+        threadRing().name = name;
+    }
+}
+
+void CpuProfiler::writeJsonString(std::ostream &out, const std::string &text)
+{
+    out << '"';
+    const char *digits = "0123456789abcdef";
+    for (char c : text)
+    {
+        unsigned char code = (unsigned char)c;
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (code < 0x20) out << "\\u00" << digits[code >> 4] << digits[code & 15];
+        else out << c;
+    }
+    out << '"';
+}
+
+bool CpuProfiler::writeTrace(const std::string &path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::CPU_PROFILER::FILE_NOT_WRITTEN: " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    size_t written = 0;
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const std::unique_ptr<ThreadRing> &ring : rings)
+    {
+        file << (written++ ? ",\n" : "\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->id << ",\"args\":{\"name\":";
+        writeJsonString(file, ring->name);
+        file << "}}";
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+        for (uint64_t i = first; i < head; i++)
+        {
+            const Event &event = ring->events[i & (RING_SIZE - 1)];
+            // complete events, timestamps in microseconds
+            file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->id << ",\"name\":";
+            writeJsonString(file, event.name);
+            file << ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    std::cout << "CPU_PROFILER::TRACE " << path << std::endl;
+    return true;
+}
+
+void CpuProfiler::writeFromEnvironment()
+{
+    if (const char *path = std::getenv("CPU_TRACE"))
+    {
+        writeTrace(path);
+    }
+}
+
+#endif /* my_cpu_profiler_h */
@@ -0,0 +1,186 @@
+//
+//  deferred.h
+//  graphics-start
+//
+//  Deferred shading, the alternative to the forward Phong path for scenes with many lights and
+//  heavy overdraw. The geometry pass writes surface attributes into a G-buffer (custom/shaders/
+//  gbuffer.glsl: albedo + specular strength, octahedral packed normal, depth); hidden fragments
+//  cost a few bytes of bandwidth instead of a full light loop. The lighting pass is one fullscreen
+//  triangle that rebuilds each pixel's position from depth and sums the lights of its cluster
+//  (LightClusters), with the same Phong terms as phong.fs, straight into the framebuffer that was
+//  bound when the frame began. Pixels without geometry are discarded and keep its clear color.
+//  That framebuffer gets no depth, forward draws after light() are not occluded by the scene.
+//
+//  The G-buffer follows the viewport, it is reallocated when the viewport size changes.
+//
+//  DeferredRenderer deferred;
+//  while (...)
+//  {
+//      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+//      clusters.update(camera, lights);
+//      clusters.bind();
+//      deferred.beginGeometry();
+//      ... draw with a program using gbuffer.fs ...
+//      deferred.light(camera, glm::vec3(1.0f));
+//  }
+//  deferred.release();
+//
+
+#ifndef my_deferred_h
+#define my_deferred_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <my/camera.h>
+#include <my/cpu_profiler.h>
+#include <my/fullscreen_triangle.h>
+#include <my/light_clusters.h>
+#include <my/path.h>
+#include <my/shader_s.h>
+
+#include <iostream>
+#include <string>
+
+class DeferredRenderer
+{
+public:
+    enum Target { ALBEDO_SPECULAR, NORMAL, TARGET_COUNT };
+    // texture units of the G-buffer in the lighting pass, the cluster buffers sit above them
+    static const GLuint ALBEDO_SPECULAR_UNIT = 0;
+    static const GLuint NORMAL_UNIT = 1;
+    static const GLuint DEPTH_UNIT = 2;
+
+    // defines go into the lighting program, e.g. SHADOWS_CASCADED as in the forward phong variant
+    DeferredRenderer(const std::string &defines = "");
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    // binds and clears the G-buffer, the following draws are the geometry pass
+    void beginGeometry();
+    // lights every covered pixel with the bound light clusters, into the framebuffer bound at beginGeometry
+    void light(Camera &camera, const glm::vec3 &ambientColor);
+
+    // the lighting program, e.g. to watch it for hot reloading
+    Shader& lightingShader() { return shader; }
+    void release();
+
+private:
+    Shader shader;
+    GLuint framebuffer = 0;
+    GLuint textures[TARGET_COUNT] = {};
+    GLuint depthTexture = 0;
+    FullscreenTriangle triangle;
+    GLint width = 0;
+    GLint height = 0;
+    // where the frame goes, 0 or the offscreen target of a headless run
+    GLint outputFramebuffer = 0;
+
+    void allocate(GLint width, GLint height);
+    void releaseTargets();
+};
+
+
+DeferredRenderer::DeferredRenderer(const std::string &defines) : shader(shaderPath + "/deferred_light.vs", shaderPath + "/deferred_light.fs", defines)
+{
+    shader.use();
+    shader.setInt("gAlbedoSpecular", ALBEDO_SPECULAR_UNIT);
+    shader.setInt("gNormal", NORMAL_UNIT);
+    shader.setInt("gDepth", DEPTH_UNIT);
+    LightClusters::setSamplers(shader);
+}
+
+void DeferredRenderer::allocate(GLint newWidth, GLint newHeight)
+{
+    releaseTargets();
+    width = newWidth;
+    height = newHeight;
+
+    // albedo and specular strength, packed normal
+    const GLenum formats[TARGET_COUNT] = { GL_RGBA8, GL_RG16F };
+    const GLenum layouts[TARGET_COUNT] = { GL_RGBA, GL_RG };
+    const GLenum types[TARGET_COUNT] = { GL_UNSIGNED_BYTE, GL_FLOAT };
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenTextures(TARGET_COUNT, textures);
+    for (int i = 0; i < TARGET_COUNT; i++)
+    {
+        glState.bindTexture(0, GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, layouts[i], types[i], NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
+    }
+
+    const GLenum attributes[TARGET_COUNT] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(TARGET_COUNT, attributes);
+
+    // sampled by the lighting pass, which draws into another framebuffer, so there is no feedback loop
+    glGenTextures(1, &depthTexture);
+    glState.bindTexture(0, GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::DEFERRED::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+}
+
+void DeferredRenderer::beginGeometry()
+{
+    CPU_ZONE("Deferred geometry setup");
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outputFramebuffer);
+    if (viewport[2] != width || viewport[3] != height)
+    {
+        allocate(viewport[2], viewport[3]);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    // only depth, the attributes of pixels left at the far plane are never read
+    glState.depthMask(GL_TRUE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glState.enable(GL_DEPTH_TEST);
+}
+
+void DeferredRenderer::light(Camera &camera, const glm::vec3 &ambientColor)
+{
+    CPU_ZONE("Deferred lighting");
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glState.disable(GL_DEPTH_TEST);
+
+    shader.use();
+    shader.setMat4("inverseViewProj", camera.GetInverseViewProjectionMatrix());
+    shader.setVec3("ambientColor", ambientColor);
+    glState.bindTexture(ALBEDO_SPECULAR_UNIT, GL_TEXTURE_2D, textures[ALBEDO_SPECULAR]);
+    glState.bindTexture(NORMAL_UNIT, GL_TEXTURE_2D, textures[NORMAL]);
+    glState.bindTexture(DEPTH_UNIT, GL_TEXTURE_2D, depthTexture);
+    triangle.draw();
+
+    glState.enable(GL_DEPTH_TEST);
+}
+
+void DeferredRenderer::release()
+{
+    releaseTargets();
+    triangle.release();
+}
+
+void DeferredRenderer::releaseTargets()
+{
+    if (framebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glState.deleteTextures(TARGET_COUNT, textures);
+        glState.deleteTextures(1, &depthTexture);
+        framebuffer = 0;
+        depthTexture = 0;
+        width = 0;
+        height = 0;
+    }
+}
+
+#endif /* my_deferred_h */
@@ -0,0 +1,71 @@
+//
+//  depth_pass.h
+//  graphics-start
+//
+//  Output state around a shadow depth pass, shared by shadow_cascades.h and point_shadows.h.
+//  begin() remembers the framebuffer and viewport the frame renders to, which are not necessarily 0 and
+//  the window, e.g. the offscreen target of a headless run; it then sets a square viewport, depth writes
+//  and test, and a slope scaled bias (the lookups add a normal offset on top). end() puts the output back.
+//
+//  DepthPass pass;
+//  pass.begin(resolution, depthShader);
+//  glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
+//  ... draw the casters
+//  pass.end();
+//
+
+#ifndef my_depth_pass_h
+#define my_depth_pass_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <my/shader_s.h>
+
+class DepthPass
+{
+public:
+    // remembers the output and sets up the depth state with shader current, the caller binds its framebuffer
+    void begin(int resolution, Shader &shader);
+    // back to the framebuffer and viewport that were current at begin
+    void end();
+    bool active() const { return isActive; }
+
+    // the draw framebuffer, for constructors that bind their own while they set it up
+    static GLint currentFramebuffer();
+
+private:
+    bool isActive = false;
+    GLint outputFramebuffer = 0;
+    GLint outputViewport[4] = {};
+};
+
+
+void DepthPass::begin(int resolution, Shader &shader)
+{
+    outputFramebuffer = currentFramebuffer();
+    glGetIntegerv(GL_VIEWPORT, outputViewport);
+    glViewport(0, 0, resolution, resolution);
+    glState.depthMask(GL_TRUE);
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 2.0f);
+    shader.use();
+    isActive = true;
+}
+
+void DepthPass::end()
+{
+    isActive = false;
+    glState.disable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glViewport(outputViewport[0], outputViewport[1], outputViewport[2], outputViewport[3]);
+}
+
+GLint DepthPass::currentFramebuffer()
+{
+    GLint framebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    return framebuffer;
+}
+
+#endif /* my_depth_pass_h */
@@ -0,0 +1,378 @@
+//
+//  frustum.h
+//  graphics-start
+//
+//  View frustum and batch culling.
+//  Frustum::fromMatrix extracts the six clip planes of a projection * view matrix. Bounds are kept
+//  structure-of-arrays, so the cull functions test one plane against 8 (AVX) or 4 (SSE, NEON)
+//  objects per instruction, with a scalar loop for the rest. The result is either a visibility
+//  bitmask (bit i of word i / 32 set when object i may be visible) or a compacted index list.
+//
+
+#ifndef my_frustum_h
+#define my_frustum_h
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+struct Frustum
+{
+    enum Plane { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR, PLANE_COUNT };
+
+    // xyz is the unit normal pointing into the frustum, w the distance, so inside is dot(n, p) + w >= 0
+    glm::vec4 planes[PLANE_COUNT];
+
+    // planes of the clip volume of an OpenGL projection * view (* model) matrix, in the matrix's input space
+    static Frustum fromMatrix(const glm::mat4 &m);
+
+    bool intersectsSphere(const glm::vec3 &center, float radius) const;
+    bool intersectsBox(const glm::vec3 &min, const glm::vec3 &max) const;
+};
+
+// bounding spheres as structure-of-arrays
+struct BoundingSpheres
+{
+    std::vector<float> x, y, z, radius;
+
+    void push_back(const glm::vec3 &center, float r)
+    {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(r);
+    }
+    void clear() { x.clear(); y.clear(); z.clear(); radius.clear(); }
+    size_t size() const { return x.size(); }
+};
+
+// axis aligned boxes as center and half extent, structure-of-arrays
+struct BoundingBoxes
+{
+    std::vector<float> x, y, z;
+    std::vector<float> extentX, extentY, extentZ;
+
+    void push_back(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        glm::vec3 center = (min + max) * 0.5f;
+        glm::vec3 extent = (max - min) * 0.5f;
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        extentX.push_back(extent.x);
+        extentY.push_back(extent.y);
+        extentZ.push_back(extent.z);
+    }
+    void clear() { x.clear(); y.clear(); z.clear(); extentX.clear(); extentY.clear(); extentZ.clear(); }
+    size_t size() const { return x.size(); }
+};
+
+// number of 32-bit mask words for count objects
+inline size_t frustumMaskWords(size_t count) { return (count + 31) / 32; }
+
+// set bits of a mask word, and the index of the lowest one (bits not 0); MSVC has no __builtin_popcount/ctz,
+// and POPCNT is not part of baseline x64, so it counts in SWAR
+inline int maskBitCount(uint32_t bits)
+{
+#ifdef _MSC_VER
+    bits = bits - ((bits >> 1) & 0x55555555u);
+    bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+    return (int)((((bits + (bits >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+#else
+    return __builtin_popcount(bits);
+#endif
+}
+
+inline int maskLowestBit(uint32_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// fill visibleMask (frustumMaskWords(size) words) and return the number of visible objects
+size_t cullSpheres(const Frustum &frustum, const BoundingSpheres &spheres, uint32_t *visibleMask);
+size_t cullBoxes(const Frustum &frustum, const BoundingBoxes &boxes, uint32_t *visibleMask);
+
+// replace visibleIndices with the indices of the visible objects, in ascending order
+size_t cullSpheres(const Frustum &frustum, const BoundingSpheres &spheres, std::vector<uint32_t> &visibleIndices);
+size_t cullBoxes(const Frustum &frustum, const BoundingBoxes &boxes, std::vector<uint32_t> &visibleIndices);
+
+
+Frustum Frustum::fromMatrix(const glm::mat4 &m)
+{
+    // glm is column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[PLANE_LEFT]   = row3 + row0;
+    frustum.planes[PLANE_RIGHT]  = row3 - row0;
+    frustum.planes[PLANE_BOTTOM] = row3 + row1;
+    frustum.planes[PLANE_TOP]    = row3 - row1;
+    frustum.planes[PLANE_NEAR]   = row3 + row2;
+    frustum.planes[PLANE_FAR]    = row3 - row2;
+
+    for (glm::vec4 &plane : frustum.planes)
+    {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f)
+        {
+            plane /= length;
+        }
+    }
+    return frustum;
+}
+
+bool Frustum::intersectsSphere(const glm::vec3 &center, float radius) const
+{
+    for (const glm::vec4 &plane : planes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersectsBox(const glm::vec3 &min, const glm::vec3 &max) const
+{
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+    for (const glm::vec4 &plane : planes)
+    {
+        glm::vec3 normal(plane);
+        float reach = glm::dot(glm::abs(normal), extent);
+        if (glm::dot(normal, center) + plane.w < -reach)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+namespace frustum_detail
+{
+#if defined(__AVX__)
+    const size_t WIDTH = 8;
+    typedef __m256 Lanes;
+    inline Lanes load(const float *p) { return _mm256_loadu_ps(p); }
+    inline Lanes splat(float v) { return _mm256_set1_ps(v); }
+    inline Lanes zero() { return _mm256_setzero_ps(); }
+    inline Lanes madd(Lanes a, Lanes b, Lanes c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+    inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+    inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+    inline Lanes lessThan(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline Lanes either(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+    inline uint32_t bits(Lanes mask) { return (uint32_t)_mm256_movemask_ps(mask); }
+#elif defined(__SSE__) || defined(_M_X64)
+    const size_t WIDTH = 4;
+    typedef __m128 Lanes;
+    inline Lanes load(const float *p) { return _mm_loadu_ps(p); }
+    inline Lanes splat(float v) { return _mm_set1_ps(v); }
+    inline Lanes zero() { return _mm_setzero_ps(); }
+    inline Lanes madd(Lanes a, Lanes b, Lanes c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+    inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+    inline Lanes lessThan(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+    inline Lanes either(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+    inline uint32_t bits(Lanes mask) { return (uint32_t)_mm_movemask_ps(mask); }
+#elif defined(__ARM_NEON)
+    const size_t WIDTH = 4;
+    typedef float32x4_t Lanes;
+    inline Lanes load(const float *p) { return vld1q_f32(p); }
+    inline Lanes splat(float v) { return vdupq_n_f32(v); }
+    inline Lanes zero() { return vdupq_n_f32(0.0f); }
+    inline Lanes madd(Lanes a, Lanes b, Lanes c) { return vmlaq_f32(c, a, b); }
+    inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+    inline Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+    inline Lanes lessThan(Lanes a, Lanes b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+    inline Lanes either(Lanes a, Lanes b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+    inline uint32_t bits(Lanes mask)
+    {
+        // one bit per lane, like movemask
+        const uint32_t weights[4] = { 1, 2, 4, 8 };
+        uint32x4_t set = vandq_u32(vreinterpretq_u32_f32(mask), vld1q_u32(weights));
+        return vaddvq_u32(set);
+    }
+#else
+    const size_t WIDTH = 1;
+#endif
+
+    inline void setBit(uint32_t *mask, size_t i)
+    {
+        mask[i / 32] |= 1u << (i % 32);
+    }
+}
+
+size_t cullSpheres(const Frustum &frustum, const BoundingSpheres &spheres, uint32_t *visibleMask)
+{
+    using namespace frustum_detail;
+    size_t count = spheres.size();
+    size_t visible = 0;
+    for (size_t w = 0; w < frustumMaskWords(count); w++)
+    {
+        visibleMask[w] = 0;
+    }
+
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64) || defined(__ARM_NEON)
+    Lanes planeX[Frustum::PLANE_COUNT], planeY[Frustum::PLANE_COUNT], planeZ[Frustum::PLANE_COUNT], planeW[Frustum::PLANE_COUNT];
+    for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+    {
+        planeX[p] = splat(frustum.planes[p].x);
+        planeY[p] = splat(frustum.planes[p].y);
+        planeZ[p] = splat(frustum.planes[p].z);
+        planeW[p] = splat(frustum.planes[p].w);
+    }
+
+    // WIDTH divides 32, so every batch lands inside one mask word
+    for (; i + WIDTH <= count; i += WIDTH)
+    {
+        Lanes x = load(&spheres.x[i]);
+        Lanes y = load(&spheres.y[i]);
+        Lanes z = load(&spheres.z[i]);
+        Lanes negativeRadius = sub(zero(), load(&spheres.radius[i]));
+
+        Lanes outside = zero();
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+        {
+            Lanes distance = madd(planeX[p], x, madd(planeY[p], y, madd(planeZ[p], z, planeW[p])));
+            outside = either(outside, lessThan(distance, negativeRadius));
+        }
+
+        uint32_t inside = ~bits(outside) & ((1u << WIDTH) - 1);
+        visibleMask[i / 32] |= inside << (i % 32);
+        visible += maskBitCount(inside);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if (frustum.intersectsSphere(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]))
+        {
+            setBit(visibleMask, i);
+            visible++;
+        }
+    }
+    return visible;
+}
+
+size_t cullBoxes(const Frustum &frustum, const BoundingBoxes &boxes, uint32_t *visibleMask)
+{
+    using namespace frustum_detail;
+    size_t count = boxes.size();
+    size_t visible = 0;
+    for (size_t w = 0; w < frustumMaskWords(count); w++)
+    {
+        visibleMask[w] = 0;
+    }
+
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64) || defined(__ARM_NEON)
+    Lanes planeX[Frustum::PLANE_COUNT], planeY[Frustum::PLANE_COUNT], planeZ[Frustum::PLANE_COUNT], planeW[Frustum::PLANE_COUNT];
+    Lanes absX[Frustum::PLANE_COUNT], absY[Frustum::PLANE_COUNT], absZ[Frustum::PLANE_COUNT];
+    for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+    {
+        planeX[p] = splat(frustum.planes[p].x);
+        planeY[p] = splat(frustum.planes[p].y);
+        planeZ[p] = splat(frustum.planes[p].z);
+        planeW[p] = splat(frustum.planes[p].w);
+        absX[p] = splat(std::fabs(frustum.planes[p].x));
+        absY[p] = splat(std::fabs(frustum.planes[p].y));
+        absZ[p] = splat(std::fabs(frustum.planes[p].z));
+    }
+
+    for (; i + WIDTH <= count; i += WIDTH)
+    {
+        Lanes x = load(&boxes.x[i]);
+        Lanes y = load(&boxes.y[i]);
+        Lanes z = load(&boxes.z[i]);
+        Lanes ex = load(&boxes.extentX[i]);
+        Lanes ey = load(&boxes.extentY[i]);
+        Lanes ez = load(&boxes.extentZ[i]);
+
+        Lanes outside = zero();
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+        {
+            // the box is outside when even its corner furthest along the normal is behind the plane
+            Lanes distance = madd(planeX[p], x, madd(planeY[p], y, madd(planeZ[p], z, planeW[p])));
+            Lanes reach = madd(absX[p], ex, madd(absY[p], ey, madd(absZ[p], ez, zero())));
+            outside = either(outside, lessThan(add(distance, reach), zero()));
+        }
+
+        uint32_t inside = ~bits(outside) & ((1u << WIDTH) - 1);
+        visibleMask[i / 32] |= inside << (i % 32);
+        visible += maskBitCount(inside);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        glm::vec3 center(boxes.x[i], boxes.y[i], boxes.z[i]);
+        glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+        if (frustum.intersectsBox(center - extent, center + extent))
+        {
+            setBit(visibleMask, i);
+            visible++;
+        }
+    }
+    return visible;
+}
+
+namespace frustum_detail
+{
+    inline size_t compact(const std::vector<uint32_t> &mask, std::vector<uint32_t> &visibleIndices)
+    {
+        visibleIndices.clear();
+        for (size_t w = 0; w < mask.size(); w++)
+        {
+            uint32_t bitsLeft = mask[w];
+            while (bitsLeft != 0)
+            {
+                visibleIndices.push_back((uint32_t)(w * 32 + maskLowestBit(bitsLeft)));
+                bitsLeft &= bitsLeft - 1;
+            }
+        }
+        return visibleIndices.size();
+    }
+}
+
+size_t cullSpheres(const Frustum &frustum, const BoundingSpheres &spheres, std::vector<uint32_t> &visibleIndices)
+{
+    static thread_local std::vector<uint32_t> mask;
+    mask.resize(frustumMaskWords(spheres.size()));
+    cullSpheres(frustum, spheres, mask.data());
+    return frustum_detail::compact(mask, visibleIndices);
+}
+
+size_t cullBoxes(const Frustum &frustum, const BoundingBoxes &boxes, std::vector<uint32_t> &visibleIndices)
+{
+    static thread_local std::vector<uint32_t> mask;
+    mask.resize(frustumMaskWords(boxes.size()));
+    cullBoxes(frustum, boxes, mask.data());
+    return frustum_detail::compact(mask, visibleIndices);
+}
+
+#endif /* my_frustum_h */
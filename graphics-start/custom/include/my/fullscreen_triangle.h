@@ -0,0 +1,53 @@
+//
+//  fullscreen_triangle.h
+//  graphics-start
+//
+//  One triangle that covers the viewport, for passes that shade every pixel (deferred lighting, the
+//  environment background). The vertex shader makes the corners from gl_VertexID (custom/shaders/
+//  deferred_light.vs), so nothing is uploaded; the triangle reads no attributes, but a core profile
+//  draw still needs a vertex array bound, an empty one.
+//
+//  FullscreenTriangle triangle;
+//  shader.use();
+//  triangle.draw();
+//  triangle.release();
+//
+
+#ifndef my_fullscreen_triangle_h
+#define my_fullscreen_triangle_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+
+class FullscreenTriangle
+{
+public:
+    // draws with the current program, the vertex array is created on the first draw
+    void draw();
+    void release();
+
+private:
+    GLuint emptyVertexArray = 0;
+};
+
+
+void FullscreenTriangle::draw()
+{
+    if (emptyVertexArray == 0)
+    {
+        glGenVertexArrays(1, &emptyVertexArray);
+    }
+    glState.bindVertexArray(emptyVertexArray);
+    glState.drawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void FullscreenTriangle::release()
+{
+    if (emptyVertexArray != 0)
+    {
+        glState.deleteVertexArrays(1, &emptyVertexArray);
+        emptyVertexArray = 0;
+    }
+}
+
+#endif /* my_fullscreen_triangle_h */
@@ -0,0 +1,348 @@
+//
+//  gpu_profiler.h
+//  graphics-start
+//
+//  GPU time per pass from timestamp queries.
+//  Every marker writes a GL_TIMESTAMP query at its begin and end, so markers can nest (GL_TIME_ELAPSED
+//  queries can not). Queries are kept per frame in FRAMES_IN_FLIGHT sets and a set is only read back
+//  when it is about to be reused, by which time the GPU has long finished it, so reading never stalls.
+//  A set whose results are still not available is dropped instead of waited for.
+//
+//  GpuProfiler gpuProfiler;
+//  gpuProfiler.beginFrame();
+//  { GpuProfileScope scope(gpuProfiler, "lighting cube"); ... draw ... }
+//  gpuProfiler.endFrame();
+//
+
+#ifndef my_gpu_profiler_h
+#define my_gpu_profiler_h
+
+#include <glad/glad.h>
+#include <my/cpu_profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GpuProfiler
+{
+public:
+    static const int FRAMES_IN_FLIGHT = 3;
+    // samples kept per pass for the rolling average and percentiles
+    static const int HISTORY = 256;
+
+    struct Pass
+    {
+        std::string name;
+        int depth = 0;
+        std::vector<float> history;   // milliseconds, ring buffer
+        size_t next = 0;
+        uint64_t frames = 0;
+
+        void add(float ms);
+        float mean() const;
+        float percentile(float p) const;
+        float max() const;
+    };
+
+    void beginFrame();
+    void endFrame();
+
+    void begin(const std::string &name);
+    void end();
+
+    const std::vector<Pass>& passes() const { return passList; }
+    uint64_t droppedFrames() const { return dropped; }
+
+    void printReport() const;
+    bool writeCsv(const std::string &path) const;
+    bool writeJson(const std::string &path) const;
+    // writes the files named by GPU_PROFILE_CSV / GPU_PROFILE_JSON, if set
+    void writeFromEnvironment() const;
+
+    // deletes the query objects, call before glfwTerminate
+    void release();
+
+private:
+    struct Marker
+    {
+        int pass;
+        GLuint beginQuery;
+        GLuint endQuery;
+    };
+
+    struct FrameQueries
+    {
+        std::vector<GLuint> pool;
+        size_t used = 0;
+        std::vector<Marker> markers;
+        GLuint lastQuery = 0;   // the query issued last in the frame
+    };
+
+    GLuint nextQuery();
+    void collect(FrameQueries &frame);
+    int passIndex(const std::string &name);
+
+    FrameQueries frames[FRAMES_IN_FLIGHT];
+    int current = 0;
+    bool inFrame = false;
+    std::vector<size_t> openMarkers;
+
+    std::vector<Pass> passList;
+    std::unordered_map<std::string, int> passIds;
+    uint64_t dropped = 0;
+};
+
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(GpuProfiler &profiler, const std::string &name) : profiler(profiler) { profiler.begin(name); }
+    ~GpuProfileScope() { profiler.end(); }
+
+private:
+    GpuProfiler &profiler;
+};
+
+
+void GpuProfiler::Pass::add(float ms)
+{
+    if (history.size() < HISTORY)
+    {
+        history.push_back(ms);
+    }
+    else
+    {
+        history[next] = ms;
+    }
+    next = (next + 1) % HISTORY;
+    frames++;
+}
+
+float GpuProfiler::Pass::mean() const
+{
+    if (history.empty()) return 0.0f;
+    double sum = 0.0;
+    for (float ms : history) sum += ms;
+    return (float)(sum / history.size());
+}
+
+float GpuProfiler::Pass::percentile(float p) const
+{
+    if (history.empty()) return 0.0f;
+    std::vector<float> sorted(history);
+    size_t index = std::min(sorted.size() - 1, (size_t)(p / 100.0f * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+float GpuProfiler::Pass::max() const
+{
+    return history.empty() ? 0.0f : *std::max_element(history.begin(), history.end());
+}
+
+GLuint GpuProfiler::nextQuery()
+{
+    FrameQueries &frame = frames[current];
+    if (frame.used == frame.pool.size())
+    {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame.pool.push_back(query);
+    }
+    return frame.pool[frame.used++];
+}
+
+int GpuProfiler::passIndex(const std::string &name)
+{
+    auto found = passIds.find(name);
+    if (found != passIds.end())
+    {
+        return found->second;
+    }
+    int index = (int)passList.size();
+    passList.emplace_back();
+    passList.back().name = name;
+    passList.back().depth = (int)openMarkers.size();
+    passIds.emplace(name, index);
+    return index;
+}
+
+void GpuProfiler::collect(FrameQueries &frame)
+{
+    if (frame.markers.empty())
+    {
+        return;
+    }
+
+    // queries finish in order, so the last one being available means all of them are
+    GLint available = 0;
+    glGetQueryObjectiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        dropped++;
+    }
+    else
+    {
+        // a pass can be entered several times per frame, its time is the sum
+        std::vector<double> frameTimes(passList.size(), -1.0);
+        for (const Marker &marker : frame.markers)
+        {
+            GLuint64 start = 0, stop = 0;
+            glGetQueryObjectui64v(marker.beginQuery, GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(marker.endQuery, GL_QUERY_RESULT, &stop);
+            double &ms = frameTimes[marker.pass];
+            ms = std::max(ms, 0.0) + (stop - start) / 1.0e6;
+        }
+        for (size_t i = 0; i < frameTimes.size(); i++)
+        {
+            if (frameTimes[i] >= 0.0)
+            {
+                passList[i].add((float)frameTimes[i]);
+            }
+        }
+    }
+
+    frame.markers.clear();
+    frame.used = 0;
+}
+
+void GpuProfiler::beginFrame()
+{
+    current = (current + 1) % FRAMES_IN_FLIGHT;
+    // this set was issued FRAMES_IN_FLIGHT frames ago
+    collect(frames[current]);
+    inFrame = true;
+    begin("frame");
+}
+
+void GpuProfiler::endFrame()
+{
+    while (!openMarkers.empty())
+    {
+        end();
+    }
+    inFrame = false;
+}
+
+void GpuProfiler::begin(const std::string &name)
+{
+    if (!inFrame)
+    {
+        std::cout << "ERROR::GPU_PROFILER::MARKER_OUTSIDE_FRAME: " << name << std::endl;
+        return;
+    }
+
+    Marker marker;
+    marker.pass = passIndex(name);
+    marker.beginQuery = nextQuery();
+    marker.endQuery = nextQuery();
+    glQueryCounter(marker.beginQuery, GL_TIMESTAMP);
+
+    openMarkers.push_back(frames[current].markers.size());
+    frames[current].markers.push_back(marker);
+}
+
+void GpuProfiler::end()
+{
+    if (openMarkers.empty())
+    {
+        return;
+    }
+    Marker &marker = frames[current].markers[openMarkers.back()];
+    openMarkers.pop_back();
+    glQueryCounter(marker.endQuery, GL_TIMESTAMP);
+    frames[current].lastQuery = marker.endQuery;
+}
+
+void GpuProfiler::printReport() const
+{
+    std::cout << "GPU_PROFILER::PASSES (ms over the last " << HISTORY << " frames, " << dropped << " frames dropped)" << std::endl;
+    std::cout << std::fixed << std::setprecision(4);
+    for (const Pass &pass : passList)
+    {
+        std::cout << "  " << std::string(pass.depth * 2, ' ') << pass.name
+                  << " mean=" << pass.mean() << " p50=" << pass.percentile(50.0f) << " p95=" << pass.percentile(95.0f)
+                  << " p99=" << pass.percentile(99.0f) << " max=" << pass.max() << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+bool GpuProfiler::writeCsv(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::GPU_PROFILER::FILE_NOT_WRITTEN: " << path << std::endl;
+        return false;
+    }
+    file << "pass,depth,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for (const Pass &pass : passList)
+    {
+        // CSV doubles the quotes inside a quoted field
+        std::string name;
+        for (char c : pass.name)
+        {
+            name += c == '"' ? "\"\"" : std::string(1, c);
+        }
+        file << '"' << name << "\"," << pass.depth << ',' << pass.frames << ',' << pass.mean() << ','
+             << pass.percentile(50.0f) << ',' << pass.percentile(95.0f) << ',' << pass.percentile(99.0f) << ',' << pass.max() << '\n';
+    }
+    return true;
+}
+
+bool GpuProfiler::writeJson(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::GPU_PROFILER::FILE_NOT_WRITTEN: " << path << std::endl;
+        return false;
+    }
+    file << "{\n  \"droppedFrames\": " << dropped << ",\n  \"passes\": [";
+    for (size_t i = 0; i < passList.size(); i++)
+    {
+        const Pass &pass = passList[i];
+        file << (i ? "," : "") << "\n    { \"name\": ";
+        CpuProfiler::writeJsonString(file, pass.name);
+        file << ", \"depth\": " << pass.depth
+             << ", \"frames\": " << pass.frames << ", \"meanMs\": " << pass.mean()
+             << ", \"p50Ms\": " << pass.percentile(50.0f) << ", \"p95Ms\": " << pass.percentile(95.0f)
+             << ", \"p99Ms\": " << pass.percentile(99.0f) << ", \"maxMs\": " << pass.max() << " }";
+    }
+    file << "\n  ]\n}\n";
+    return true;
+}
+
+void GpuProfiler::writeFromEnvironment() const
+{
+    if (const char *csv = std::getenv("GPU_PROFILE_CSV"))
+    {
+        writeCsv(csv);
+    }
+    if (const char *json = std::getenv("GPU_PROFILE_JSON"))
+    {
+        writeJson(json);
+    }
+}
+
+void GpuProfiler::release()
+{
+    for (FrameQueries &frame : frames)
+    {
+        if (!frame.pool.empty())
+        {
+            glDeleteQueries((GLsizei)frame.pool.size(), frame.pool.data());
+        }
+        frame.pool.clear();
+        frame.markers.clear();
+        frame.used = 0;
+    }
+}
+
+#endif /* my_gpu_profiler_h */
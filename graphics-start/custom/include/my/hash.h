@@ -0,0 +1,108 @@
+//
+//  hash.h
+//  graphics-start
+//
+//  64-bit content hash for the on-disk caches (shader_s.h, mesh_cache.h, texture_image.h, ibl_bake.h),
+//  and the directory lookup and atomic file write they share.
+//  Eight bytes per step, fast enough that hashing a source file stays bound by the disk.
+//  Not a cryptographic hash; a collision only means a stale cache entry.
+//
+
+#ifndef my_hash_h
+#define my_hash_h
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+const uint64_t HASH_SEED = 0x9E3779B97F4A7C15ull;
+
+// chain calls through hash to cover several buffers
+inline uint64_t hashBytes(const void *bytes, size_t length, uint64_t hash = HASH_SEED)
+{
+    const uint64_t PRIME = 0xC2B2AE3D27D4EB4Full;
+    const char *data = static_cast<const char *>(bytes);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, length - i);
+    hash = (hash ^ tail ^ length) * PRIME;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// 16 hex digits, for cache file names
+inline std::string hashHex(uint64_t hash)
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+// ".tmp" suffix for a cache file written under a temporary name before the rename into place;
+// differs between threads and between processes writing the same key at the same time
+inline std::string tempFileSuffix()
+{
+    std::random_device random;
+    uint64_t parts[3] = { (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count(),
+                          (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id()),
+                          ((uint64_t)random() << 32) | random() };
+    return ".tmp" + hashHex(hashBytes(parts, sizeof(parts)));
+}
+
+// the directory in the environment variable, an empty one disables the cache; otherwise name in the temp directory
+inline std::filesystem::path cacheDirectory(const char *environment, const char *name)
+{
+    if (const char *dir = getenv(environment))
+    {
+        return std::filesystem::path(dir);
+    }
+    std::error_code error;
+    std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        return std::filesystem::path();
+    }
+    return temp / name;
+}
+
+// write(std::ofstream &) fills a temporary file that is then renamed to path, so a concurrent run never
+// reads or maps a half written file; a failed write prints failure and removes the temporary file
+template <typename Write>
+bool writeFileAtomic(const std::filesystem::path &path, const char *failure, Write write)
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    std::filesystem::path temp = path;
+    temp += tempFileSuffix();
+    {
+        std::ofstream file(temp, std::ios::binary);
+        write(file);
+        if (!file)
+        {
+            std::cout << failure << ": " << temp.string() << std::endl;
+            file.close();
+            std::filesystem::remove(temp, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, path, error);
+    return !error;
+}
+
+#endif /* my_hash_h */
@@ -0,0 +1,386 @@
+//
+//  headless.h
+//  graphics-start
+//
+//  Headless backend for the chapters.
+//  When GRAPHICS_HEADLESS is defined, the subset of the GLFW API used by the chapters is implemented here
+//  on top of an EGL surfaceless context (Mesa llvmpipe works, no display or GPU needed), and the scene is
+//  rendered into an offscreen FBO of the requested window size. The render loop ends by itself after
+//  HEADLESS_FRAMES frames (environment variable, default 300) and frame cost is reported on glfwTerminate().
+//
+//  Build a chapter without linking glfw, e.g.
+//  g++ -std=c++17 -DGRAPHICS_HEADLESS -Icustom/include ... main.cpp glad.c -lEGL
+//
+
+#ifndef my_headless_h
+#define my_headless_h
+
+#ifdef GRAPHICS_HEADLESS
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+const unsigned HEADLESS_DEFAULT_FRAMES = 300;
+
+/**
+ Offscreen "window". Everything the chapters draw to the default framebuffer ends up in fbo.
+ */
+struct GLFWwindow
+{
+    int width = 0;
+    int height = 0;
+    bool shouldClose = false;
+
+    unsigned frame = 0;
+    unsigned frameLimit = HEADLESS_DEFAULT_FRAMES;
+
+    EGLContext context = EGL_NO_CONTEXT;
+
+    GLuint fbo = 0;
+    GLuint colorRbo = 0;
+    GLuint depthRbo = 0;
+
+    std::chrono::steady_clock::time_point frameStart;
+    std::vector<double> frameTimes; // milliseconds, one per swap
+};
+
+struct HeadlessState
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLConfig config = nullptr;
+
+    int contextMajor = 3;
+    int contextMinor = 3;
+
+    std::chrono::steady_clock::time_point startTime;
+    GLFWwindow* window = nullptr;       // first window, the one that is rendered and reported
+    std::vector<GLFWwindow*> windows;   // including hidden ones used as shared worker contexts
+};
+
+static HeadlessState headless;
+
+
+/**
+ Framebuffer the chapters should bind instead of 0 when they want to draw "to the screen".
+ */
+GLuint headlessDefaultFramebuffer()
+{
+    return headless.window ? headless.window->fbo : 0;
+}
+
+/**
+ Creates the color/depth attachments of the offscreen window.
+ It is called once the GL functions are loaded, i.e. on the first glfwSwapBuffers or from myOpenGLInit.
+ */
+void headlessCreateFramebuffer(GLFWwindow* window)
+{
+    if (window->fbo != 0)
+        return;
+
+    glGenRenderbuffers(1, &window->colorRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, window->colorRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window->width, window->height);
+
+    glGenRenderbuffers(1, &window->depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, window->depthRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, window->width, window->height);
+
+    glGenFramebuffers(1, &window->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, window->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, window->colorRbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, window->depthRbo);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::HEADLESS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+    glViewport(0, 0, window->width, window->height);
+    window->frameStart = std::chrono::steady_clock::now();
+}
+
+/**
+ Writes the color attachment as a binary PPM, so runs can be diffed against a reference image.
+ */
+void headlessDumpFramebuffer(GLFWwindow* window, const char* path)
+{
+    std::vector<unsigned char> pixels(window->width * window->height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, window->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, window->width, window->height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << path << std::endl;
+        return;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", window->width, window->height);
+    // GL rows go bottom to top
+    for (int y = window->height - 1; y >= 0; y--)
+        fwrite(&pixels[y * window->width * 3], 1, window->width * 3, file);
+    fclose(file);
+}
+
+/**
+ Prints count, mean and percentiles of the recorded frame times.
+ */
+void headlessReport(GLFWwindow* window)
+{
+    if (window->frameTimes.empty())
+        return;
+
+    std::vector<double> sorted = window->frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for (double t : sorted)
+        sum += t;
+
+    auto percentile = [&sorted](double p) {
+        size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    };
+
+    std::cout << "HEADLESS::FRAMES " << sorted.size()
+              << " size=" << window->width << "x" << window->height
+              << " mean=" << sum / sorted.size() << "ms"
+              << " min=" << sorted.front() << "ms"
+              << " p50=" << percentile(0.50) << "ms"
+              << " p95=" << percentile(0.95) << "ms"
+              << " p99=" << percentile(0.99) << "ms"
+              << " max=" << sorted.back() << "ms" << std::endl;
+}
+
+
+///
+/// GLFW API subset
+///
+
+int glfwInit(void)
+{
+    if (headless.display != EGL_NO_DISPLAY)
+        return GLFW_TRUE;
+
+    headless.startTime = std::chrono::steady_clock::now();
+
+    // prefer the Mesa surfaceless platform, it does not need any window system at all
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        headless.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (headless.display == EGL_NO_DISPLAY)
+        headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, NULL, NULL))
+    {
+        std::cout << "ERROR::HEADLESS::EGL_INITIALIZE_FAILED" << std::endl;
+        headless.display = EGL_NO_DISPLAY;
+        return GLFW_FALSE;
+    }
+
+    return GLFW_TRUE;
+}
+
+void glfwWindowHint(int hint, int value)
+{
+    if (hint == GLFW_CONTEXT_VERSION_MAJOR)
+        headless.contextMajor = value;
+    else if (hint == GLFW_CONTEXT_VERSION_MINOR)
+        headless.contextMinor = value;
+}
+
+GLFWwindow* glfwCreateWindow(int width, int height, const char* title, GLFWmonitor* monitor, GLFWwindow* share)
+{
+    if (headless.display == EGL_NO_DISPLAY)
+        return NULL;
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cout << "ERROR::HEADLESS::EGL_OPENGL_API_UNAVAILABLE" << std::endl;
+        return NULL;
+    }
+
+    // EGL_SURFACE_TYPE defaults to EGL_WINDOW_BIT, which the surfaceless platform never offers
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(headless.display, configAttribs, &headless.config, 1, &numConfigs) || numConfigs == 0)
+    {
+        std::cout << "ERROR::HEADLESS::NO_EGL_CONFIG" << std::endl;
+        return NULL;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, headless.contextMajor,
+        EGL_CONTEXT_MINOR_VERSION, headless.contextMinor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext shareContext = share ? share->context : EGL_NO_CONTEXT;
+    EGLContext context = eglCreateContext(headless.display, headless.config, shareContext, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+    {
+        std::cout << "ERROR::HEADLESS::EGL_CREATE_CONTEXT_FAILED" << std::endl;
+        return NULL;
+    }
+
+    GLFWwindow* window = new GLFWwindow();
+    window->width = width;
+    window->height = height;
+    window->context = context;
+
+    if (const char* frames = getenv("HEADLESS_FRAMES"))
+        window->frameLimit = static_cast<unsigned>(std::max(1, atoi(frames)));
+
+    if (headless.window == nullptr)
+        headless.window = window;
+    headless.windows.push_back(window);
+    return window;
+}
+
+void glfwDestroyWindow(GLFWwindow* window)
+{
+    if (window == NULL)
+        return;
+
+    if (window->fbo != 0)
+    {
+        glDeleteFramebuffers(1, &window->fbo);
+        glDeleteRenderbuffers(1, &window->colorRbo);
+        glDeleteRenderbuffers(1, &window->depthRbo);
+    }
+    eglDestroyContext(headless.display, window->context);
+
+    if (headless.window == window)
+        headless.window = nullptr;
+    headless.windows.erase(std::remove(headless.windows.begin(), headless.windows.end(), window), headless.windows.end());
+    delete window;
+}
+
+void glfwMakeContextCurrent(GLFWwindow* window)
+{
+    if (window == NULL)
+    {
+        eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        return;
+    }
+    // surfaceless: the context has no default framebuffer, we draw into the window FBO instead
+    if (!eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, window->context))
+        std::cout << "ERROR::HEADLESS::EGL_MAKE_CURRENT_FAILED" << std::endl;
+}
+
+GLFWglproc glfwGetProcAddress(const char* procname)
+{
+    return (GLFWglproc)eglGetProcAddress(procname);
+}
+
+int glfwWindowShouldClose(GLFWwindow* window)
+{
+    return window->shouldClose;
+}
+
+void glfwSetWindowShouldClose(GLFWwindow* window, int value)
+{
+    window->shouldClose = value;
+}
+
+void glfwSwapBuffers(GLFWwindow* window)
+{
+    if (window->fbo == 0)
+    {
+        headlessCreateFramebuffer(window);
+        return;
+    }
+
+    // wait for the GPU so the recorded time is the real cost of the frame
+    glFinish();
+
+    auto now = std::chrono::steady_clock::now();
+    window->frameTimes.push_back(std::chrono::duration<double, std::milli>(now - window->frameStart).count());
+    window->frameStart = now;
+
+    if (++window->frame >= window->frameLimit)
+        window->shouldClose = true;
+
+    // chapters bind 0 to get back to the screen, so make sure the offscreen target is current again
+    glBindFramebuffer(GL_FRAMEBUFFER, window->fbo);
+}
+
+void glfwPollEvents(void)
+{
+}
+
+int glfwGetKey(GLFWwindow* window, int key)
+{
+    return GLFW_RELEASE;
+}
+
+double glfwGetTime(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - headless.startTime).count();
+}
+
+void glfwSetInputMode(GLFWwindow* window, int mode, int value)
+{
+}
+
+GLFWframebuffersizefun glfwSetFramebufferSizeCallback(GLFWwindow* window, GLFWframebuffersizefun callback)
+{
+    // the offscreen window is never resized, but create the target here since GL is loaded by now
+    headlessCreateFramebuffer(window);
+    return NULL;
+}
+
+GLFWcursorposfun glfwSetCursorPosCallback(GLFWwindow* window, GLFWcursorposfun callback)
+{
+    return NULL;
+}
+
+GLFWscrollfun glfwSetScrollCallback(GLFWwindow* window, GLFWscrollfun callback)
+{
+    return NULL;
+}
+
+void glfwTerminate(void)
+{
+    if (headless.window)
+    {
+        if (headless.window->fbo != 0)
+        {
+            if (const char* dumpPath = getenv("HEADLESS_DUMP"))
+                headlessDumpFramebuffer(headless.window, dumpPath);
+            headlessReport(headless.window);
+        }
+    }
+    while (!headless.windows.empty())
+        glfwDestroyWindow(headless.windows.back());
+
+    if (headless.display != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglTerminate(headless.display);
+    }
+    headless = HeadlessState();
+}
+
+#endif /* GRAPHICS_HEADLESS */
+
+#endif /* my_headless_h */
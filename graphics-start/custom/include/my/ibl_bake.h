@@ -0,0 +1,751 @@
+//
+//  ibl_bake.h
+//  graphics-start
+//
+//  CPU precompute of image based lighting from an equirectangular HDR environment (resources/
+//  textures/hdr): the environment as a cube map, its diffuse irradiance, the GGX prefiltered
+//  specular mip chain (roughness level / (levels - 1) on each level) and the split-sum BRDF table
+//  (scale and bias of F0 per NdotV and roughness).
+//
+//  The convolutions importance sample Hammersley points (cosine lobe for the irradiance, GGX for the
+//  reflections) and read a coarser mip of the environment where the sample density is low, so about
+//  a thousand samples per texel come out without fireflies. In tangent space the samples of a level
+//  are the same for every texel: they are tabled once, then rotated into each texel's frame and
+//  projected on the cube faces 4 at a time (SSE, NEON). The rows of every face are split across
+//  threads. Filtering stays inside a face, texels at the edges clamp instead of reading the
+//  neighbouring face.
+//
+//  The maps are stored as half floats and cached on disk keyed by a hash of the HDR file and the bake
+//  settings, so an environment is baked once and later runs only read it back.
+//  IBL_CACHE_DIR overrides the cache location, set it to an empty string to disable the cache.
+//
+//  IblMaps maps;
+//  if (loadIblMaps(projectPath + "/resources/textures/hdr/newport_loft.hdr", maps))
+//  {
+//      for (int face = 0; face < 6; face++)
+//          glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB16F, ..., maps.irradiance.face(face));
+//  }
+//
+
+#ifndef my_ibl_bake_h
+#define my_ibl_bake_h
+
+#include <glm/glm.hpp>
+#include <my/cpu_profiler.h>
+#include <my/hash.h>
+// include guard as in texture_image.h
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb-master/stb_image.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define MY_IBL_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MY_IBL_NEON 1
+#endif
+
+// bake settings, part of the cache key
+const int IBL_ENVIRONMENT_SIZE = 512;
+const int IBL_IRRADIANCE_SIZE = 32;
+const int IBL_PREFILTER_SIZE = 128;
+const int IBL_PREFILTER_LEVELS = 6;
+const int IBL_BRDF_LUT_SIZE = 128;
+const int IBL_IRRADIANCE_SAMPLES = 2048;
+const int IBL_PREFILTER_SAMPLES = 1024;
+const int IBL_BRDF_SAMPLES = 1024;
+
+// one cube map level: 6 faces of RGB half floats in GL order, +X -X +Y -Y +Z -Z
+struct IblCube
+{
+    int size = 0;
+    std::vector<uint16_t> data;
+
+    const uint16_t* face(int face) const { return &data[(size_t)face * size * size * 3]; }
+};
+
+struct IblMaps
+{
+    IblCube environment;
+    IblCube irradiance;
+    // mip chain, roughness level / (levels - 1)
+    std::vector<IblCube> prefilter;
+    // RG half floats, NdotV along x, roughness along y
+    int brdfLutSize = 0;
+    std::vector<uint16_t> brdfLut;
+
+    size_t size() const;
+};
+
+// threads 0 uses every core
+bool loadIblMaps(const std::string &path, IblMaps &maps, unsigned int threads = 0);
+
+// the bake itself, from width x height RGB floats, rows top to bottom
+void bakeIblMaps(const float *rgb, int width, int height, IblMaps &maps, unsigned int threads);
+
+uint16_t floatToHalf(float value);
+
+
+size_t IblMaps::size() const
+{
+    size_t total = environment.data.size() + irradiance.data.size() + brdfLut.size();
+    for (const IblCube &level : prefilter)
+    {
+        total += level.data.size();
+    }
+    return total * sizeof(uint16_t);
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    float magnitude = std::fabs(value);
+    // the largest half, also for infinities and NaN, which a lighting map has no use for
+    if (!(magnitude < 65504.0f))
+    {
+        return sign | 0x7BFF;
+    }
+    // below the smallest normal half: a multiple of 2^-24, ties to even like the normal range
+    if (magnitude < 6.103515625e-05f)
+    {
+        return sign | (uint16_t)std::nearbyint(magnitude * 16777216.0f);
+    }
+    std::memcpy(&bits, &magnitude, sizeof(bits));
+    // round to nearest even, a carry moves into the exponent
+    bits += 0x0FFF + ((bits >> 13) & 1);
+    return sign | (uint16_t)((bits - (112u << 23)) >> 13);
+}
+
+
+namespace ibl_detail
+{
+    // a cube level in float RGB while baking, faces one after another
+    struct FloatCube
+    {
+        int size = 0;
+        std::vector<float> rgb;
+
+        FloatCube() = default;
+        FloatCube(int size) : size(size), rgb((size_t)6 * size * size * 3) {}
+        float* texel(int face, int x, int y) { return &rgb[(((size_t)face * size + y) * size + x) * 3]; }
+        const float* texel(int face, int x, int y) const { return &rgb[(((size_t)face * size + y) * size + x) * 3]; }
+    };
+
+    // directions of a level's samples in tangent space (z along the normal), padded with zero weights
+    // to a multiple of 4, and the environment mip each one reads
+    struct SampleTable
+    {
+        std::vector<float> x, y, z, weight, lod;
+
+        void push(const glm::vec3 &direction, float sampleWeight, float sampleLod)
+        {
+            x.push_back(direction.x);
+            y.push_back(direction.y);
+            z.push_back(direction.z);
+            weight.push_back(sampleWeight);
+            lod.push_back(sampleLod);
+        }
+        void pad()
+        {
+            while (x.size() % 4 != 0)
+            {
+                push(glm::vec3(0.0f, 0.0f, 1.0f), 0.0f, 0.0f);
+            }
+        }
+        size_t size() const { return x.size(); }
+    };
+
+    const float PI = 3.14159265358979f;
+
+    // direction through texel coordinates s, t in [-1, 1] of a face, as the GL cube map lookup
+    inline glm::vec3 faceDirection(int face, float s, float t)
+    {
+        switch (face)
+        {
+            case 0: return glm::vec3(1.0f, -t, -s);
+            case 1: return glm::vec3(-1.0f, -t, s);
+            case 2: return glm::vec3(s, 1.0f, t);
+            case 3: return glm::vec3(s, -1.0f, -t);
+            case 4: return glm::vec3(s, -t, 1.0f);
+            default: return glm::vec3(-s, -t, -1.0f);
+        }
+    }
+
+    // the inverse: face by the major axis, s, t in [0, 1]
+    inline void faceCoordinates(const glm::vec3 &direction, int &face, float &s, float &t)
+    {
+        glm::vec3 a = glm::abs(direction);
+        float sc, tc, ma;
+        if (a.x >= a.y && a.x >= a.z)
+        {
+            face = direction.x > 0.0f ? 0 : 1;
+            ma = a.x;
+            sc = direction.x > 0.0f ? -direction.z : direction.z;
+            tc = -direction.y;
+        }
+        else if (a.y >= a.z)
+        {
+            face = direction.y > 0.0f ? 2 : 3;
+            ma = a.y;
+            sc = direction.x;
+            tc = direction.y > 0.0f ? direction.z : -direction.z;
+        }
+        else
+        {
+            face = direction.z > 0.0f ? 4 : 5;
+            ma = a.z;
+            sc = direction.z > 0.0f ? direction.x : -direction.x;
+            tc = -direction.y;
+        }
+        s = 0.5f * sc / ma + 0.5f;
+        t = 0.5f * tc / ma + 0.5f;
+    }
+
+#if defined(MY_IBL_SSE)
+    typedef __m128 Lanes;
+    inline Lanes load(const float *p) { return _mm_loadu_ps(p); }
+    inline void store(float *p, Lanes a) { _mm_storeu_ps(p, a); }
+    inline Lanes splat(float v) { return _mm_set1_ps(v); }
+    inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+    inline Lanes madd(Lanes a, Lanes b, Lanes c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    inline Lanes negate(Lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    inline Lanes absolute(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    inline Lanes reciprocal(Lanes a) { return _mm_div_ps(_mm_set1_ps(1.0f), a); }
+    inline Lanes greaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+    inline Lanes positive(Lanes a) { return _mm_cmpgt_ps(a, _mm_setzero_ps()); }
+    inline Lanes both(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+    inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#elif defined(MY_IBL_NEON)
+    typedef float32x4_t Lanes;
+    inline Lanes load(const float *p) { return vld1q_f32(p); }
+    inline void store(float *p, Lanes a) { vst1q_f32(p, a); }
+    inline Lanes splat(float v) { return vdupq_n_f32(v); }
+    inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+    inline Lanes madd(Lanes a, Lanes b, Lanes c) { return vmlaq_f32(c, a, b); }
+    inline Lanes negate(Lanes a) { return vnegq_f32(a); }
+    inline Lanes absolute(Lanes a) { return vabsq_f32(a); }
+    inline Lanes reciprocal(Lanes a)
+    {
+        // estimate and two Newton steps, 32-bit NEON has no divide
+        Lanes r = vrecpeq_f32(a);
+        r = vmulq_f32(r, vrecpsq_f32(a, r));
+        return vmulq_f32(r, vrecpsq_f32(a, r));
+    }
+    inline Lanes greaterEqual(Lanes a, Lanes b) { return vreinterpretq_f32_u32(vcgeq_f32(a, b)); }
+    inline Lanes positive(Lanes a) { return vreinterpretq_f32_u32(vcgtq_f32(a, vdupq_n_f32(0.0f))); }
+    inline Lanes both(Lanes a, Lanes b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+    inline Lanes select(Lanes mask, Lanes a, Lanes b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+#endif
+
+#if defined(MY_IBL_SSE) || defined(MY_IBL_NEON)
+    // faceCoordinates of 4 directions; the face comes back as a float
+    inline void faceCoordinates(Lanes x, Lanes y, Lanes z, float *face, float *s, float *t)
+    {
+        Lanes ax = absolute(x), ay = absolute(y), az = absolute(z);
+        Lanes xPositive = positive(x), yPositive = positive(y), zPositive = positive(z);
+        // z major, overridden where y is major, then where x is
+        Lanes f = select(zPositive, splat(4.0f), splat(5.0f));
+        Lanes ma = az;
+        Lanes sc = select(zPositive, x, negate(x));
+        Lanes tc = negate(y);
+
+        Lanes yMajor = greaterEqual(ay, az);
+        f = select(yMajor, select(yPositive, splat(2.0f), splat(3.0f)), f);
+        ma = select(yMajor, ay, ma);
+        sc = select(yMajor, x, sc);
+        tc = select(yMajor, select(yPositive, z, negate(z)), tc);
+
+        Lanes xMajor = both(greaterEqual(ax, ay), greaterEqual(ax, az));
+        f = select(xMajor, select(xPositive, splat(0.0f), splat(1.0f)), f);
+        ma = select(xMajor, ax, ma);
+        sc = select(xMajor, select(xPositive, negate(z), z), sc);
+        tc = select(xMajor, negate(y), tc);
+
+        Lanes half = splat(0.5f);
+        Lanes scale = mul(half, reciprocal(ma));
+        store(face, f);
+        store(s, madd(sc, scale, half));
+        store(t, madd(tc, scale, half));
+    }
+#endif
+
+    // the i-th of count points of the Hammersley set
+    inline glm::vec2 hammersley(uint32_t i, uint32_t count)
+    {
+        uint32_t bits = i;
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+        bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+        bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+        return glm::vec2((float)i / (float)count, (float)bits * 2.3283064365386963e-10f);
+    }
+
+    // GGX distributed half vector around +z, alpha = roughness^2
+    inline glm::vec3 importanceSampleGgx(const glm::vec2 &xi, float alpha)
+    {
+        float phi = 2.0f * PI * xi.x;
+        float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+
+    // environment mip that averages about the solid angle of a sample with this pdf (GPU Gems 3, 20.4),
+    // one level coarser for a smoother result
+    inline float sampleLod(float pdf, int samples, int environmentSize)
+    {
+        float sampleAngle = 1.0f / ((float)samples * pdf + 1e-6f);
+        float texelAngle = 4.0f * PI / (6.0f * (float)environmentSize * environmentSize);
+        return std::max(0.5f * std::log2(sampleAngle / texelAngle) + 1.0f, 0.0f);
+    }
+
+    // cosine weighted directions: their plain average is the irradiance over pi
+    SampleTable irradianceSamples(int environmentSize)
+    {
+        SampleTable table;
+        for (int i = 0; i < IBL_IRRADIANCE_SAMPLES; i++)
+        {
+            glm::vec2 xi = hammersley(i, IBL_IRRADIANCE_SAMPLES);
+            float phi = 2.0f * PI * xi.x;
+            float cosTheta = std::sqrt(1.0f - xi.y);
+            float sinTheta = std::sqrt(xi.y);
+            table.push(glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta), 1.0f,
+                       sampleLod(cosTheta / PI, IBL_IRRADIANCE_SAMPLES, environmentSize));
+        }
+        table.pad();
+        return table;
+    }
+
+    // light directions of GGX half vectors with view = normal, weighted by NdotL (Karis 2013)
+    SampleTable prefilterSamples(float roughness, int environmentSize, int targetSize)
+    {
+        SampleTable table;
+        if (roughness == 0.0f)
+        {
+            // a mirror: the environment mip of the target's resolution
+            table.push(glm::vec3(0.0f, 0.0f, 1.0f), 1.0f, std::log2((float)environmentSize / (float)targetSize));
+            table.pad();
+            return table;
+        }
+        float alpha = roughness * roughness;
+        for (int i = 0; i < IBL_PREFILTER_SAMPLES; i++)
+        {
+            glm::vec3 h = importanceSampleGgx(hammersley(i, IBL_PREFILTER_SAMPLES), alpha);
+            glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (l.z > 0.0f)
+            {
+                float denominator = h.z * h.z * (alpha * alpha - 1.0f) + 1.0f;
+                float d = alpha * alpha / (PI * denominator * denominator);
+                // pdf of l: D * NdotH / (4 * VdotH), and VdotH = NdotH
+                table.push(l, l.z, sampleLod(d * 0.25f, IBL_PREFILTER_SAMPLES, environmentSize));
+            }
+        }
+        table.pad();
+        return table;
+    }
+
+    // splits rows across threads, small jobs stay on the calling thread
+    void forEachRows(int rows, unsigned int threads, const std::function<void(int, int)> &job)
+    {
+        const int MIN_ROWS_PER_THREAD = 4;
+        unsigned int count = std::max(1u, std::min(threads, (unsigned int)(rows / MIN_ROWS_PER_THREAD)));
+        std::vector<std::thread> helpers;
+        for (unsigned int i = 1; i < count; i++)
+        {
+            helpers.emplace_back(job, rows * (int)i / (int)count, rows * (int)(i + 1) / (int)count);
+        }
+        job(0, rows / (int)count);
+        for (std::thread &helper : helpers)
+        {
+            helper.join();
+        }
+    }
+
+    inline void sampleBilinear(const FloatCube &cube, int face, float s, float t, float weight, float *sum)
+    {
+        float x = s * cube.size - 0.5f;
+        float y = t * cube.size - 0.5f;
+        float x0f = std::floor(x), y0f = std::floor(y);
+        float fx = x - x0f, fy = y - y0f;
+        int last = cube.size - 1;
+        int x0 = std::min(std::max((int)x0f, 0), last), x1 = std::min(std::max((int)x0f + 1, 0), last);
+        int y0 = std::min(std::max((int)y0f, 0), last), y1 = std::min(std::max((int)y0f + 1, 0), last);
+        const float *a = cube.texel(face, x0, y0), *b = cube.texel(face, x1, y0);
+        const float *c = cube.texel(face, x0, y1), *d = cube.texel(face, x1, y1);
+        float wa = (1.0f - fx) * (1.0f - fy) * weight, wb = fx * (1.0f - fy) * weight;
+        float wc = (1.0f - fx) * fy * weight, wd = fx * fy * weight;
+        for (int channel = 0; channel < 3; channel++)
+        {
+            sum[channel] += a[channel] * wa + b[channel] * wb + c[channel] * wc + d[channel] * wd;
+        }
+    }
+
+    inline void sampleTrilinear(const std::vector<FloatCube> &mips, int face, float s, float t, float lod, float weight, float *sum)
+    {
+        lod = std::min(lod, (float)(mips.size() - 1));
+        int level = (int)lod;
+        float blend = lod - (float)level;
+        sampleBilinear(mips[level], face, s, t, weight * (1.0f - blend), sum);
+        if (blend > 0.0f)
+        {
+            sampleBilinear(mips[level + 1], face, s, t, weight * blend, sum);
+        }
+    }
+
+    // every texel of target: the weighted average of the table's samples around its direction
+    void convolve(const std::vector<FloatCube> &environment, const SampleTable &table, FloatCube &target, unsigned int threads)
+    {
+        int size = target.size;
+        forEachRows(6 * size, threads, [&](int firstRow, int lastRow)
+        {
+            CPU_ZONE("IBL convolve");
+            float faces[4], s[4], t[4];
+            for (int row = firstRow; row < lastRow; row++)
+            {
+                int face = row / size;
+                int y = row % size;
+                for (int x = 0; x < size; x++)
+                {
+                    glm::vec3 n = glm::normalize(faceDirection(face, (x + 0.5f) * 2.0f / size - 1.0f, (y + 0.5f) * 2.0f / size - 1.0f));
+                    glm::vec3 up = std::fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                    glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                    glm::vec3 bitangent = glm::cross(n, tangent);
+
+                    float sum[3] = {};
+                    float total = 0.0f;
+#if defined(MY_IBL_SSE) || defined(MY_IBL_NEON)
+                    Lanes tx = splat(tangent.x), ty = splat(tangent.y), tz = splat(tangent.z);
+                    Lanes bx = splat(bitangent.x), by = splat(bitangent.y), bz = splat(bitangent.z);
+                    Lanes nx = splat(n.x), ny = splat(n.y), nz = splat(n.z);
+                    for (size_t i = 0; i < table.size(); i += 4)
+                    {
+                        Lanes lx = load(&table.x[i]), ly = load(&table.y[i]), lz = load(&table.z[i]);
+                        Lanes wx = madd(tx, lx, madd(bx, ly, mul(nx, lz)));
+                        Lanes wy = madd(ty, lx, madd(by, ly, mul(ny, lz)));
+                        Lanes wz = madd(tz, lx, madd(bz, ly, mul(nz, lz)));
+                        faceCoordinates(wx, wy, wz, faces, s, t);
+                        for (size_t lane = 0; lane < 4; lane++)
+                        {
+                            float weight = table.weight[i + lane];
+                            if (weight > 0.0f)
+                            {
+                                sampleTrilinear(environment, (int)faces[lane], s[lane], t[lane], table.lod[i + lane], weight, sum);
+                                total += weight;
+                            }
+                        }
+                    }
+#else
+                    for (size_t i = 0; i < table.size(); i++)
+                    {
+                        float weight = table.weight[i];
+                        if (weight > 0.0f)
+                        {
+                            int sampleFace;
+                            float sampleS, sampleT;
+                            faceCoordinates(tangent * table.x[i] + bitangent * table.y[i] + n * table.z[i], sampleFace, sampleS, sampleT);
+                            sampleTrilinear(environment, sampleFace, sampleS, sampleT, table.lod[i], weight, sum);
+                            total += weight;
+                        }
+                    }
+#endif
+                    float *texel = target.texel(face, x, y);
+                    for (int channel = 0; channel < 3; channel++)
+                    {
+                        texel[channel] = total > 0.0f ? sum[channel] / total : 0.0f;
+                    }
+                }
+            }
+        });
+    }
+
+    // bilinear lookup of the equirectangular map, wrapping around the horizon
+    inline void sampleEquirect(const float *rgb, int width, int height, const glm::vec3 &direction, float *texel)
+    {
+        float u = std::atan2(direction.z, direction.x) / (2.0f * PI) + 0.5f;
+        float v = std::acos(std::min(std::max(direction.y, -1.0f), 1.0f)) / PI;
+        float x = u * width - 0.5f;
+        float y = std::min(std::max(v * height - 0.5f, 0.0f), (float)(height - 1));
+        float x0f = std::floor(x), y0f = std::floor(y);
+        float fx = x - x0f, fy = y - y0f;
+        int x0 = ((int)x0f % width + width) % width, x1 = (x0 + 1) % width;
+        int y0 = (int)y0f, y1 = std::min(y0 + 1, height - 1);
+        const float *a = &rgb[((size_t)y0 * width + x0) * 3], *b = &rgb[((size_t)y0 * width + x1) * 3];
+        const float *c = &rgb[((size_t)y1 * width + x0) * 3], *d = &rgb[((size_t)y1 * width + x1) * 3];
+        for (int channel = 0; channel < 3; channel++)
+        {
+            texel[channel] = (a[channel] * (1.0f - fx) + b[channel] * fx) * (1.0f - fy) + (c[channel] * (1.0f - fx) + d[channel] * fx) * fy;
+        }
+    }
+
+    // the environment's mip chain down to 1x1, each face box filtered on its own
+    std::vector<FloatCube> environmentMips(const float *rgb, int width, int height, unsigned int threads)
+    {
+        std::vector<FloatCube> mips;
+        mips.emplace_back(IBL_ENVIRONMENT_SIZE);
+        FloatCube &base = mips[0];
+        forEachRows(6 * base.size, threads, [&](int firstRow, int lastRow)
+        {
+            CPU_ZONE("IBL equirect to cube");
+            for (int row = firstRow; row < lastRow; row++)
+            {
+                int face = row / base.size;
+                int y = row % base.size;
+                for (int x = 0; x < base.size; x++)
+                {
+                    glm::vec3 direction = glm::normalize(faceDirection(face, (x + 0.5f) * 2.0f / base.size - 1.0f, (y + 0.5f) * 2.0f / base.size - 1.0f));
+                    sampleEquirect(rgb, width, height, direction, base.texel(face, x, y));
+                }
+            }
+        });
+
+        while (mips.back().size > 1)
+        {
+            const FloatCube &source = mips.back();
+            FloatCube level(source.size / 2);
+            for (int face = 0; face < 6; face++)
+            {
+                for (int y = 0; y < level.size; y++)
+                {
+                    for (int x = 0; x < level.size; x++)
+                    {
+                        const float *a = source.texel(face, x * 2, y * 2), *b = source.texel(face, x * 2 + 1, y * 2);
+                        const float *c = source.texel(face, x * 2, y * 2 + 1), *d = source.texel(face, x * 2 + 1, y * 2 + 1);
+                        float *texel = level.texel(face, x, y);
+                        for (int channel = 0; channel < 3; channel++)
+                        {
+                            texel[channel] = 0.25f * (a[channel] + b[channel] + c[channel] + d[channel]);
+                        }
+                    }
+                }
+            }
+            mips.push_back(std::move(level));
+        }
+        return mips;
+    }
+
+    // scale and bias of F0 in the split-sum approximation, k = roughness^2 / 2 for image based lighting
+    void brdfLut(std::vector<float> &rg, unsigned int threads)
+    {
+        const int size = IBL_BRDF_LUT_SIZE;
+        rg.resize((size_t)size * size * 2);
+        forEachRows(size, threads, [&](int firstRow, int lastRow)
+        {
+            CPU_ZONE("IBL BRDF table");
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                float roughness = (y + 0.5f) / size;
+                float alpha = roughness * roughness;
+                float k = alpha / 2.0f;
+                for (int x = 0; x < size; x++)
+                {
+                    float nDotV = (x + 0.5f) / size;
+                    glm::vec3 v(std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV);
+                    float scale = 0.0f, bias = 0.0f;
+                    for (int i = 0; i < IBL_BRDF_SAMPLES; i++)
+                    {
+                        glm::vec3 h = importanceSampleGgx(hammersley(i, IBL_BRDF_SAMPLES), alpha);
+                        float vDotH = glm::dot(v, h);
+                        glm::vec3 l = 2.0f * vDotH * h - v;
+                        if (l.z > 0.0f)
+                        {
+                            float g = (nDotV / (nDotV * (1.0f - k) + k)) * (l.z / (l.z * (1.0f - k) + k));
+                            float visibility = g * std::max(vDotH, 0.0f) / (h.z * nDotV);
+                            float fresnel = std::pow(1.0f - std::max(vDotH, 0.0f), 5.0f);
+                            scale += (1.0f - fresnel) * visibility;
+                            bias += fresnel * visibility;
+                        }
+                    }
+                    rg[((size_t)y * size + x) * 2] = scale / IBL_BRDF_SAMPLES;
+                    rg[((size_t)y * size + x) * 2 + 1] = bias / IBL_BRDF_SAMPLES;
+                }
+            }
+        });
+    }
+
+    inline void toHalf(const std::vector<float> &values, std::vector<uint16_t> &halves)
+    {
+        halves.resize(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            halves[i] = floatToHalf(values[i]);
+        }
+    }
+
+    inline void toHalf(const FloatCube &cube, IblCube &halves)
+    {
+        halves.size = cube.size;
+        toHalf(cube.rgb, halves.data);
+    }
+}
+
+void bakeIblMaps(const float *rgb, int width, int height, IblMaps &maps, unsigned int threads)
+{
+    using namespace ibl_detail;
+    CPU_ZONE("bakeIblMaps");
+    std::vector<FloatCube> environment = environmentMips(rgb, width, height, threads);
+    toHalf(environment[0], maps.environment);
+
+    FloatCube irradiance(IBL_IRRADIANCE_SIZE);
+    convolve(environment, irradianceSamples(IBL_ENVIRONMENT_SIZE), irradiance, threads);
+    toHalf(irradiance, maps.irradiance);
+
+    maps.prefilter.resize(IBL_PREFILTER_LEVELS);
+    for (int level = 0; level < IBL_PREFILTER_LEVELS; level++)
+    {
+        FloatCube prefiltered(IBL_PREFILTER_SIZE >> level);
+        float roughness = (float)level / (float)(IBL_PREFILTER_LEVELS - 1);
+        convolve(environment, prefilterSamples(roughness, IBL_ENVIRONMENT_SIZE, prefiltered.size), prefiltered, threads);
+        toHalf(prefiltered, maps.prefilter[level]);
+    }
+
+    std::vector<float> lut;
+    brdfLut(lut, threads);
+    maps.brdfLutSize = IBL_BRDF_LUT_SIZE;
+    toHalf(lut, maps.brdfLut);
+}
+
+
+namespace ibl_cache_detail
+{
+    // cache file layout: magic, version, environment, irradiance and prefilter sizes, prefilter level count,
+    // BRDF table size, then the half floats of the environment, irradiance, prefilter levels and table
+    const uint32_t IBL_CACHE_MAGIC = 0x42495347; // "GSIB"
+    // bump when the bake changes in a way the settings do not cover
+    const uint32_t IBL_CACHE_VERSION = 1;
+
+    inline bool readCube(std::ifstream &file, int size, IblCube &cube)
+    {
+        cube.size = size;
+        cube.data.resize((size_t)6 * size * size * 3);
+        file.read(reinterpret_cast<char *>(cube.data.data()), cube.data.size() * sizeof(uint16_t));
+        return (bool)file;
+    }
+
+    bool readCache(const std::filesystem::path &path, IblMaps &maps)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        uint32_t header[7] = {};
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!file || header[0] != IBL_CACHE_MAGIC || header[1] != IBL_CACHE_VERSION
+            || header[2] != IBL_ENVIRONMENT_SIZE || header[3] != IBL_IRRADIANCE_SIZE || header[4] != IBL_PREFILTER_SIZE
+            || header[5] != IBL_PREFILTER_LEVELS || header[6] != IBL_BRDF_LUT_SIZE)
+        {
+            return false;
+        }
+        if (!readCube(file, IBL_ENVIRONMENT_SIZE, maps.environment) || !readCube(file, IBL_IRRADIANCE_SIZE, maps.irradiance))
+        {
+            return false;
+        }
+        maps.prefilter.resize(IBL_PREFILTER_LEVELS);
+        for (int level = 0; level < IBL_PREFILTER_LEVELS; level++)
+        {
+            if (!readCube(file, IBL_PREFILTER_SIZE >> level, maps.prefilter[level]))
+            {
+                return false;
+            }
+        }
+        maps.brdfLutSize = IBL_BRDF_LUT_SIZE;
+        maps.brdfLut.resize((size_t)IBL_BRDF_LUT_SIZE * IBL_BRDF_LUT_SIZE * 2);
+        file.read(reinterpret_cast<char *>(maps.brdfLut.data()), maps.brdfLut.size() * sizeof(uint16_t));
+        return (bool)file;
+    }
+
+    void writeCache(const std::filesystem::path &path, const IblMaps &maps)
+    {
+        writeFileAtomic(path, "ERROR::IBL::CACHE_WRITE_FAILED", [&](std::ofstream &file)
+        {
+            uint32_t header[7] = { IBL_CACHE_MAGIC, IBL_CACHE_VERSION, (uint32_t)maps.environment.size, (uint32_t)maps.irradiance.size,
+                                   (uint32_t)maps.prefilter[0].size, (uint32_t)maps.prefilter.size(), (uint32_t)maps.brdfLutSize };
+            file.write(reinterpret_cast<const char *>(header), sizeof(header));
+            auto writeHalves = [&](const std::vector<uint16_t> &halves)
+            {
+                file.write(reinterpret_cast<const char *>(halves.data()), halves.size() * sizeof(uint16_t));
+            };
+            writeHalves(maps.environment.data);
+            writeHalves(maps.irradiance.data);
+            for (const IblCube &level : maps.prefilter)
+            {
+                writeHalves(level.data);
+            }
+            writeHalves(maps.brdfLut);
+        });
+    }
+}
+
+bool loadIblMaps(const std::string &path, IblMaps &maps, unsigned int threads)
+{
+    using namespace ibl_cache_detail;
+    CPU_ZONE("loadIblMaps");
+
+    // the file is read once, for the hash and for the decoder
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "ERROR::IBL::LOAD_FAILED: " << path << " (not found)" << std::endl;
+        return false;
+    }
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    uint64_t hash = hashBytes(bytes.data(), bytes.size());
+    const uint32_t settings[8] = { IBL_ENVIRONMENT_SIZE, IBL_IRRADIANCE_SIZE, IBL_PREFILTER_SIZE, IBL_PREFILTER_LEVELS,
+                                   IBL_BRDF_LUT_SIZE, IBL_IRRADIANCE_SAMPLES, IBL_PREFILTER_SAMPLES, IBL_BRDF_SAMPLES };
+    hash = hashBytes(settings, sizeof(settings), hash);
+    std::filesystem::path directory = cacheDirectory("IBL_CACHE_DIR", "graphics-start-ibl-cache");
+    std::filesystem::path cachePath;
+    if (!directory.empty())
+    {
+        cachePath = directory / (std::filesystem::path(path).stem().string() + "-" + hashHex(hash) + ".ibl");
+        if (readCache(cachePath, maps))
+        {
+            return true;
+        }
+    }
+
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(false);
+    float *rgb = stbi_loadf_from_memory(reinterpret_cast<const stbi_uc *>(bytes.data()), (int)bytes.size(), &width, &height, &channels, 3);
+    if (rgb == nullptr)
+    {
+        std::cout << "ERROR::IBL::LOAD_FAILED: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+        return false;
+    }
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto start = std::chrono::steady_clock::now();
+    bakeIblMaps(rgb, width, height, maps, threads);
+    stbi_image_free(rgb);
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "IBL::BAKED " << std::filesystem::path(path).filename().string() << " (" << width << "x" << height << ") in "
+              << (int)milliseconds << " ms on " << threads << " threads" << std::endl;
+
+    if (!cachePath.empty())
+    {
+        writeCache(cachePath, maps);
+    }
+    return true;
+}
+
+#endif /* my_ibl_bake_h */
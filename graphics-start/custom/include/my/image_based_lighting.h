@@ -0,0 +1,166 @@
+//
+//  image_based_lighting.h
+//  graphics-start
+//
+//  Ambient light and reflections from an HDR environment. The maps are baked on the CPU and cached
+//  on disk (my/ibl_bake.h), so startup renders nothing: they are only uploaded, as RGB16F cube maps
+//  (irradiance, prefiltered mip chain) and an RG16F table. The LIGHT_IBL variants of phong.fs and
+//  deferred_light.fs read them through custom/shaders/ibl.glsl: diffuse irradiance in place of the
+//  flat ambient term, plus the split-sum reflection of the prefiltered level that matches the
+//  roughness. drawBackground() shows the environment itself behind the scene.
+//
+//  ImageBasedLighting ibl(projectPath + "/resources/textures/hdr/newport_loft.hdr");
+//  if (ibl.loaded())
+//      ibl.setSamplers(shader);
+//  while (...)
+//  {
+//      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+//      ibl.bind();
+//      ibl.drawBackground(camera);
+//      ... draw with a LIGHT_IBL program ...
+//  }
+//  ibl.release();
+//
+
+#ifndef my_image_based_lighting_h
+#define my_image_based_lighting_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <my/camera.h>
+#include <my/cpu_profiler.h>
+#include <my/fullscreen_triangle.h>
+#include <my/ibl_bake.h>
+#include <my/path.h>
+#include <my/shader_s.h>
+
+#include <iostream>
+#include <string>
+
+class ImageBasedLighting
+{
+public:
+    // texture units in the lighting programs, below the shadow maps and the light clusters
+    static const GLuint IRRADIANCE_UNIT = 8;
+    static const GLuint PREFILTER_UNIT = 9;
+    static const GLuint BRDF_LUT_UNIT = 10;
+
+    // bakes the equirectangular HDR at path, or reads the bake back from the cache, and uploads it
+    ImageBasedLighting(const std::string &path);
+    ImageBasedLighting(const ImageBasedLighting&) = delete;
+    ImageBasedLighting& operator=(const ImageBasedLighting&) = delete;
+
+    // false when the HDR could not be read, programs should not use LIGHT_IBL then
+    bool loaded() const { return irradianceMap != 0; }
+    // points the samplers of a program at their units and sets the prefiltered level count, again after a relink
+    void setSamplers(Shader &shader) const;
+    // binds the maps the lighting reads to their units
+    void bind();
+    // the environment into every pixel of the bound framebuffer, before the scene: writes no depth
+    void drawBackground(Camera &camera);
+
+    void release();
+
+private:
+    Shader backgroundShader;
+    GLuint environmentMap = 0;
+    GLuint irradianceMap = 0;
+    GLuint prefilterMap = 0;
+    GLuint brdfLut = 0;
+    int prefilterLevels = 0;
+    FullscreenTriangle triangle;
+
+    static GLuint uploadCube(const std::vector<IblCube> &levels);
+};
+
+
+ImageBasedLighting::ImageBasedLighting(const std::string &path) : backgroundShader(shaderPath + "/deferred_light.vs", shaderPath + "/environment.fs")
+{
+    CPU_ZONE("ImageBasedLighting");
+    IblMaps maps;
+    if (!loadIblMaps(path, maps))
+    {
+        return;
+    }
+
+    environmentMap = uploadCube({ maps.environment });
+    irradianceMap = uploadCube({ maps.irradiance });
+    prefilterMap = uploadCube(maps.prefilter);
+    prefilterLevels = (int)maps.prefilter.size();
+
+    glGenTextures(1, &brdfLut);
+    glState.bindTexture(0, GL_TEXTURE_2D, brdfLut);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, maps.brdfLutSize, maps.brdfLutSize, 0, GL_RG, GL_HALF_FLOAT, maps.brdfLut.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // the blurred levels are a few texels wide, filtering across the face edges hides the seams
+    glState.enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    backgroundShader.use();
+    backgroundShader.setInt("environmentMap", 0);
+}
+
+GLuint ImageBasedLighting::uploadCube(const std::vector<IblCube> &levels)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glState.bindTexture(0, GL_TEXTURE_CUBE_MAP, texture);
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        for (int face = 0; face < 6; face++)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)level, GL_RGB16F, levels[level].size, levels[level].size, 0,
+                         GL_RGB, GL_HALF_FLOAT, levels[level].face(face));
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+void ImageBasedLighting::setSamplers(Shader &shader) const
+{
+    shader.use();
+    shader.setInt("irradianceMap", IRRADIANCE_UNIT);
+    shader.setInt("prefilterMap", PREFILTER_UNIT);
+    shader.setInt("brdfLut", BRDF_LUT_UNIT);
+    shader.setFloat("prefilterMaxLod", (float)(prefilterLevels - 1));
+}
+
+void ImageBasedLighting::bind()
+{
+    glState.bindTexture(IRRADIANCE_UNIT, GL_TEXTURE_CUBE_MAP, irradianceMap);
+    glState.bindTexture(PREFILTER_UNIT, GL_TEXTURE_CUBE_MAP, prefilterMap);
+    glState.bindTexture(BRDF_LUT_UNIT, GL_TEXTURE_2D, brdfLut);
+}
+
+void ImageBasedLighting::drawBackground(Camera &camera)
+{
+    CPU_ZONE("Environment background");
+    glState.disable(GL_DEPTH_TEST);
+    backgroundShader.use();
+    backgroundShader.setMat4("inverseViewProj", camera.GetInverseViewProjectionMatrix());
+    glState.bindTexture(0, GL_TEXTURE_CUBE_MAP, environmentMap);
+    triangle.draw();
+    glState.enable(GL_DEPTH_TEST);
+}
+
+void ImageBasedLighting::release()
+{
+    GLuint textures[] = { environmentMap, irradianceMap, prefilterMap, brdfLut };
+    if (irradianceMap != 0)
+    {
+        glState.deleteTextures(4, textures);
+        environmentMap = irradianceMap = prefilterMap = brdfLut = 0;
+    }
+    triangle.release();
+}
+
+#endif /* my_image_based_lighting_h */
@@ -0,0 +1,536 @@
+//
+//  light_clusters.h
+//  graphics-start
+//
+//  Clustered forward lighting.
+//  The view frustum is split into a CLUSTERS_X x CLUSTERS_Y x CLUSTERS_Z grid (screen tiles times
+//  depth slices spaced exponentially between the near and far plane). Every frame update() culls the
+//  lights against the frustum, then bins the visible ones into the clusters their sphere touches:
+//  the depth slices are split across a pool of worker threads, and each light is tested against the
+//  view space boxes of a slice's clusters 4 at a time (SSE, NEON).
+//  The result goes to the GPU through texture buffers (custom/shaders/clusters.glsl):
+//    - lights:  2 RGBA32F texels per visible light, position + radius and color
+//    - ranges:  one RG32UI texel per cluster, first index and count
+//    - indices: R16UI light indices, grouped per cluster
+//  so a fragment only loops over the lights of its cluster, however many lights the scene has.
+//
+//  LightClusters clusters;
+//  clusters.setSamplers(shader);
+//  while (...)
+//  {
+//      clusters.update(camera, lights);
+//      clusters.bind();
+//      ...
+//  }
+//  clusters.release();
+//
+
+#ifndef my_light_clusters_h
+#define my_light_clusters_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <glm/glm.hpp>
+#include <my/camera.h>
+#include <my/cpu_profiler.h>
+#include <my/frustum.h>
+#include <my/shader_s.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define MY_CLUSTERS_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MY_CLUSTERS_NEON 1
+#endif
+
+struct PointLight
+{
+    glm::vec3 position;
+    // the light fades to zero at radius
+    float radius;
+    glm::vec3 color;
+};
+
+// std140 layout of the Clusters block
+struct ClustersBlock
+{
+    // clusters along x, y and z, w is the number of visible lights
+    glm::uvec4 grid;
+    // depth slice = log(view depth) * x + y
+    glm::vec4 depth;
+};
+static_assert(sizeof(ClustersBlock) == 32, "ClustersBlock has to match the std140 layout in clusters.glsl");
+
+class LightClusters
+{
+public:
+    static const unsigned int CLUSTERS_X = 16;
+    static const unsigned int CLUSTERS_Y = 9;
+    static const unsigned int CLUSTERS_Z = 24;
+    static const unsigned int TILE_COUNT = CLUSTERS_X * CLUSTERS_Y;
+    static const unsigned int CLUSTER_COUNT = TILE_COUNT * CLUSTERS_Z;
+    // light indices are 16 bit
+    static const size_t MAX_VISIBLE_LIGHTS = 65535;
+    // texture units of the three buffers, above the ones the chapters use for materials
+    static const GLuint LIGHTS_UNIT = 13;
+    static const GLuint RANGES_UNIT = 14;
+    static const GLuint INDICES_UNIT = 15;
+
+    // workers 0 uses every core but one, the render thread bins a share too
+    LightClusters(unsigned int workers = 0);
+    ~LightClusters();
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // bins lights into the camera's clusters and uploads the result, once per frame before drawing
+    void update(Camera &camera, const std::vector<PointLight> &lights);
+    // binds the buffers to their units and the block to CLUSTERS_BLOCK_BINDING
+    void bind();
+    // points the cluster samplers of a program at their units, again after it is relinked
+    static void setSamplers(Shader &shader);
+
+    size_t visibleLights() const { return visibleCount; }
+    void printStats() const;
+    void release();
+
+private:
+    static const unsigned int MASK_WORDS = (TILE_COUNT + 31) / 32;
+
+    // one job bins a range of depth slices, its offsets start at 0 and are rebased after the join
+    struct Job
+    {
+        unsigned int firstSlice = 0;
+        unsigned int lastSlice = 0;
+        std::vector<uint16_t> indices;
+        // scratch: one tile mask per candidate light of the current slice
+        std::vector<uint32_t> masks;
+        std::vector<uint16_t> candidates;
+    };
+
+    // cluster boxes in view space (depth positive), slice major; x/y per cluster, depth per slice
+    float tileMinX[CLUSTER_COUNT], tileMaxX[CLUSTER_COUNT];
+    float tileMinY[CLUSTER_COUNT], tileMaxY[CLUSTER_COUNT];
+    float sliceDepth[CLUSTERS_Z + 1];
+    // projection the boxes were built for
+    float builtTanX = 0.0f, builtTanY = 0.0f, builtNear = 0.0f, builtFar = 0.0f;
+
+    // visible lights of this frame, view space, structure-of-arrays
+    std::vector<float> lightX, lightY, lightDepth, lightRadius;
+    std::vector<uint8_t> lightFirstSlice, lightLastSlice;
+    BoundingSpheres bounds;
+    std::vector<uint32_t> visible;
+    std::vector<glm::vec4> lightData;
+    std::vector<glm::uvec2> ranges;
+    size_t visibleCount = 0;
+
+    std::vector<Job> jobs;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned int generation = 0;
+    unsigned int remaining = 0;
+    bool stopping = false;
+
+    ClustersBlock block;
+    GLuint blockBuffer = 0;
+    GLuint buffers[3] = {};
+    GLuint textures[3] = {};
+
+    // statistics
+    size_t frames = 0;
+    size_t indexCount = 0;
+    unsigned int maxPerCluster = 0;
+    double binMs = 0.0;
+    // frames that dropped visible lights over MAX_VISIBLE_LIGHTS, reported once and then counted
+    size_t overflowFrames = 0;
+
+    void buildClusters(float tanX, float tanY, float nearPlane, float farPlane);
+    void workerLoop(unsigned int job);
+    void binSlices(Job &job);
+};
+
+
+LightClusters::LightClusters(unsigned int workerCount)
+{
+    if (workerCount == 0)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        workerCount = cores > 1 ? cores - 1 : 1;
+    }
+    // a job per thread, at least one slice each
+    unsigned int jobCount = std::min(workerCount + 1, CLUSTERS_Z);
+    jobs.resize(jobCount);
+    for (unsigned int i = 0; i < jobCount; i++)
+    {
+        jobs[i].firstSlice = CLUSTERS_Z * i / jobCount;
+        jobs[i].lastSlice = CLUSTERS_Z * (i + 1) / jobCount;
+    }
+    for (unsigned int i = 1; i < jobCount; i++)
+    {
+        workers.emplace_back(&LightClusters::workerLoop, this, i);
+    }
+    ranges.resize(CLUSTER_COUNT);
+
+    glGenBuffers(1, &blockBuffer);
+    glState.bindBuffer(GL_UNIFORM_BUFFER, blockBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClustersBlock), NULL, GL_DYNAMIC_DRAW);
+
+    // the buffer textures stay attached while their storage is reallocated every frame
+    const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; i++)
+    {
+        glState.bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glState.bindTexture(LIGHTS_UNIT + i, GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+}
+
+LightClusters::~LightClusters()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ Depth slices are spaced exponentially, so clusters stay roughly cube shaped in view space. A tile's
+ box over a slice spans its side planes at both the near and the far depth of the slice.
+ */
+void LightClusters::buildClusters(float tanX, float tanY, float nearPlane, float farPlane)
+{
+    for (unsigned int z = 0; z <= CLUSTERS_Z; z++)
+    {
+        sliceDepth[z] = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTERS_Z);
+    }
+    for (unsigned int z = 0; z < CLUSTERS_Z; z++)
+    {
+        float nearDepth = sliceDepth[z];
+        float farDepth = sliceDepth[z + 1];
+        for (unsigned int y = 0; y < CLUSTERS_Y; y++)
+        {
+            float bottom = (-1.0f + 2.0f * y / CLUSTERS_Y) * tanY;
+            float top = (-1.0f + 2.0f * (y + 1) / CLUSTERS_Y) * tanY;
+            for (unsigned int x = 0; x < CLUSTERS_X; x++)
+            {
+                float left = (-1.0f + 2.0f * x / CLUSTERS_X) * tanX;
+                float right = (-1.0f + 2.0f * (x + 1) / CLUSTERS_X) * tanX;
+                unsigned int cluster = (z * CLUSTERS_Y + y) * CLUSTERS_X + x;
+                tileMinX[cluster] = std::min(left * nearDepth, left * farDepth);
+                tileMaxX[cluster] = std::max(right * nearDepth, right * farDepth);
+                tileMinY[cluster] = std::min(bottom * nearDepth, bottom * farDepth);
+                tileMaxY[cluster] = std::max(top * nearDepth, top * farDepth);
+            }
+        }
+    }
+
+    float logRatio = std::log(farPlane / nearPlane);
+    block.grid = glm::uvec4(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, 0);
+    block.depth = glm::vec4(CLUSTERS_Z / logRatio, -(float)CLUSTERS_Z * std::log(nearPlane) / logRatio, 0.0f, 0.0f);
+    builtTanX = tanX;
+    builtTanY = tanY;
+    builtNear = nearPlane;
+    builtFar = farPlane;
+}
+
+void LightClusters::update(Camera &camera, const std::vector<PointLight> &lights)
+{
+    CPU_ZONE("LightClusters::update");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const glm::mat4 &projection = camera.GetProjectionMatrix();
+    float tanX = 1.0f / projection[0][0];
+    float tanY = 1.0f / projection[1][1];
+    if (tanX != builtTanX || tanY != builtTanY || camera.NearPlane != builtNear || camera.FarPlane != builtFar)
+    {
+        buildClusters(tanX, tanY, camera.NearPlane, camera.FarPlane);
+    }
+
+    {
+        CPU_ZONE("Light culling");
+        bounds.clear();
+        for (const PointLight &light : lights)
+        {
+            bounds.push_back(light.position, light.radius);
+        }
+        cullSpheres(camera.GetFrustum(), bounds, visible);
+        if (visible.size() > MAX_VISIBLE_LIGHTS)
+        {
+            if (overflowFrames++ == 0)
+            {
+                std::cout << "ERROR::LIGHT_CLUSTERS::TOO_MANY_LIGHTS: " << visible.size() << " visible, the first " << MAX_VISIBLE_LIGHTS << " are kept" << std::endl;
+            }
+            visible.resize(MAX_VISIBLE_LIGHTS);
+        }
+    }
+
+    // view space centers and the depth slices each light overlaps
+    const glm::mat4 &view = camera.GetViewMatrix();
+    visibleCount = visible.size();
+    lightX.resize(visibleCount);
+    lightY.resize(visibleCount);
+    lightDepth.resize(visibleCount);
+    lightRadius.resize(visibleCount);
+    lightFirstSlice.resize(visibleCount);
+    lightLastSlice.resize(visibleCount);
+    lightData.resize(std::max<size_t>(visibleCount, 1) * 2);
+    for (size_t i = 0; i < visibleCount; i++)
+    {
+        const PointLight &light = lights[visible[i]];
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        lightX[i] = center.x;
+        lightY[i] = center.y;
+        lightDepth[i] = -center.z;
+        lightRadius[i] = light.radius;
+        float nearSlice = std::log(std::max(lightDepth[i] - light.radius, builtNear)) * block.depth.x + block.depth.y;
+        float farSlice = std::log(std::max(lightDepth[i] + light.radius, builtNear)) * block.depth.x + block.depth.y;
+        lightFirstSlice[i] = (uint8_t)std::min(std::max(nearSlice, 0.0f), (float)CLUSTERS_Z - 1.0f);
+        lightLastSlice[i] = (uint8_t)std::min(std::max(farSlice, 0.0f), (float)CLUSTERS_Z - 1.0f);
+        lightData[i * 2] = glm::vec4(light.position, light.radius);
+        lightData[i * 2 + 1] = glm::vec4(light.color, 0.0f);
+    }
+
+    // the render thread takes job 0 while the workers run the others
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        remaining = (unsigned int)workers.size();
+    }
+    wake.notify_all();
+    binSlices(jobs[0]);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return remaining == 0; });
+    }
+
+    CPU_ZONE("Light cluster upload");
+    size_t total = 0;
+    for (Job &job : jobs)
+    {
+        for (unsigned int cluster = job.firstSlice * TILE_COUNT; cluster < job.lastSlice * TILE_COUNT; cluster++)
+        {
+            ranges[cluster].x += (unsigned int)total;
+            maxPerCluster = std::max(maxPerCluster, ranges[cluster].y);
+        }
+        total += job.indices.size();
+    }
+
+    // orphaned every frame, the draws of the previous frame keep reading the old storage
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, ranges.size() * sizeof(glm::uvec2), ranges.data(), GL_STREAM_DRAW);
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(total, 1) * sizeof(uint16_t), NULL, GL_STREAM_DRAW);
+    size_t offset = 0;
+    for (Job &job : jobs)
+    {
+        if (!job.indices.empty())
+        {
+            glBufferSubData(GL_TEXTURE_BUFFER, offset * sizeof(uint16_t), job.indices.size() * sizeof(uint16_t), job.indices.data());
+        }
+        offset += job.indices.size();
+    }
+
+    block.grid.w = (unsigned int)visibleCount;
+    glState.bindBuffer(GL_UNIFORM_BUFFER, blockBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClustersBlock), &block);
+
+    frames++;
+    indexCount = total;
+    binMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void LightClusters::workerLoop(unsigned int job)
+{
+    cpuProfiler.setThreadName("light clusters");
+    unsigned int seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+        }
+        binSlices(jobs[job]);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining--;
+        }
+        done.notify_one();
+    }
+}
+
+/**
+ Per slice: test every light overlapping the slice against the slice's tiles (sphere vs box, the
+ squared distance from the center to the box against the radius left after the depth gap), keeping
+ a tile mask per light. Then count the hits per cluster, turn the counts into offsets and write the
+ indices, so each cluster's lights end up contiguous without a sort.
+ */
+void LightClusters::binSlices(Job &job)
+{
+    CPU_ZONE("Light binning");
+    job.indices.clear();
+    for (unsigned int slice = job.firstSlice; slice < job.lastSlice; slice++)
+    {
+        const float *minX = &tileMinX[slice * TILE_COUNT];
+        const float *maxX = &tileMaxX[slice * TILE_COUNT];
+        const float *minY = &tileMinY[slice * TILE_COUNT];
+        const float *maxY = &tileMaxY[slice * TILE_COUNT];
+        float nearDepth = sliceDepth[slice];
+        float farDepth = sliceDepth[slice + 1];
+
+        job.candidates.clear();
+        job.masks.clear();
+        for (size_t light = 0; light < visibleCount; light++)
+        {
+            if (slice < lightFirstSlice[light] || slice > lightLastSlice[light])
+            {
+                continue;
+            }
+            float gap = std::max(0.0f, std::max(nearDepth - lightDepth[light], lightDepth[light] - farDepth));
+            float reach = lightRadius[light] * lightRadius[light] - gap * gap;
+            if (reach < 0.0f)
+            {
+                continue;
+            }
+
+            size_t first = job.masks.size();
+            job.masks.resize(first + MASK_WORDS, 0);
+            uint32_t *mask = &job.masks[first];
+            float cx = lightX[light], cy = lightY[light];
+            unsigned int tile = 0;
+#if defined(MY_CLUSTERS_SSE)
+            __m128 x = _mm_set1_ps(cx), y = _mm_set1_ps(cy), limit = _mm_set1_ps(reach), zero = _mm_setzero_ps();
+            for (; tile + 4 <= TILE_COUNT; tile += 4)
+            {
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[tile]), x), _mm_sub_ps(x, _mm_loadu_ps(&maxX[tile]))), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[tile]), y), _mm_sub_ps(y, _mm_loadu_ps(&maxY[tile]))), zero);
+                __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                mask[tile / 32] |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(distance, limit)) << (tile % 32);
+            }
+#elif defined(MY_CLUSTERS_NEON)
+            float32x4_t x = vdupq_n_f32(cx), y = vdupq_n_f32(cy), limit = vdupq_n_f32(reach), zero = vdupq_n_f32(0.0f);
+            const uint32_t weights[4] = { 1, 2, 4, 8 };
+            uint32x4_t bits = vld1q_u32(weights);
+            for (; tile + 4 <= TILE_COUNT; tile += 4)
+            {
+                float32x4_t dx = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(&minX[tile]), x), vsubq_f32(x, vld1q_f32(&maxX[tile]))), zero);
+                float32x4_t dy = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(&minY[tile]), y), vsubq_f32(y, vld1q_f32(&maxY[tile]))), zero);
+                float32x4_t distance = vmlaq_f32(vmulq_f32(dx, dx), dy, dy);
+                mask[tile / 32] |= vaddvq_u32(vandq_u32(vcleq_f32(distance, limit), bits)) << (tile % 32);
+            }
+#endif
+            for (; tile < TILE_COUNT; tile++)
+            {
+                float dx = std::max(0.0f, std::max(minX[tile] - cx, cx - maxX[tile]));
+                float dy = std::max(0.0f, std::max(minY[tile] - cy, cy - maxY[tile]));
+                if (dx * dx + dy * dy <= reach)
+                {
+                    mask[tile / 32] |= 1u << (tile % 32);
+                }
+            }
+            job.candidates.push_back((uint16_t)light);
+        }
+
+        glm::uvec2 *sliceRanges = &ranges[slice * TILE_COUNT];
+        for (unsigned int tile = 0; tile < TILE_COUNT; tile++)
+        {
+            sliceRanges[tile] = glm::uvec2(0, 0);
+        }
+        for (size_t candidate = 0; candidate < job.candidates.size(); candidate++)
+        {
+            for (unsigned int word = 0; word < MASK_WORDS; word++)
+            {
+                for (uint32_t bits = job.masks[candidate * MASK_WORDS + word]; bits != 0; bits &= bits - 1)
+                {
+                    sliceRanges[word * 32 + maskLowestBit(bits)].y++;
+                }
+            }
+        }
+        unsigned int offset = (unsigned int)job.indices.size();
+        for (unsigned int tile = 0; tile < TILE_COUNT; tile++)
+        {
+            sliceRanges[tile].x = offset;
+            offset += sliceRanges[tile].y;
+        }
+        job.indices.resize(offset);
+        // x doubles as the write cursor, and is put back after
+        for (size_t candidate = 0; candidate < job.candidates.size(); candidate++)
+        {
+            for (unsigned int word = 0; word < MASK_WORDS; word++)
+            {
+                for (uint32_t bits = job.masks[candidate * MASK_WORDS + word]; bits != 0; bits &= bits - 1)
+                {
+                    job.indices[sliceRanges[word * 32 + maskLowestBit(bits)].x++] = job.candidates[candidate];
+                }
+            }
+        }
+        for (unsigned int tile = 0; tile < TILE_COUNT; tile++)
+        {
+            sliceRanges[tile].x -= sliceRanges[tile].y;
+        }
+    }
+}
+
+void LightClusters::bind()
+{
+    glState.bindBufferBase(GL_UNIFORM_BUFFER, CLUSTERS_BLOCK_BINDING, blockBuffer);
+    for (int i = 0; i < 3; i++)
+    {
+        glState.bindTexture(LIGHTS_UNIT + i, GL_TEXTURE_BUFFER, textures[i]);
+    }
+}
+
+void LightClusters::setSamplers(Shader &shader)
+{
+    shader.use();
+    shader.setInt("clusterLights", LIGHTS_UNIT);
+    shader.setInt("clusterRanges", RANGES_UNIT);
+    shader.setInt("clusterIndices", INDICES_UNIT);
+}
+
+void LightClusters::printStats() const
+{
+    std::cout << "LIGHT_CLUSTERS::STATS clusters=" << CLUSTERS_X << "x" << CLUSTERS_Y << "x" << CLUSTERS_Z
+              << " visible=" << visibleCount << " indices=" << indexCount << " max per cluster=" << maxPerCluster
+              << " update=" << std::fixed << std::setprecision(3) << (frames ? binMs / frames : 0.0) << "ms on "
+              << jobs.size() << " threads" << std::defaultfloat << " overflow frames=" << overflowFrames << std::endl;
+}
+
+void LightClusters::release()
+{
+    glState.deleteTextures(3, textures);
+    glState.deleteBuffers(3, buffers);
+    glState.deleteBuffers(1, &blockBuffer);
+    std::fill(textures, textures + 3, 0);
+    std::fill(buffers, buffers + 3, 0);
+    blockBuffer = 0;
+}
+
+#endif /* my_light_clusters_h */
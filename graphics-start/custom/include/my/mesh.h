@@ -0,0 +1,592 @@
+//
+//  mesh.h
+//  graphics-start
+//
+//  Indexed triangle meshes.
+//  Every mesh goes through optimize() before upload:
+//    1. weld: identical vertices are merged, the triangle list becomes an index buffer
+//    2. vertex cache: triangles are reordered for the post-transform cache (Forsyth's linear-speed
+//       algorithm, scored for a 32 entry LRU cache)
+//    3. vertex fetch: vertices are renumbered in order of first use, so fetches walk the VBO linearly
+//  and prints ACMR (vertex transforms per triangle) and ATVR (transforms per unique vertex) of a
+//  simulated FIFO cache before and after.
+//
+//  Vertices are interleaved floats. Indices are uploaded as 16 bits when the mesh is small enough.
+//  fromBuffers wraps data that is already in that form (a mapped mesh cache, see mesh_cache.h) and
+//  uploads it without copying; such a mesh has no CPU-side vertices or indices.
+//
+//  Mesh cube = Mesh::fromTriangles(vertices, sizeof(vertices) / sizeof(float), 5, "cube");
+//  GLuint vao = cube.createVertexArray({ { 0, 3 }, { 1, 2 } }); // position, texcoord
+//  glState.bindVertexArray(vao);
+//  cube.draw();
+//
+
+#ifndef my_mesh_h
+#define my_mesh_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <my/cpu_profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MeshStats
+{
+    // average transforms per triangle, 0.5 is the best case for a regular grid and 3 the worst
+    float acmr = 0.0f;
+    // average transforms per referenced vertex, 1 is ideal
+    float atvr = 0.0f;
+};
+
+// a range of the index buffer drawn with one material; the cache optimization keeps triangles inside their section
+struct MeshSection
+{
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    uint32_t material = 0;
+};
+
+// one float attribute of the interleaved vertex, offset counted in floats
+struct MeshAttribute
+{
+    GLuint location;
+    GLint components;
+    GLint offset = -1; // -1: right after the previous attribute
+    MeshAttribute(GLuint location, GLint components, GLint offset = -1) : location(location), components(components), offset(offset) {}
+};
+
+class Mesh
+{
+public:
+    static const unsigned int FIFO_CACHE_SIZE = 16;
+
+    std::string name;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    unsigned int floatsPerVertex = 0;
+    // empty when the whole index buffer is one section
+    std::vector<MeshSection> sections;
+
+    Mesh() {}
+    Mesh(const std::string &name, std::vector<float> vertices, std::vector<uint32_t> indices, unsigned int floatsPerVertex);
+
+    // from a non-indexed triangle list (the usual float vertices[] of the chapters), optimized
+    static Mesh fromTriangles(const float *data, size_t floatCount, unsigned int floatsPerVertex, const std::string &name = "mesh");
+    // from an existing index buffer, optimized
+    static Mesh fromIndexed(std::vector<float> vertices, std::vector<uint32_t> indices, unsigned int floatsPerVertex, const std::string &name = "mesh", std::vector<MeshSection> sections = {});
+    // already optimized data, indices in indexType() format; storage keeps the memory alive until the upload
+    static Mesh fromBuffers(const std::string &name, unsigned int floatsPerVertex, const float *vertexData, uint32_t vertexCount, const void *indexData, uint32_t indexCount, std::vector<MeshSection> sections, std::shared_ptr<const void> storage);
+
+    size_t vertexCount() const { return !vertices.empty() && floatsPerVertex ? vertices.size() / floatsPerVertex : bufferVertexCount; }
+    size_t triangleCount() const { return indexCount() / 3; }
+
+    void weld();
+    void optimizeVertexCache();
+    void optimizeVertexFetch();
+    // all three, reporting the statistics before and after
+    void optimize();
+
+    MeshStats stats(unsigned int cacheSize = FIFO_CACHE_SIZE) const;
+
+    // uploads the buffers on first use; every VAO shares them, e.g. a light cube that only reads positions
+    GLuint createVertexArray(const std::vector<MeshAttribute> &attributes);
+    GLenum indexType() const { return vertexCount() <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+    GLsizei indexCount() const { return (GLsizei)(indices.empty() ? bufferIndexCount : indices.size()); }
+
+    // with the mesh's VAO bound
+    void draw() const;
+    void drawInstanced(GLsizei instances) const;
+    void drawSection(size_t section) const;
+
+    void release();
+
+    GLuint VBO = 0;
+    GLuint EBO = 0;
+    std::vector<GLuint> vertexArrays;
+
+private:
+    // fromBuffers data, the pointers are dropped after the upload
+    std::shared_ptr<const void> bufferStorage;
+    const float *bufferVertices = nullptr;
+    const void *bufferIndices = nullptr;
+    uint32_t bufferVertexCount = 0;
+    uint32_t bufferIndexCount = 0;
+
+    void upload();
+    void optimizeVertexCache(size_t firstIndex, size_t indexCount);
+};
+
+
+Mesh::Mesh(const std::string &name, std::vector<float> vertices, std::vector<uint32_t> indices, unsigned int floatsPerVertex): name(name), vertices(std::move(vertices)), indices(std::move(indices)), floatsPerVertex(floatsPerVertex)
+{
+}
+
+Mesh Mesh::fromTriangles(const float *data, size_t floatCount, unsigned int floatsPerVertex, const std::string &name)
+{
+    std::vector<float> vertices(data, data + floatCount);
+    std::vector<uint32_t> indices(floatCount / floatsPerVertex);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        indices[i] = (uint32_t)i;
+    }
+    return fromIndexed(std::move(vertices), std::move(indices), floatsPerVertex, name);
+}
+
+Mesh Mesh::fromBuffers(const std::string &name, unsigned int floatsPerVertex, const float *vertexData, uint32_t vertexCount, const void *indexData, uint32_t indexCount, std::vector<MeshSection> sections, std::shared_ptr<const void> storage)
+{
+    Mesh mesh;
+    mesh.name = name;
+    mesh.floatsPerVertex = floatsPerVertex;
+    mesh.sections = std::move(sections);
+    mesh.bufferStorage = std::move(storage);
+    mesh.bufferVertices = vertexData;
+    mesh.bufferIndices = indexData;
+    mesh.bufferVertexCount = vertexCount;
+    mesh.bufferIndexCount = indexCount;
+    return mesh;
+}
+
+Mesh Mesh::fromIndexed(std::vector<float> vertices, std::vector<uint32_t> indices, unsigned int floatsPerVertex, const std::string &name, std::vector<MeshSection> sections)
+{
+    Mesh mesh(name, std::move(vertices), std::move(indices), floatsPerVertex);
+    mesh.sections = std::move(sections);
+    mesh.optimize();
+    return mesh;
+}
+
+void Mesh::optimize()
+{
+    CPU_ZONE("Mesh::optimize");
+    size_t vertexCountBefore = vertexCount();
+    MeshStats before = stats();
+
+    weld();
+    optimizeVertexCache();
+    optimizeVertexFetch();
+
+    MeshStats after = stats();
+    std::cout << "MESH::OPTIMIZE " << name << " triangles=" << triangleCount()
+              << " vertices " << vertexCountBefore << " -> " << vertexCount()
+              << std::fixed << std::setprecision(3)
+              << " ACMR " << before.acmr << " -> " << after.acmr
+              << " ATVR " << before.atvr << " -> " << after.atvr
+              << std::defaultfloat << std::endl;
+}
+
+/**
+ Merges bitwise identical vertices with an open addressing hash table and rewrites the indices.
+ */
+void Mesh::weld()
+{
+    size_t count = vertexCount();
+    if (count == 0)
+    {
+        return;
+    }
+    const size_t stride = floatsPerVertex * sizeof(float);
+    const float *source = vertices.data();
+
+    auto hashOf = [&](size_t vertex)
+    {
+        const unsigned char *bytes = (const unsigned char *)(source + vertex * floatsPerVertex);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < stride; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    };
+
+    size_t tableSize = 1;
+    while (tableSize < count * 2)
+    {
+        tableSize <<= 1;
+    }
+    const uint32_t EMPTY = 0xFFFFFFFFu;
+    std::vector<uint32_t> table(tableSize, EMPTY);
+    std::vector<uint32_t> remap(count);
+    std::vector<float> welded;
+    welded.reserve(vertices.size());
+
+    for (size_t vertex = 0; vertex < count; vertex++)
+    {
+        size_t slot = hashOf(vertex) & (tableSize - 1);
+        while (true)
+        {
+            uint32_t existing = table[slot];
+            if (existing == EMPTY)
+            {
+                uint32_t id = (uint32_t)(welded.size() / floatsPerVertex);
+                welded.insert(welded.end(), source + vertex * floatsPerVertex, source + (vertex + 1) * floatsPerVertex);
+                table[slot] = (uint32_t)vertex;
+                remap[vertex] = id;
+                break;
+            }
+            if (std::memcmp(source + existing * floatsPerVertex, source + vertex * floatsPerVertex, stride) == 0)
+            {
+                remap[vertex] = remap[existing];
+                break;
+            }
+            slot = (slot + 1) & (tableSize - 1);
+        }
+    }
+
+    for (uint32_t &index : indices)
+    {
+        index = remap[index];
+    }
+    vertices.swap(welded);
+}
+
+namespace mesh_detail
+{
+    // Forsyth, "Linear-Speed Vertex Cache Optimisation"
+    const int LRU_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    inline float vertexScore(int cachePosition, uint32_t remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+        {
+            return -1.0f;
+        }
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+            {
+                // the triangle just drawn, scored flat so its vertices are not favoured too much
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else
+            {
+                float scaler = 1.0f / (LRU_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+        // vertices with few triangles left are finished first so they leave the working set
+        score += VALENCE_BOOST_SCALE * std::pow((float)remainingTriangles, -VALENCE_BOOST_POWER);
+        return score;
+    }
+}
+
+void Mesh::optimizeVertexCache()
+{
+    if (sections.empty())
+    {
+        optimizeVertexCache(0, indices.size());
+        return;
+    }
+    for (const MeshSection &section : sections)
+    {
+        optimizeVertexCache(section.firstIndex, section.indexCount);
+    }
+}
+
+void Mesh::optimizeVertexCache(size_t firstIndex, size_t indexCount)
+{
+    using namespace mesh_detail;
+    const uint32_t *indices = this->indices.data() + firstIndex;
+    size_t triangles = indexCount / 3;
+    size_t count = vertexCount();
+    if (triangles == 0)
+    {
+        return;
+    }
+
+    // triangles of every vertex, as offsets into one adjacency array
+    std::vector<uint32_t> remaining(count, 0);
+    for (size_t i = 0; i < triangles * 3; i++)
+    {
+        remaining[indices[i]]++;
+    }
+    std::vector<uint32_t> adjacencyStart(count + 1, 0);
+    for (size_t v = 0; v < count; v++)
+    {
+        adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+    }
+    std::vector<uint32_t> adjacency(triangles * 3);
+    std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t t = 0; t < triangles; t++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+        {
+            uint32_t v = indices[t * 3 + corner];
+            adjacency[fill[v]++] = (uint32_t)t;
+        }
+    }
+
+    std::vector<int> cachePosition(count, -1);
+    std::vector<float> score(count);
+    for (size_t v = 0; v < count; v++)
+    {
+        score[v] = vertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(triangles);
+    for (size_t t = 0; t < triangles; t++)
+    {
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+    }
+
+    std::vector<char> emitted(triangles, 0);
+    std::vector<uint32_t> output;
+    output.reserve(triangles * 3);
+
+    // LRU cache of vertex ids, 3 spare entries for the vertices being pushed in
+    std::vector<uint32_t> cache, nextCache;
+    cache.reserve(LRU_CACHE_SIZE + 3);
+    nextCache.reserve(LRU_CACHE_SIZE + 3);
+
+    size_t scanCursor = 0;
+    int64_t best = -1;
+    for (size_t t = 0; t < triangles; t++)
+    {
+        if (triangleScore[t] > (best < 0 ? -1.0f : triangleScore[best]))
+        {
+            best = (int64_t)t;
+        }
+    }
+
+    while (best >= 0)
+    {
+        uint32_t triangle = (uint32_t)best;
+        emitted[triangle] = 1;
+        const uint32_t *corners = &indices[triangle * 3];
+        output.insert(output.end(), corners, corners + 3);
+
+        // the triangle's vertices go to the front of the cache, everything else moves back
+        nextCache.clear();
+        for (int corner = 0; corner < 3; corner++)
+        {
+            uint32_t v = corners[corner];
+            nextCache.push_back(v);
+
+            // drop the triangle from the vertex's remaining list
+            uint32_t *begin = &adjacency[adjacencyStart[v]];
+            uint32_t *end = begin + remaining[v];
+            uint32_t *found = std::find(begin, end, triangle);
+            std::swap(*found, *(end - 1));
+            remaining[v]--;
+        }
+        for (uint32_t v : cache)
+        {
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+            {
+                nextCache.push_back(v);
+            }
+        }
+        cache.swap(nextCache);
+
+        // vertices pushed out of the cache lose their cache score
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            uint32_t v = cache[i];
+            cachePosition[v] = i < (size_t)LRU_CACHE_SIZE ? (int)i : -1;
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        if (cache.size() > (size_t)LRU_CACHE_SIZE)
+        {
+            cache.resize(LRU_CACHE_SIZE);
+        }
+
+        // only triangles touching the cache changed score, the best next one is among them
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : cache)
+        {
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                uint32_t t = adjacency[adjacencyStart[v] + i];
+                const uint32_t *tc = &indices[t * 3];
+                float s = score[tc[0]] + score[tc[1]] + score[tc[2]];
+                triangleScore[t] = s;
+                if (s > bestScore)
+                {
+                    bestScore = s;
+                    best = t;
+                }
+            }
+        }
+
+        // nothing left around the cache, continue with the next triangle not drawn yet
+        if (best < 0)
+        {
+            while (scanCursor < triangles && emitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            if (scanCursor < triangles)
+            {
+                best = (int64_t)scanCursor;
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), this->indices.begin() + firstIndex);
+}
+
+void Mesh::optimizeVertexFetch()
+{
+    size_t count = vertexCount();
+    const uint32_t UNUSED = 0xFFFFFFFFu;
+    std::vector<uint32_t> remap(count, UNUSED);
+    std::vector<float> ordered;
+    ordered.reserve(vertices.size());
+
+    // unreferenced vertices are dropped
+    for (uint32_t &index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            remap[index] = (uint32_t)(ordered.size() / floatsPerVertex);
+            ordered.insert(ordered.end(), vertices.begin() + index * floatsPerVertex, vertices.begin() + (index + 1) * floatsPerVertex);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+/**
+ Simulates a FIFO post-transform cache over the index buffer.
+ */
+MeshStats Mesh::stats(unsigned int cacheSize) const
+{
+    MeshStats result;
+    if (indices.empty())
+    {
+        return result;
+    }
+
+    std::vector<uint32_t> insertedAt(vertexCount(), 0);
+    std::vector<char> referenced(vertexCount(), 0);
+    uint32_t transforms = 0;
+    size_t unique = 0;
+    for (uint32_t index : indices)
+    {
+        // a vertex is still cached if fewer than cacheSize misses happened since it was transformed
+        if (insertedAt[index] == 0 || transforms - insertedAt[index] >= cacheSize)
+        {
+            transforms++;
+            insertedAt[index] = transforms;
+        }
+        if (!referenced[index])
+        {
+            referenced[index] = 1;
+            unique++;
+        }
+    }
+    result.acmr = (float)transforms / triangleCount();
+    result.atvr = (float)transforms / unique;
+    return result;
+}
+
+void Mesh::upload()
+{
+    if (VBO != 0)
+    {
+        return;
+    }
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    if (bufferVertices != nullptr)
+    {
+        // straight from the caller's memory, e.g. a mapped file, no intermediate copy
+        size_t indexSize = indexType() == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, (size_t)bufferVertexCount * floatsPerVertex * sizeof(float), bufferVertices, GL_STATIC_DRAW);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, (size_t)bufferIndexCount * indexSize, bufferIndices, GL_STATIC_DRAW);
+        bufferVertices = nullptr;
+        bufferIndices = nullptr;
+        bufferStorage.reset();
+        return;
+    }
+
+    glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+
+    // the element buffer binding is VAO state, so it is filled through another target and only attached in createVertexArray
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+    if (indexType() == GL_UNSIGNED_SHORT)
+    {
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_COPY_WRITE_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    }
+}
+
+GLuint Mesh::createVertexArray(const std::vector<MeshAttribute> &attributes)
+{
+    upload();
+
+    GLuint vao = 0;
+    glGenVertexArrays(1, &vao);
+    glState.bindVertexArray(vao);
+    glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    GLint offset = 0;
+    for (const MeshAttribute &attribute : attributes)
+    {
+        if (attribute.offset >= 0)
+        {
+            offset = attribute.offset;
+        }
+        glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(float), (void*)(offset * sizeof(float)));
+        glEnableVertexAttribArray(attribute.location);
+        offset += attribute.components;
+    }
+
+    vertexArrays.push_back(vao);
+    return vao;
+}
+
+void Mesh::draw() const
+{
+    glState.drawElements(GL_TRIANGLES, indexCount(), indexType(), (void*)0);
+}
+
+void Mesh::drawInstanced(GLsizei instances) const
+{
+    glState.drawElementsInstanced(GL_TRIANGLES, indexCount(), indexType(), (void*)0, instances);
+}
+
+void Mesh::drawSection(size_t section) const
+{
+    const MeshSection &range = sections[section];
+    size_t indexSize = indexType() == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    glState.drawElements(GL_TRIANGLES, range.indexCount, indexType(), (void*)(range.firstIndex * indexSize));
+}
+
+void Mesh::release()
+{
+    if (!vertexArrays.empty())
+    {
+        glState.deleteVertexArrays((GLsizei)vertexArrays.size(), vertexArrays.data());
+        vertexArrays.clear();
+    }
+    if (VBO != 0)
+    {
+        glState.deleteBuffers(1, &VBO);
+        glState.deleteBuffers(1, &EBO);
+        VBO = EBO = 0;
+    }
+}
+
+#endif /* my_mesh_h */
@@ -0,0 +1,467 @@
+//
+//  mesh_cache.h
+//  graphics-start
+//
+//  Binary cache for loaded OBJ models.
+//  The first load parses the OBJ (obj_loader.h) and writes a blob keyed by the OBJ's path; later
+//  loads map the blob and hand its vertex and index sections to glBufferData as they are, without
+//  parsing or copying. The blob records the size and modification time of the OBJ and its MTL files:
+//  when they match nothing is read but the blob, when only a time moved the contents are hashed and
+//  compared with the recorded hashes, and an edit makes the blob stale, it is then rebuilt.
+//
+//  blob layout, every section aligned to 64 bytes:
+//    header     magic, version, source size, time and hash, counts, bounds, section offsets
+//    vertices   interleaved floats (position 3, normal 3, texcoord 2)
+//    indices    uint16 below 64k vertices, uint32 otherwise, the type Mesh uploads
+//    sections   MeshSection[]
+//    materials  MeshCacheMaterial[], strings referenced by offset and length
+//    libraries  string references of the MTL files, relative to the OBJ
+//    strings    names and texture paths, texture paths relative to the OBJ
+//
+//  MESH_CACHE_DIR overrides the cache location, set it to an empty string to disable the cache.
+//
+//  ObjModel model;
+//  loadObjCached(objectPath + "/nanosuit/nanosuit.obj", model);
+//  GLuint vao = model.createVertexArray(); // the upload reads the mapped blob
+//
+
+#ifndef my_mesh_cache_h
+#define my_mesh_cache_h
+
+#include <my/obj_loader.h>
+#include <my/hash.h>
+#include <my/mesh.h>
+#include <my/cpu_profiler.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the first cold load writes the cache, later loads map it
+bool loadObjCached(const std::string &path, ObjModel &model, unsigned int threads = 0);
+
+
+const uint32_t MESH_CACHE_MAGIC = 0x434D5347; // "GSMC"
+// bump when the blob layout or the loader's output changes
+const uint32_t MESH_CACHE_VERSION = 2;
+const uint64_t MESH_CACHE_ALIGNMENT = 64;
+
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t librariesHash;
+    uint64_t librariesStamp;
+
+    uint32_t floatsPerVertex;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexSize;
+    uint32_t sectionCount;
+    uint32_t materialCount;
+    uint32_t libraryCount;
+    uint32_t flags;
+    float boundsMin[3];
+    float boundsMax[3];
+
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t sectionOffset;
+    uint64_t materialOffset;
+    uint64_t libraryOffset;
+    uint64_t stringOffset;
+    uint64_t stringSize;
+    uint64_t fileSize;
+};
+
+enum MeshCacheFlags : uint32_t
+{
+    MESH_CACHE_NORMALS = 1,
+    MESH_CACHE_TEXCOORDS = 2,
+};
+
+// offset and length in the string table
+struct MeshCacheString
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct MeshCacheMaterial
+{
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float shininess;
+    float opacity;
+    MeshCacheString name;
+    MeshCacheString diffuseMap;
+    MeshCacheString specularMap;
+    MeshCacheString normalMap;
+    MeshCacheString ambientMap;
+};
+
+
+namespace mesh_cache_detail
+{
+    inline uint64_t alignUp(uint64_t offset) { return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1); }
+
+    // size and modification time, cheap enough to compare on every load
+    struct FileStamp
+    {
+        uint64_t size = 0;
+        int64_t time = 0;
+    };
+
+    inline bool stampOf(const std::string &path, FileStamp &stamp)
+    {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (error)
+        {
+            return false;
+        }
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+        if (error)
+        {
+            return false;
+        }
+        stamp.size = size;
+        stamp.time = (int64_t)time.time_since_epoch().count();
+        return true;
+    }
+
+    // a missing library keeps a zero stamp, so it differs from any stored one
+    inline uint64_t stampLibraries(const std::vector<std::string> &libraries)
+    {
+        uint64_t hash = MESH_CACHE_VERSION;
+        for (const std::string &library : libraries)
+        {
+            FileStamp stamp;
+            stampOf(library, stamp);
+            hash = hashBytes(library.data(), library.size(), hash);
+            hash = hashBytes(&stamp.size, sizeof(stamp.size), hash);
+            hash = hashBytes(&stamp.time, sizeof(stamp.time), hash);
+        }
+        return hash;
+    }
+
+    // MTL edits change materials without touching the OBJ, so their bytes are part of the check
+    inline uint64_t hashLibraries(const std::vector<std::string> &libraries)
+    {
+        uint64_t hash = MESH_CACHE_VERSION;
+        for (const std::string &library : libraries)
+        {
+            MappedFile file(library);
+            hash = hashBytes(library.data(), library.size(), hash);
+            hash = file.valid() ? hashBytes(file.data(), file.size(), hash) : hash ^ 0xff;
+        }
+        return hash;
+    }
+
+    inline std::string relativeTo(const std::string &directory, const std::string &path)
+    {
+        std::string prefix = directory + "/";
+        return path.compare(0, prefix.size(), prefix) == 0 ? path.substr(prefix.size()) : path;
+    }
+
+    // the contents matched after a time moved (a checkout, a copy): store the new times, so the next load skips the hash
+    inline void restampCache(const std::filesystem::path &cachePath, const MeshCacheHeader &header)
+    {
+        std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(offsetof(MeshCacheHeader, sourceTime));
+        file.write(reinterpret_cast<const char *>(&header.sourceTime), sizeof(header.sourceTime));
+        file.seekp(offsetof(MeshCacheHeader, librariesStamp));
+        file.write(reinterpret_cast<const char *>(&header.librariesStamp), sizeof(header.librariesStamp));
+    }
+
+    bool readCache(const std::filesystem::path &cachePath, const std::string &path, const FileStamp &source, ObjModel &model)
+    {
+        CPU_ZONE("MeshCache read");
+        std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cachePath.string());
+        if (!file->valid() || file->size() < sizeof(MeshCacheHeader))
+        {
+            return false;
+        }
+        const char *base = file->data();
+        MeshCacheHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+            || header.sourceSize != source.size || header.fileSize != file->size()
+            || header.floatsPerVertex != ObjModel::FLOATS_PER_VERTEX)
+        {
+            // written for another layout (or version), the upload would hand the wrong stride to the vertex array
+            return false;
+        }
+        bool restamp = false;
+        if (header.sourceTime != source.time)
+        {
+            CPU_ZONE("MeshCache hash");
+            MappedFile sourceFile(path);
+            if (!sourceFile.valid() || hashBytes(sourceFile.data(), sourceFile.size()) != header.sourceHash)
+            {
+                return false;
+            }
+            header.sourceTime = source.time;
+            restamp = true;
+        }
+
+        uint64_t indexSize = header.vertexCount <= 0xFFFF ? sizeof(uint16_t) : sizeof(uint32_t);
+        auto fits = [&](uint64_t offset, uint64_t bytes) { return offset % MESH_CACHE_ALIGNMENT == 0 && offset <= header.fileSize && bytes <= header.fileSize - offset; };
+        if (header.indexSize != indexSize
+            || !fits(header.vertexOffset, (uint64_t)header.vertexCount * header.floatsPerVertex * sizeof(float))
+            || !fits(header.indexOffset, (uint64_t)header.indexCount * indexSize)
+            || !fits(header.sectionOffset, (uint64_t)header.sectionCount * sizeof(MeshSection))
+            || !fits(header.materialOffset, (uint64_t)header.materialCount * sizeof(MeshCacheMaterial))
+            || !fits(header.libraryOffset, (uint64_t)header.libraryCount * sizeof(MeshCacheString))
+            || !fits(header.stringOffset, header.stringSize))
+        {
+            std::cout << "ERROR::MESH_CACHE::CORRUPT: " << cachePath.string() << std::endl;
+            return false;
+        }
+
+        const char *strings = base + header.stringOffset;
+        auto string = [&](const MeshCacheString &reference)
+        {
+            return (uint64_t)reference.offset + reference.length <= header.stringSize ? std::string(strings + reference.offset, reference.length) : std::string();
+        };
+        std::string directory = obj_detail::directoryOf(path);
+        auto fullPath = [&](const MeshCacheString &reference)
+        {
+            std::string relative = string(reference);
+            return relative.empty() || relative[0] == '/' ? relative : directory + "/" + relative;
+        };
+
+        ObjModel result;
+        for (uint32_t i = 0; i < header.libraryCount; i++)
+        {
+            MeshCacheString reference;
+            std::memcpy(&reference, base + header.libraryOffset + i * sizeof(MeshCacheString), sizeof(reference));
+            result.libraries.push_back(fullPath(reference));
+        }
+        uint64_t librariesStamp = stampLibraries(result.libraries);
+        if (librariesStamp != header.librariesStamp)
+        {
+            if (hashLibraries(result.libraries) != header.librariesHash)
+            {
+                return false;
+            }
+            header.librariesStamp = librariesStamp;
+            restamp = true;
+        }
+
+        for (uint32_t i = 0; i < header.materialCount; i++)
+        {
+            MeshCacheMaterial stored;
+            std::memcpy(&stored, base + header.materialOffset + i * sizeof(MeshCacheMaterial), sizeof(stored));
+            ObjMaterial material;
+            material.name = string(stored.name);
+            material.ambient = glm::vec3(stored.ambient[0], stored.ambient[1], stored.ambient[2]);
+            material.diffuse = glm::vec3(stored.diffuse[0], stored.diffuse[1], stored.diffuse[2]);
+            material.specular = glm::vec3(stored.specular[0], stored.specular[1], stored.specular[2]);
+            material.shininess = stored.shininess;
+            material.opacity = stored.opacity;
+            material.diffuseMap = fullPath(stored.diffuseMap);
+            material.specularMap = fullPath(stored.specularMap);
+            material.normalMap = fullPath(stored.normalMap);
+            material.ambientMap = fullPath(stored.ambientMap);
+            result.materials.push_back(material);
+        }
+
+        std::vector<MeshSection> sections(header.sectionCount);
+        std::memcpy(sections.data(), base + header.sectionOffset, sections.size() * sizeof(MeshSection));
+        for (const MeshSection &section : sections)
+        {
+            if ((uint64_t)section.firstIndex + section.indexCount > header.indexCount || section.material >= header.materialCount)
+            {
+                std::cout << "ERROR::MESH_CACHE::CORRUPT: " << cachePath.string() << std::endl;
+                return false;
+            }
+        }
+
+        result.hasNormals = (header.flags & MESH_CACHE_NORMALS) != 0;
+        result.hasTexcoords = (header.flags & MESH_CACHE_TEXCOORDS) != 0;
+        result.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+        result.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+        if (restamp)
+        {
+            restampCache(cachePath, header);
+        }
+
+        // the vertex and index sections stay in the mapping, which lives until the mesh is uploaded
+        std::string name = path.substr(path.find_last_of("/\\") == std::string::npos ? 0 : path.find_last_of("/\\") + 1);
+        result.mesh = Mesh::fromBuffers(name, header.floatsPerVertex,
+                                        reinterpret_cast<const float *>(base + header.vertexOffset), header.vertexCount,
+                                        base + header.indexOffset, header.indexCount, std::move(sections), file);
+        model = std::move(result);
+        return true;
+    }
+
+    void writeCache(const std::filesystem::path &cachePath, const std::string &path, uint64_t sourceHash, const FileStamp &source, const ObjModel &model)
+    {
+        CPU_ZONE("MeshCache write");
+        const Mesh &mesh = model.mesh;
+        std::string directory = obj_detail::directoryOf(path);
+
+        std::string strings;
+        auto addString = [&](const std::string &value)
+        {
+            MeshCacheString reference = { (uint32_t)strings.size(), (uint32_t)value.size() };
+            strings += value;
+            return reference;
+        };
+
+        std::vector<MeshCacheMaterial> materials;
+        for (const ObjMaterial &material : model.materials)
+        {
+            MeshCacheMaterial stored;
+            std::memcpy(stored.ambient, &material.ambient[0], sizeof(stored.ambient));
+            std::memcpy(stored.diffuse, &material.diffuse[0], sizeof(stored.diffuse));
+            std::memcpy(stored.specular, &material.specular[0], sizeof(stored.specular));
+            stored.shininess = material.shininess;
+            stored.opacity = material.opacity;
+            stored.name = addString(material.name);
+            stored.diffuseMap = addString(relativeTo(directory, material.diffuseMap));
+            stored.specularMap = addString(relativeTo(directory, material.specularMap));
+            stored.normalMap = addString(relativeTo(directory, material.normalMap));
+            stored.ambientMap = addString(relativeTo(directory, material.ambientMap));
+            materials.push_back(stored);
+        }
+        std::vector<MeshCacheString> libraries;
+        for (const std::string &library : model.libraries)
+        {
+            libraries.push_back(addString(relativeTo(directory, library)));
+        }
+
+        // the same index type Mesh::upload would pick, so the warm path uploads the bytes as they are
+        std::vector<uint16_t> shortIndices;
+        const void *indexData = mesh.indices.data();
+        uint32_t indexSize = sizeof(uint32_t);
+        if (mesh.indexType() == GL_UNSIGNED_SHORT)
+        {
+            shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+            indexData = shortIndices.data();
+            indexSize = sizeof(uint16_t);
+        }
+
+        MeshCacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.sourceSize = source.size;
+        header.sourceTime = source.time;
+        header.librariesHash = hashLibraries(model.libraries);
+        header.librariesStamp = stampLibraries(model.libraries);
+        header.floatsPerVertex = mesh.floatsPerVertex;
+        header.vertexCount = (uint32_t)mesh.vertexCount();
+        header.indexCount = (uint32_t)mesh.indices.size();
+        header.indexSize = indexSize;
+        header.sectionCount = (uint32_t)mesh.sections.size();
+        header.materialCount = (uint32_t)materials.size();
+        header.libraryCount = (uint32_t)libraries.size();
+        header.flags = (model.hasNormals ? MESH_CACHE_NORMALS : 0) | (model.hasTexcoords ? MESH_CACHE_TEXCOORDS : 0);
+        std::memcpy(header.boundsMin, &model.boundsMin[0], sizeof(header.boundsMin));
+        std::memcpy(header.boundsMax, &model.boundsMax[0], sizeof(header.boundsMax));
+
+        struct Block { uint64_t *offset; const void *data; uint64_t size; };
+        Block blocks[] = {
+            { &header.vertexOffset, mesh.vertices.data(), mesh.vertices.size() * sizeof(float) },
+            { &header.indexOffset, indexData, (uint64_t)header.indexCount * indexSize },
+            { &header.sectionOffset, mesh.sections.data(), mesh.sections.size() * sizeof(MeshSection) },
+            { &header.materialOffset, materials.data(), materials.size() * sizeof(MeshCacheMaterial) },
+            { &header.libraryOffset, libraries.data(), libraries.size() * sizeof(MeshCacheString) },
+            { &header.stringOffset, strings.data(), strings.size() },
+        };
+        uint64_t offset = sizeof(MeshCacheHeader);
+        for (Block &block : blocks)
+        {
+            offset = alignUp(offset);
+            *block.offset = offset;
+            offset += block.size;
+        }
+        header.stringSize = strings.size();
+        header.fileSize = offset;
+
+        writeFileAtomic(cachePath, "ERROR::MESH_CACHE::WRITE_FAILED", [&](std::ofstream &file)
+        {
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            uint64_t written = sizeof(header);
+            const char padding[MESH_CACHE_ALIGNMENT] = {};
+            for (const Block &block : blocks)
+            {
+                file.write(padding, *block.offset - written);
+                file.write(reinterpret_cast<const char *>(block.data), block.size);
+                written = *block.offset + block.size;
+            }
+        });
+    }
+}
+
+bool loadObjCached(const std::string &path, ObjModel &model, unsigned int threads)
+{
+    using namespace mesh_cache_detail;
+    CPU_ZONE("loadObjCached");
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    std::filesystem::path directory = cacheDirectory("MESH_CACHE_DIR", "graphics-start-mesh-cache");
+    if (directory.empty())
+    {
+        return loadObj(path, model, threads);
+    }
+
+    FileStamp source;
+    if (!stampOf(path, source))
+    {
+        std::cout << "ERROR::OBJ::FILE_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+
+    // one blob per OBJ, a rebuild replaces the stale one
+    std::error_code error;
+    std::string absolute = std::filesystem::absolute(path, error).lexically_normal().string();
+    std::string stem = std::filesystem::path(path).stem().string();
+    std::filesystem::path cachePath = directory / (stem + "-" + hashHex(hashBytes(absolute.data(), absolute.size())) + ".mesh");
+
+    if (readCache(cachePath, path, source, model))
+    {
+        std::cout << "MESH_CACHE::HIT " << cachePath.filename().string() << " triangles=" << model.mesh.triangleCount()
+                  << " vertices=" << model.mesh.vertexCount()
+                  << " load=" << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << "ms" << std::endl;
+        return true;
+    }
+
+    // hashed before the parse: an edit in between leaves a time that no longer matches and a hash that
+    // no longer matches either, so the next load rebuilds
+    uint64_t sourceHash;
+    {
+        CPU_ZONE("MeshCache hash");
+        MappedFile sourceFile(path);
+        if (!sourceFile.valid())
+        {
+            std::cout << "ERROR::OBJ::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        sourceHash = hashBytes(sourceFile.data(), sourceFile.size());
+    }
+    if (!loadObj(path, model, threads))
+    {
+        return false;
+    }
+    writeCache(cachePath, path, sourceHash, source, model);
+    std::cout << "MESH_CACHE::WRITE " << cachePath.filename().string()
+              << " load=" << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << "ms" << std::endl;
+    return true;
+}
+
+#endif /* my_mesh_cache_h */
@@ -0,0 +1,733 @@
+//
+//  obj_loader.h
+//  graphics-start
+//
+//  Wavefront OBJ/MTL loader.
+//  The OBJ file is memory mapped and split into line-aligned chunks that are parsed in parallel, one
+//  thread per chunk, with a hand written float parser. The chunks are then merged: relative (negative)
+//  indices are resolved against the chunk's position in the file, polygons are fanned into triangles,
+//  triangles are grouped by material, and every distinct v/vt/vn corner becomes one vertex. The result
+//  goes through Mesh (weld, cache and fetch order) with one section per material.
+//
+//  vertex layout: position 3, normal 3, texcoord 2 (zero when the file has none)
+//
+//  ObjModel model;
+//  if (loadObj(objectPath + "/nanosuit/nanosuit.obj", model))
+//  {
+//      GLuint vao = model.createVertexArray();
+//      ...
+//      for (size_t i = 0; i < model.mesh.sections.size(); i++)
+//      {
+//          const ObjMaterial &material = model.materials[model.mesh.sections[i].material];
+//          // bind material textures
+//          model.mesh.drawSection(i);
+//      }
+//  }
+//
+
+#ifndef my_obj_loader_h
+#define my_obj_loader_h
+
+#include <my/mesh.h>
+#include <my/cpu_profiler.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ObjMaterial
+{
+    std::string name;
+    glm::vec3 ambient = glm::vec3(0.0f);
+    glm::vec3 diffuse = glm::vec3(0.8f);
+    glm::vec3 specular = glm::vec3(0.0f);
+    float shininess = 32.0f;
+    float opacity = 1.0f;
+
+    // full paths, empty when the material has no such map
+    std::string diffuseMap;
+    std::string specularMap;
+    std::string normalMap;
+    std::string ambientMap;
+};
+
+struct ObjModel
+{
+    // one section per material, section.material indexes materials
+    Mesh mesh;
+    std::vector<ObjMaterial> materials;
+    bool hasNormals = false;
+    bool hasTexcoords = false;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // full paths of the mtllib files that were read
+    std::vector<std::string> libraries;
+
+    static const unsigned int FLOATS_PER_VERTEX = 8;
+
+    // position at location 0, normal at 1, texcoord at 2
+    GLuint createVertexArray() { return mesh.createVertexArray({ { 0, 3 }, { 1, 3 }, { 2, 2 } }); }
+};
+
+// threads 0 uses every core
+bool loadObj(const std::string &path, ObjModel &model, unsigned int threads = 0);
+bool loadMtl(const std::string &path, std::vector<ObjMaterial> &materials);
+
+
+/**
+ Read-only view of a whole file, memory mapped where possible.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool valid() const { return opened; }
+    const char *data() const { return begin; }
+    size_t size() const { return length; }
+
+private:
+    const char *begin = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    bool opened = false;
+    std::vector<char> fallback;
+};
+
+MappedFile::MappedFile(const std::string &path)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void *address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                // the file is read front to back by every thread
+                madvise(address, (size_t)info.st_size, MADV_SEQUENTIAL);
+                begin = (const char *)address;
+                length = (size_t)info.st_size;
+                mapped = true;
+                opened = true;
+            }
+        }
+        close(fd);
+        if (mapped)
+        {
+            return;
+        }
+    }
+#endif
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return;
+    }
+    file.seekg(0, std::ios::end);
+    fallback.resize((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(fallback.data(), fallback.size());
+    begin = fallback.data();
+    length = fallback.size();
+    opened = true;
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (mapped)
+    {
+        munmap((void *)begin, length);
+    }
+#endif
+}
+
+
+namespace obj_detail
+{
+    // indices are stored 0-based; relative ones are counted from the chunk's start and flagged until the merge
+    const int64_t RELATIVE = 1ll << 40;
+    const int64_t MISSING = -1;
+
+    struct Corner
+    {
+        int64_t position;
+        int64_t texcoord;
+        int64_t normal;
+    };
+
+    struct MaterialChange
+    {
+        size_t triangle;   // first triangle of the chunk using it
+        std::string name;
+    };
+
+    struct Chunk
+    {
+        std::vector<float> positions;  // 3 per vertex
+        std::vector<float> texcoords;  // 2 per vertex
+        std::vector<float> normals;    // 3 per vertex
+        std::vector<Corner> corners;   // 3 per triangle
+        std::vector<MaterialChange> materials;
+        std::vector<std::string> libraries;
+    };
+
+    inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    inline const char *skipSpace(const char *p, const char *end)
+    {
+        while (p < end && isSpace(*p)) p++;
+        return p;
+    }
+
+    /**
+     Decimal float with optional sign, fraction and exponent. Accurate to float precision, which is
+     all the vertex data keeps.
+     */
+    inline const char *parseFloat(const char *p, const char *end, float &out)
+    {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+        };
+        p = skipSpace(p, end);
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int digits = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; }
+            else exponent++;
+            p++;
+        }
+        if (p < end && *p == '.')
+        {
+            p++;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                if (digits < 19) { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; exponent--; }
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char *exponentStart = p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negativeExponent = *p == '-';
+                p++;
+            }
+            if (p < end && *p >= '0' && *p <= '9')
+            {
+                int value = 0;
+                while (p < end && *p >= '0' && *p <= '9')
+                {
+                    value = std::min(value * 10 + (*p - '0'), 1000);
+                    p++;
+                }
+                exponent += negativeExponent ? -value : value;
+            }
+            else
+            {
+                p = exponentStart;
+            }
+        }
+
+        double value = (double)mantissa;
+        if (exponent < 0)
+        {
+            value = -exponent <= 22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+        }
+        else if (exponent > 0)
+        {
+            value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+        }
+        out = (float)(negative ? -value : value);
+        return p;
+    }
+
+    inline const char *parseInt(const char *p, const char *end, int64_t &out, bool &found)
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            p++;
+        }
+        int64_t value = 0;
+        found = false;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            value = value * 10 + (*p - '0');
+            found = true;
+            p++;
+        }
+        out = negative ? -value : value;
+        return p;
+    }
+
+    // OBJ index (1-based, or negative from the current end) to the chunk-relative form
+    inline int64_t storeIndex(int64_t index, size_t countSoFar)
+    {
+        if (index > 0) return index - 1;
+        if (index < 0) return RELATIVE + (int64_t)countSoFar + index;
+        return MISSING;
+    }
+
+    inline bool startsWith(const char *p, const char *end, const char *word)
+    {
+        size_t length = std::strlen(word);
+        return (size_t)(end - p) > length && std::memcmp(p, word, length) == 0 && isSpace(p[length]);
+    }
+
+    inline std::string restOfLine(const char *p, const char *end)
+    {
+        p = skipSpace(p, end);
+        const char *last = end;
+        while (last > p && isSpace(last[-1])) last--;
+        return std::string(p, last);
+    }
+
+    void parseChunk(const char *begin, const char *end, Chunk &chunk)
+    {
+        CPU_ZONE("OBJ parse chunk");
+        std::vector<Corner> polygon;
+        const char *line = begin;
+        while (line < end)
+        {
+            const char *lineEnd = (const char *)std::memchr(line, '\n', end - line);
+            if (lineEnd == nullptr) lineEnd = end;
+            const char *p = skipSpace(line, lineEnd);
+
+            if (p + 1 < lineEnd && p[0] == 'v' && isSpace(p[1]))
+            {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                p = parseFloat(p + 1, lineEnd, x);
+                p = parseFloat(p, lineEnd, y);
+                parseFloat(p, lineEnd, z);
+                chunk.positions.insert(chunk.positions.end(), { x, y, z });
+            }
+            else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+            {
+                float u = 0.0f, v = 0.0f;
+                p = parseFloat(p + 2, lineEnd, u);
+                parseFloat(p, lineEnd, v);
+                chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+            }
+            else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+            {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                p = parseFloat(p + 2, lineEnd, x);
+                p = parseFloat(p, lineEnd, y);
+                parseFloat(p, lineEnd, z);
+                chunk.normals.insert(chunk.normals.end(), { x, y, z });
+            }
+            else if (p + 1 < lineEnd && p[0] == 'f' && isSpace(p[1]))
+            {
+                // v, v/vt, v//vn or v/vt/vn per corner
+                polygon.clear();
+                p++;
+                while (true)
+                {
+                    p = skipSpace(p, lineEnd);
+                    if (p >= lineEnd) break;
+                    int64_t value;
+                    bool found;
+                    Corner corner = { MISSING, MISSING, MISSING };
+                    p = parseInt(p, lineEnd, value, found);
+                    if (!found) break;
+                    corner.position = storeIndex(value, chunk.positions.size() / 3);
+                    if (p < lineEnd && *p == '/')
+                    {
+                        p = parseInt(p + 1, lineEnd, value, found);
+                        if (found) corner.texcoord = storeIndex(value, chunk.texcoords.size() / 2);
+                        if (p < lineEnd && *p == '/')
+                        {
+                            p = parseInt(p + 1, lineEnd, value, found);
+                            if (found) corner.normal = storeIndex(value, chunk.normals.size() / 3);
+                        }
+                    }
+                    polygon.push_back(corner);
+                }
+                // fan triangulation, fine for the convex polygons exporters write
+                for (size_t i = 2; i < polygon.size(); i++)
+                {
+                    chunk.corners.push_back(polygon[0]);
+                    chunk.corners.push_back(polygon[i - 1]);
+                    chunk.corners.push_back(polygon[i]);
+                }
+            }
+            else if (startsWith(p, lineEnd, "usemtl"))
+            {
+                chunk.materials.push_back({ chunk.corners.size() / 3, restOfLine(p + 6, lineEnd) });
+            }
+            else if (startsWith(p, lineEnd, "mtllib"))
+            {
+                chunk.libraries.push_back(restOfLine(p + 6, lineEnd));
+            }
+            // comments, o, g, s, l and p are not needed
+
+            line = lineEnd + 1;
+        }
+    }
+
+    inline int64_t resolve(int64_t index, size_t base, size_t count)
+    {
+        if (index == MISSING) return MISSING;
+        int64_t global = index >= RELATIVE / 2 ? (int64_t)base + (index - RELATIVE) : index;
+        return global >= 0 && global < (int64_t)count ? global : MISSING;
+    }
+
+    inline std::string directoryOf(const std::string &path)
+    {
+        size_t slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+    }
+}
+
+bool loadMtl(const std::string &path, std::vector<ObjMaterial> &materials)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::OBJ::MTL_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+    std::string directory = obj_detail::directoryOf(path);
+    auto mapPath = [&](std::istringstream &in)
+    {
+        // options like -bm 1.0 come before the file name, which is the last token
+        std::string token, last;
+        while (in >> token) last = token;
+        return last.empty() ? last : directory + "/" + last;
+    };
+
+    ObjMaterial *material = nullptr;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        std::string key;
+        if (!(in >> key) || key[0] == '#')
+        {
+            continue;
+        }
+        if (key == "newmtl")
+        {
+            materials.emplace_back();
+            material = &materials.back();
+            std::getline(in >> std::ws, material->name);
+            while (!material->name.empty() && obj_detail::isSpace(material->name.back())) material->name.pop_back();
+            continue;
+        }
+        if (material == nullptr)
+        {
+            continue;
+        }
+
+        if (key == "Ka") in >> material->ambient.x >> material->ambient.y >> material->ambient.z;
+        else if (key == "Kd") in >> material->diffuse.x >> material->diffuse.y >> material->diffuse.z;
+        else if (key == "Ks") in >> material->specular.x >> material->specular.y >> material->specular.z;
+        else if (key == "Ns") in >> material->shininess;
+        else if (key == "d") in >> material->opacity;
+        else if (key == "Tr") { float transparency; if (in >> transparency) material->opacity = 1.0f - transparency; }
+        else if (key == "map_Kd") material->diffuseMap = mapPath(in);
+        else if (key == "map_Ks") material->specularMap = mapPath(in);
+        else if (key == "map_Ka") material->ambientMap = mapPath(in);
+        else if (key == "map_Bump" || key == "map_bump" || key == "bump" || key == "norm") material->normalMap = mapPath(in);
+    }
+    return true;
+}
+
+bool loadObj(const std::string &path, ObjModel &model, unsigned int threads)
+{
+    using namespace obj_detail;
+    CPU_ZONE("loadObj");
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    MappedFile file(path);
+    if (!file.valid())
+    {
+        std::cout << "ERROR::OBJ::FILE_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+
+    // chunks of at least 1 MB, so small files stay on one thread
+    const size_t MIN_CHUNK = 1 << 20;
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, file.size() / MIN_CHUNK));
+
+    // chunk boundaries are moved forward to the next line start
+    const char *data = file.data();
+    const char *dataEnd = data + file.size();
+    std::vector<const char *> bounds(chunkCount + 1);
+    bounds[0] = data;
+    bounds[chunkCount] = dataEnd;
+    for (size_t i = 1; i < chunkCount; i++)
+    {
+        const char *p = data + file.size() * i / chunkCount;
+        p = std::max(p, bounds[i - 1]);
+        const char *newline = (const char *)std::memchr(p, '\n', dataEnd - p);
+        bounds[i] = newline ? newline + 1 : dataEnd;
+    }
+
+    std::vector<Chunk> chunks(chunkCount);
+    {
+        CPU_ZONE("OBJ parse");
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunkCount; i++)
+        {
+            workers.emplace_back([&, i]()
+            {
+                cpuProfiler.setThreadName("obj parse");
+                parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+            });
+        }
+        parseChunk(bounds[0], bounds[1], chunks[0]);
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+    Clock::time_point parsed = Clock::now();
+
+    CPU_ZONE("OBJ merge");
+    ObjModel result;
+
+    // materials of every mtllib, then one more for usemtl names they do not define
+    std::string directory = directoryOf(path);
+    for (const Chunk &chunk : chunks)
+    {
+        for (const std::string &library : chunk.libraries)
+        {
+            if (loadMtl(directory + "/" + library, result.materials))
+            {
+                result.libraries.push_back(directory + "/" + library);
+            }
+        }
+    }
+    std::unordered_map<std::string, uint32_t> materialIds;
+    for (size_t i = 0; i < result.materials.size(); i++)
+    {
+        materialIds.emplace(result.materials[i].name, (uint32_t)i);
+    }
+    auto materialId = [&](const std::string &name)
+    {
+        auto found = materialIds.find(name);
+        if (found != materialIds.end())
+        {
+            return found->second;
+        }
+        ObjMaterial material;
+        material.name = name;
+        result.materials.push_back(material);
+        uint32_t id = (uint32_t)result.materials.size() - 1;
+        materialIds.emplace(name, id);
+        return id;
+    };
+
+    // attribute offsets of every chunk, and the material of every triangle
+    size_t positionCount = 0, texcoordCount = 0, normalCount = 0, triangleCount = 0;
+    std::vector<size_t> positionBase(chunkCount), texcoordBase(chunkCount), normalBase(chunkCount), triangleBase(chunkCount);
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        positionBase[i] = positionCount;
+        texcoordBase[i] = texcoordCount;
+        normalBase[i] = normalCount;
+        triangleBase[i] = triangleCount;
+        positionCount += chunks[i].positions.size() / 3;
+        texcoordCount += chunks[i].texcoords.size() / 2;
+        normalCount += chunks[i].normals.size() / 3;
+        triangleCount += chunks[i].corners.size() / 3;
+    }
+    if (triangleCount == 0)
+    {
+        std::cout << "ERROR::OBJ::NO_TRIANGLES: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> triangleMaterial(triangleCount);
+    {
+        uint32_t current = UINT32_MAX;
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            size_t next = 0;
+            size_t triangles = chunks[i].corners.size() / 3;
+            for (size_t t = 0; t < triangles; t++)
+            {
+                while (next < chunks[i].materials.size() && chunks[i].materials[next].triangle == t)
+                {
+                    current = materialId(chunks[i].materials[next++].name);
+                }
+                if (current == UINT32_MAX)
+                {
+                    // faces before any usemtl
+                    current = materialId("");
+                }
+                triangleMaterial[triangleBase[i] + t] = current;
+            }
+            while (next < chunks[i].materials.size())
+            {
+                current = materialId(chunks[i].materials[next++].name);
+            }
+        }
+    }
+
+    // triangles grouped by material, in file order within a material
+    size_t materialCount = result.materials.size();
+    std::vector<uint32_t> materialStart(materialCount + 1, 0);
+    for (uint32_t material : triangleMaterial)
+    {
+        materialStart[material + 1]++;
+    }
+    for (size_t m = 0; m < materialCount; m++)
+    {
+        materialStart[m + 1] += materialStart[m];
+    }
+    std::vector<uint32_t> slot(materialStart.begin(), materialStart.end() - 1);
+
+    // one vertex per distinct (v, vt, vn), open addressing on the resolved indices
+    struct Key { int64_t position, texcoord, normal; };
+    size_t tableSize = 1;
+    while (tableSize < triangleCount * 3) tableSize <<= 1;
+    std::vector<uint32_t> table(tableSize, UINT32_MAX);
+    std::vector<Key> keys;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices(triangleCount * 3);
+    keys.reserve(positionCount);
+    vertices.reserve(positionCount * ObjModel::FLOATS_PER_VERTEX);
+
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        const Chunk &chunk = chunks[i];
+        size_t triangles = chunk.corners.size() / 3;
+        for (size_t t = 0; t < triangles; t++)
+        {
+            uint32_t destination = slot[triangleMaterial[triangleBase[i] + t]]++;
+            for (int c = 0; c < 3; c++)
+            {
+                const Corner &corner = chunk.corners[t * 3 + c];
+                Key key = {
+                    resolve(corner.position, positionBase[i], positionCount),
+                    resolve(corner.texcoord, texcoordBase[i], texcoordCount),
+                    resolve(corner.normal, normalBase[i], normalCount),
+                };
+
+                uint64_t hash = (uint64_t)key.position * 0x9E3779B97F4A7C15ull;
+                hash ^= (uint64_t)key.texcoord * 0xC2B2AE3D27D4EB4Full + (hash >> 29);
+                hash ^= (uint64_t)key.normal * 0x165667B19E3779F9ull + (hash >> 32);
+                size_t h = (size_t)(hash ^ (hash >> 31)) & (tableSize - 1);
+                uint32_t vertex;
+                while (true)
+                {
+                    uint32_t existing = table[h];
+                    if (existing == UINT32_MAX)
+                    {
+                        vertex = (uint32_t)keys.size();
+                        table[h] = vertex;
+                        keys.push_back(key);
+                        break;
+                    }
+                    const Key &other = keys[existing];
+                    if (other.position == key.position && other.texcoord == key.texcoord && other.normal == key.normal)
+                    {
+                        vertex = existing;
+                        break;
+                    }
+                    h = (h + 1) & (tableSize - 1);
+                }
+                indices[destination * 3 + c] = vertex;
+            }
+        }
+    }
+
+    // attribute lookup through the chunk that holds the global index
+    auto fetch = [&](const std::vector<size_t> &base, std::vector<float> Chunk::*member, int64_t index, unsigned int components, float *out)
+    {
+        if (index == MISSING)
+        {
+            std::fill(out, out + components, 0.0f);
+            return;
+        }
+        size_t chunk = std::upper_bound(base.begin(), base.end(), (size_t)index) - base.begin() - 1;
+        const float *source = &(chunks[chunk].*member)[((size_t)index - base[chunk]) * components];
+        std::copy(source, source + components, out);
+    };
+    vertices.resize(keys.size() * ObjModel::FLOATS_PER_VERTEX);
+    result.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    result.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (size_t v = 0; v < keys.size(); v++)
+    {
+        float *out = &vertices[v * ObjModel::FLOATS_PER_VERTEX];
+        fetch(positionBase, &Chunk::positions, keys[v].position, 3, out);
+        fetch(normalBase, &Chunk::normals, keys[v].normal, 3, out + 3);
+        fetch(texcoordBase, &Chunk::texcoords, keys[v].texcoord, 2, out + 6);
+        result.boundsMin = glm::min(result.boundsMin, glm::vec3(out[0], out[1], out[2]));
+        result.boundsMax = glm::max(result.boundsMax, glm::vec3(out[0], out[1], out[2]));
+    }
+
+    std::vector<MeshSection> sections;
+    for (size_t m = 0; m < materialCount; m++)
+    {
+        if (materialStart[m + 1] > materialStart[m])
+        {
+            MeshSection section;
+            section.firstIndex = materialStart[m] * 3;
+            section.indexCount = (materialStart[m + 1] - materialStart[m]) * 3;
+            section.material = (uint32_t)m;
+            sections.push_back(section);
+        }
+    }
+
+    std::string name = path.substr(path.find_last_of("/\\") == std::string::npos ? 0 : path.find_last_of("/\\") + 1);
+    size_t uniqueVertices = keys.size();
+    result.hasNormals = normalCount > 0;
+    result.hasTexcoords = texcoordCount > 0;
+    result.mesh = Mesh::fromIndexed(std::move(vertices), std::move(indices), ObjModel::FLOATS_PER_VERTEX, name, std::move(sections));
+    model = std::move(result);
+
+    Clock::time_point finished = Clock::now();
+    std::cout << "OBJ::LOAD " << name << " triangles=" << triangleCount << " vertices=" << uniqueVertices
+              << " materials=" << model.materials.size() << " threads=" << chunkCount
+              << " parse=" << std::chrono::duration<double, std::milli>(parsed - start).count() << "ms"
+              << " merge=" << std::chrono::duration<double, std::milli>(finished - parsed).count() << "ms" << std::endl;
+    return true;
+}
+
+#endif /* my_obj_loader_h */
@@ -10,8 +10,14 @@
 
 #include <iostream>
 
+// GRAPHICS_PROJECT_PATH overrides the checkout location, e.g. for headless runs on other machines
+#ifdef GRAPHICS_PROJECT_PATH
+const std::string projectPath = GRAPHICS_PROJECT_PATH;
+#else
 const std::string projectPath = "/Users/wonjulee/Desktop/workspace/study/graphics-start";
-const std::string srcPath = "/Users/wonjulee/Desktop/workspace/study/graphics-start/graphics-start";
+#endif
+const std::string srcPath = projectPath + "/graphics-start";
+const std::string shaderPath = srcPath + "/custom/shaders";
 
 
 #endif /* root_path_h */
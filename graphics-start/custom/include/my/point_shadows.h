@@ -0,0 +1,357 @@
+//
+//  point_shadows.h
+//  graphics-start
+//
+//  Omnidirectional shadows of one point light, all six cube faces in a single pass.
+//  The depth program has a geometry stage that emits every triangle once per cube face it is meant
+//  for, with gl_Layer selecting the face of the layered cube map framebuffer (custom/shaders/
+//  point_shadow_depth.gs). Which faces a caster goes to is decided on the CPU: its bounding sphere is
+//  culled against the six face frustums and the resulting bit mask is set per draw, so an object next
+//  to the light costs one face, not six.
+//
+//  Static and dynamic casters are kept apart. With caching on, the static casters are rendered into a
+//  cube map of their own only when the light or the static set changes; a frame in which dynamic casters
+//  moved copies that map into the one the lighting samples and adds the dynamic casters on top, and a
+//  frame in which nothing moved renders nothing. Without caching everything is rendered every frame.
+//
+//  The map stores plain hardware depth of the face projections; the lookup (custom/shaders/
+//  point_shadow.glsl) rebuilds the reference depth from the major axis of the light-to-fragment vector,
+//  so the depth pass keeps early depth testing and writes no gl_FragDepth.
+//
+//  PointShadows shadows(1024, 25.0f, true);
+//  shadows.setSamplers(shader);
+//  while (...)
+//  {
+//      shadows.update(lightPos, staticBounds, staticVersion, dynamicBounds, dynamicMoved);
+//      if (shadows.beginStatic())
+//          for (const PointShadowCaster &caster : shadows.staticCasters()) { shadows.setCaster(models[caster.index], caster.faces); draw(); }
+//      if (shadows.beginDynamic())
+//          for (const PointShadowCaster &caster : shadows.dynamicCasters()) { ... }
+//      shadows.end();
+//      shadows.bind();
+//      ...
+//  }
+//  shadows.release();
+//
+
+#ifndef my_point_shadows_h
+#define my_point_shadows_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <my/cpu_profiler.h>
+#include <my/depth_pass.h>
+#include <my/frustum.h>
+#include <my/path.h>
+#include <my/shader_s.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct PointShadowCaster
+{
+    // index into the bounds given to update()
+    uint32_t index;
+    // bit f set: the caster touches cube face f (GL_TEXTURE_CUBE_MAP_POSITIVE_X + f)
+    uint32_t faces;
+};
+
+class PointShadows
+{
+public:
+    static const int FACE_COUNT = 6;
+    // texture unit of the cube map, below the cascaded shadow map
+    static const GLuint SHADOW_UNIT = 11;
+    static constexpr float NEAR_PLANE = 0.05f;
+
+    PointShadows(int resolution = 1024, float farPlane = 25.0f, bool cacheStatic = true);
+    PointShadows(const PointShadows&) = delete;
+    PointShadows& operator=(const PointShadows&) = delete;
+
+    // decides what has to be rendered this frame and culls those casters per face;
+    // staticVersion changes whenever the static casters changed, dynamicMoved when a dynamic one did
+    void update(const glm::vec3 &lightPos, const BoundingSpheres &staticBounds, unsigned int staticVersion,
+                const BoundingSpheres &dynamicBounds, bool dynamicMoved);
+    // true when the static casters have to be drawn now, with setCaster before each draw
+    bool beginStatic();
+    // true when the dynamic casters have to be drawn now, the static ones are already in place
+    bool beginDynamic();
+    // back to the framebuffer and viewport that were current before beginStatic / beginDynamic
+    void end();
+    // model matrix and face mask of the next draw
+    void setCaster(const glm::mat4 &model, uint32_t faces);
+    // binds the cube map the lighting samples to SHADOW_UNIT
+    void bind();
+    // points the shadow sampler of a program at its unit and sets the projection it needs, again after a relink
+    void setSamplers(Shader &shader) const;
+
+    const std::vector<PointShadowCaster>& staticCasters() const { return staticList; }
+    const std::vector<PointShadowCaster>& dynamicCasters() const { return dynamicList; }
+    Shader& depthShader() { return shader; }
+
+    void printStats() const;
+    void release();
+
+private:
+    enum Map { STATIC_MAP, LIT_MAP, MAP_COUNT };
+
+    int resolution;
+    float farPlane;
+    bool cacheStatic;
+
+    Shader shader;
+    GLuint textures[MAP_COUNT] = {};
+    GLuint framebuffers[MAP_COUNT] = {};
+    // read and draw framebuffers for copying the static map face by face
+    GLuint copyFramebuffers[2] = {};
+
+    glm::mat4 faceMatrices[FACE_COUNT];
+    Frustum faceFrustums[FACE_COUNT];
+    glm::vec3 cachedLightPos = glm::vec3(0.0f);
+    unsigned int cachedStaticVersion = 0;
+    bool staticValid = false;
+    bool renderStatic = false;
+    bool renderDynamic = false;
+
+    std::vector<PointShadowCaster> staticList;
+    std::vector<PointShadowCaster> dynamicList;
+    std::vector<uint32_t> faceMasks[FACE_COUNT];
+
+    DepthPass pass;
+
+    // totals for printStats
+    uint64_t frames = 0;
+    uint64_t staticRenders = 0;
+    uint64_t dynamicRenders = 0;
+    uint64_t casterDraws = 0;
+    uint64_t faceEmits = 0;
+
+    void createMap(Map map);
+    void cull(const BoundingSpheres &bounds, std::vector<PointShadowCaster> &casters);
+    // starts the depth pass once before the first map of a frame
+    void activate();
+};
+
+
+PointShadows::PointShadows(int resolution, float farPlane, bool cacheStatic) :
+    resolution(resolution), farPlane(farPlane), cacheStatic(cacheStatic),
+    shader(shaderPath + "/point_shadow_depth.vs", shaderPath + "/point_shadow_depth.fs", "", shaderPath + "/point_shadow_depth.gs")
+{
+    GLint previous = DepthPass::currentFramebuffer();
+    createMap(LIT_MAP);
+    if (cacheStatic)
+    {
+        createMap(STATIC_MAP);
+        glGenFramebuffers(2, copyFramebuffers);
+        for (GLuint copy : copyFramebuffers)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, copy);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+}
+
+void PointShadows::createMap(Map map)
+{
+    glGenTextures(1, &textures[map]);
+    glState.bindTexture(SHADOW_UNIT, GL_TEXTURE_CUBE_MAP, textures[map]);
+    for (int face = 0; face < FACE_COUNT; face++)
+    {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    }
+    // hardware compare with bilinear filtering
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    // layered: the whole cube is attached, the geometry stage picks the face
+    glGenFramebuffers(1, &framebuffers[map]);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[map]);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[map], 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::POINT_SHADOWS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+}
+
+void PointShadows::update(const glm::vec3 &lightPos, const BoundingSpheres &staticBounds, unsigned int staticVersion,
+                          const BoundingSpheres &dynamicBounds, bool dynamicMoved)
+{
+    CPU_ZONE("Point shadows update");
+    bool lightMoved = !staticValid || lightPos != cachedLightPos;
+    renderStatic = !cacheStatic || lightMoved || staticVersion != cachedStaticVersion;
+    renderDynamic = !cacheStatic || renderStatic || dynamicMoved;
+    frames++;
+    if (!renderStatic && !renderDynamic)
+    {
+        return;
+    }
+
+    if (lightMoved)
+    {
+        // the face orientations cube map lookups expect
+        const glm::vec3 directions[FACE_COUNT] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        const glm::vec3 ups[FACE_COUNT] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, farPlane);
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            faceMatrices[face] = projection * glm::lookAt(lightPos, lightPos + directions[face], ups[face]);
+            faceFrustums[face] = Frustum::fromMatrix(faceMatrices[face]);
+        }
+        cachedLightPos = lightPos;
+        shader.use();
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            shader.setMat4("faceMatrices[" + std::to_string(face) + "]", faceMatrices[face]);
+        }
+    }
+
+    if (renderStatic)
+    {
+        cull(staticBounds, staticList);
+        cachedStaticVersion = staticVersion;
+        staticValid = true;
+    }
+    if (renderDynamic)
+    {
+        cull(dynamicBounds, dynamicList);
+    }
+}
+
+void PointShadows::cull(const BoundingSpheres &bounds, std::vector<PointShadowCaster> &casters)
+{
+    CPU_ZONE("Point shadows face culling");
+    size_t words = frustumMaskWords(bounds.size());
+    for (int face = 0; face < FACE_COUNT; face++)
+    {
+        faceMasks[face].resize(words);
+        cullSpheres(faceFrustums[face], bounds, faceMasks[face].data());
+    }
+
+    casters.clear();
+    for (size_t word = 0; word < words; word++)
+    {
+        uint32_t any = 0;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            any |= faceMasks[face][word];
+        }
+        for (; any != 0; any &= any - 1)
+        {
+            uint32_t bit = (uint32_t)maskLowestBit(any);
+            PointShadowCaster caster = { (uint32_t)(word * 32 + bit), 0 };
+            for (int face = 0; face < FACE_COUNT; face++)
+            {
+                caster.faces |= ((faceMasks[face][word] >> bit) & 1u) << face;
+            }
+            casters.push_back(caster);
+        }
+    }
+}
+
+void PointShadows::activate()
+{
+    if (!pass.active())
+    {
+        pass.begin(resolution, shader);
+    }
+}
+
+bool PointShadows::beginStatic()
+{
+    if (!renderStatic)
+    {
+        return false;
+    }
+    activate();
+    // without caching the static casters go straight into the map the lighting samples
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[cacheStatic ? STATIC_MAP : LIT_MAP]);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    staticRenders++;
+    return true;
+}
+
+bool PointShadows::beginDynamic()
+{
+    if (!renderDynamic)
+    {
+        return false;
+    }
+    activate();
+    if (cacheStatic)
+    {
+        CPU_ZONE("Point shadows copy static");
+        // the blit takes one face of each side at a time
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffers[0]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFramebuffers[1]);
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, textures[STATIC_MAP], 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, textures[LIT_MAP], 0);
+            glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[LIT_MAP]);
+    dynamicRenders++;
+    return true;
+}
+
+void PointShadows::setCaster(const glm::mat4 &model, uint32_t faces)
+{
+    shader.setMat4("model", model);
+    shader.setInt("faceMask", (int)faces);
+    casterDraws++;
+    faceEmits += maskBitCount(faces);
+}
+
+void PointShadows::end()
+{
+    if (pass.active())
+    {
+        pass.end();
+    }
+}
+
+void PointShadows::bind()
+{
+    glState.bindTexture(SHADOW_UNIT, GL_TEXTURE_CUBE_MAP, textures[LIT_MAP]);
+}
+
+void PointShadows::setSamplers(Shader &shader) const
+{
+    shader.use();
+    shader.setInt("pointShadowMap", SHADOW_UNIT);
+    shader.setVec3("pointShadowParams", NEAR_PLANE, farPlane, 1.0f / resolution);
+}
+
+void PointShadows::printStats() const
+{
+    std::cout << "POINT_SHADOWS::STATS resolution=" << resolution << " cache=" << (cacheStatic ? "on" : "off")
+              << " frames=" << frames << " static renders=" << staticRenders << " dynamic renders=" << dynamicRenders
+              << " faces per draw=" << std::fixed << std::setprecision(2) << (casterDraws ? (double)faceEmits / casterDraws : 0.0)
+              << " of " << FACE_COUNT << std::defaultfloat << std::endl;
+}
+
+void PointShadows::release()
+{
+    glDeleteFramebuffers(MAP_COUNT, framebuffers);
+    glDeleteFramebuffers(2, copyFramebuffers);
+    glState.deleteTextures(MAP_COUNT, textures);
+    std::fill(framebuffers, framebuffers + MAP_COUNT, 0);
+    std::fill(copyFramebuffers, copyFramebuffers + 2, 0);
+    std::fill(textures, textures + MAP_COUNT, 0);
+}
+
+#endif /* my_point_shadows_h */
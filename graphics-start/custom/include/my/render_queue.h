@@ -0,0 +1,315 @@
+//
+//  render_queue.h
+//  graphics-start
+//
+//  Sorted render queue.
+//  Scene code submits one DrawPacket per object. flush() packs every packet into a 64-bit key,
+//  radix-sorts the keys and draws in key order, so objects sharing a program, material and VAO are
+//  drawn back to back and the state cache elides the repeated binds.
+//  Programs, texture sets and VAOs get small dense ids for their key fields. The ids only have to
+//  agree within one flush, so a full id map is renumbered from 0 at the next flush; binds compare
+//  the packets' GL names, never the ids.
+//
+//  key layout, most significant bit first
+//    opaque:      0 | program 12 | material 14 | vao 14 | depth 23 (front to back)
+//    translucent: 1 | depth 23 (back to front) | program 12 | material 14 | vao 14
+//
+
+#ifndef my_render_queue_h
+#define my_render_queue_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <my/shader_s.h>
+#include <my/cpu_profiler.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+struct DrawPacket
+{
+    static const int MAX_TEXTURES = 4;
+
+    Shader *shader = nullptr;
+    GLuint vao = 0;
+
+    // textures[i] is bound to unit i, 0 leaves the unit alone
+    GLuint textures[MAX_TEXTURES] = { 0, 0, 0, 0 };
+    GLenum textureTarget = GL_TEXTURE_2D;
+
+    bool translucent = false;
+    // distance from the camera, only its order matters
+    float depth = 0.0f;
+    glm::mat4 model = glm::mat4(1.0f);
+
+    // glDrawElements when indexType is set, glDrawArrays otherwise
+    GLenum mode = GL_TRIANGLES;
+    GLint first = 0;
+    GLsizei count = 0;
+    GLenum indexType = 0;
+    GLsizeiptr indexOffset = 0;
+};
+
+struct RenderQueueStats
+{
+    unsigned int draws = 0;
+    unsigned int programChanges = 0;
+    unsigned int materialChanges = 0;
+    unsigned int vaoChanges = 0;
+};
+
+class RenderQueue
+{
+public:
+    // depth is quantized over [0, farPlane]
+    RenderQueue(float farPlane = 100.0f) : farPlane(farPlane) {}
+
+    void submit(const DrawPacket &packet);
+    // sorts and draws everything submitted since the last flush
+    void flush();
+
+    size_t size() const { return packets.size(); }
+    const RenderQueueStats& stats() const { return lastStats; }
+
+    float farPlane;
+
+private:
+    static const int PROGRAM_BITS = 12;
+    static const int MATERIAL_BITS = 14;
+    static const int VAO_BITS = 14;
+    static const int DEPTH_BITS = 23;
+
+    uint64_t makeKey(const DrawPacket &packet);
+    template<typename Key, typename Map> uint32_t internId(Map &ids, const Key &key, int bits);
+    static std::array<GLuint, DrawPacket::MAX_TEXTURES + 1> materialOf(const DrawPacket &packet);
+    uint32_t quantizeDepth(float depth) const;
+    void sortKeys();
+
+    std::vector<DrawPacket> packets;
+    std::vector<uint64_t> keys, keysScratch;
+    std::vector<uint32_t> order, orderScratch;
+
+    // small dense ids, so any GL name or texture set fits its key field
+    std::unordered_map<GLuint, uint32_t> programIds;
+    std::map<std::array<GLuint, DrawPacket::MAX_TEXTURES + 1>, uint32_t> materialIds;
+    std::unordered_map<GLuint, uint32_t> vaoIds;
+    // more distinct states in one flush than a field holds, reported once
+    bool idsExhausted = false;
+
+    RenderQueueStats lastStats;
+};
+
+
+void RenderQueue::submit(const DrawPacket &packet)
+{
+    if (packet.shader == nullptr || packet.count <= 0)
+    {
+        return;
+    }
+    packets.push_back(packet);
+}
+
+template<typename Key, typename Map>
+uint32_t RenderQueue::internId(Map &ids, const Key &key, int bits)
+{
+    auto found = ids.find(key);
+    if (found != ids.end())
+    {
+        return found->second;
+    }
+    uint32_t capacity = 1u << bits;
+    if (ids.size() >= capacity)
+    {
+        // the rest of this flush shares the last id: worse batching, but the binds stay right
+        if (!idsExhausted)
+        {
+            std::cout << "ERROR::RENDER_QUEUE::TOO_MANY_STATES: more than " << capacity << " in one flush" << std::endl;
+            idsExhausted = true;
+        }
+        return capacity - 1;
+    }
+    uint32_t id = (uint32_t)ids.size();
+    ids.emplace(key, id);
+    return id;
+}
+
+std::array<GLuint, DrawPacket::MAX_TEXTURES + 1> RenderQueue::materialOf(const DrawPacket &packet)
+{
+    std::array<GLuint, DrawPacket::MAX_TEXTURES + 1> textures;
+    textures[0] = packet.textureTarget;
+    for (int i = 0; i < DrawPacket::MAX_TEXTURES; i++)
+    {
+        textures[i + 1] = packet.textures[i];
+    }
+    return textures;
+}
+
+uint32_t RenderQueue::quantizeDepth(float depth) const
+{
+    const uint32_t maxDepth = (1u << DEPTH_BITS) - 1;
+    float normalized = farPlane > 0.0f ? depth / farPlane : 0.0f;
+    if (!(normalized > 0.0f)) return 0;
+    if (normalized >= 1.0f) return maxDepth;
+    return (uint32_t)(normalized * maxDepth);
+}
+
+uint64_t RenderQueue::makeKey(const DrawPacket &packet)
+{
+    uint64_t program = internId(programIds, packet.shader->ID, PROGRAM_BITS);
+    uint64_t material = internId(materialIds, materialOf(packet), MATERIAL_BITS);
+    uint64_t vao = internId(vaoIds, packet.vao, VAO_BITS);
+    uint64_t depth = quantizeDepth(packet.depth);
+
+    uint64_t state = (program << (MATERIAL_BITS + VAO_BITS)) | (material << VAO_BITS) | vao;
+    if (packet.translucent)
+    {
+        uint64_t backToFront = ((1u << DEPTH_BITS) - 1) - depth;
+        return (1ull << 63) | (backToFront << (PROGRAM_BITS + MATERIAL_BITS + VAO_BITS)) | state;
+    }
+    return (state << DEPTH_BITS) | depth;
+}
+
+/**
+ LSD radix sort of keys (with order as payload), 8 bits per pass.
+ Passes where every key has the same digit are skipped, which is most of them for small scenes.
+ */
+void RenderQueue::sortKeys()
+{
+    size_t n = keys.size();
+    keysScratch.resize(n);
+    orderScratch.resize(n);
+
+    uint32_t histograms[8][256] = {};
+    for (uint64_t key : keys)
+    {
+        for (int pass = 0; pass < 8; pass++)
+        {
+            histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    for (int pass = 0; pass < 8; pass++)
+    {
+        uint32_t *histogram = histograms[pass];
+        if (histogram[(keys[0] >> (pass * 8)) & 0xFF] == n)
+        {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            uint32_t count = histogram[digit];
+            histogram[digit] = offset;
+            offset += count;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t destination = histogram[(keys[i] >> (pass * 8)) & 0xFF]++;
+            keysScratch[destination] = keys[i];
+            orderScratch[destination] = order[i];
+        }
+        keys.swap(keysScratch);
+        order.swap(orderScratch);
+    }
+}
+
+void RenderQueue::flush()
+{
+    CPU_ZONE("RenderQueue::flush");
+    lastStats = RenderQueueStats();
+    if (packets.empty())
+    {
+        return;
+    }
+
+    // names deleted and reused over time only grow the maps, start over once one is full
+    if (programIds.size() >= (1u << PROGRAM_BITS) || materialIds.size() >= (1u << MATERIAL_BITS) || vaoIds.size() >= (1u << VAO_BITS))
+    {
+        programIds.clear();
+        materialIds.clear();
+        vaoIds.clear();
+    }
+
+    size_t n = packets.size();
+    keys.resize(n);
+    order.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        keys[i] = makeKey(packets[i]);
+        order[i] = (uint32_t)i;
+    }
+    sortKeys();
+
+    // the key only orders the packets, what is bound is decided by the GL names themselves
+    const DrawPacket *last = nullptr;
+    bool blending = false;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const DrawPacket &packet = packets[order[i]];
+        bool programChanged = last == nullptr || packet.shader->ID != last->shader->ID;
+        // a material is per program, a VAO per material, as in the key
+        bool materialChanged = programChanged || materialOf(packet) != materialOf(*last);
+        bool vaoChanged = materialChanged || packet.vao != last->vao;
+        last = &packet;
+
+        if (packet.translucent && !blending)
+        {
+            // translucent keys sort after every opaque one
+            glState.enable(GL_BLEND);
+            glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glState.depthMask(GL_FALSE);
+            blending = true;
+        }
+
+        if (programChanged)
+        {
+            packet.shader->use();
+            lastStats.programChanges++;
+        }
+        if (materialChanged)
+        {
+            for (int unit = 0; unit < DrawPacket::MAX_TEXTURES; unit++)
+            {
+                if (packet.textures[unit] != 0)
+                {
+                    glState.bindTexture(unit, packet.textureTarget, packet.textures[unit]);
+                }
+            }
+            lastStats.materialChanges++;
+        }
+        if (vaoChanged)
+        {
+            glState.bindVertexArray(packet.vao);
+            lastStats.vaoChanges++;
+        }
+
+        packet.shader->setMat4("model"_uniform, packet.model);
+        if (packet.indexType != 0)
+        {
+            glState.drawElements(packet.mode, packet.count, packet.indexType, (void*)packet.indexOffset);
+        }
+        else
+        {
+            glState.drawArrays(packet.mode, packet.first, packet.count);
+        }
+        lastStats.draws++;
+    }
+
+    if (blending)
+    {
+        glState.depthMask(GL_TRUE);
+        glState.disable(GL_BLEND);
+    }
+    packets.clear();
+}
+
+#endif /* my_render_queue_h */
@@ -0,0 +1,114 @@
+//
+//  shader_permutations.h
+//  graphics-start
+//
+//  Lazily compiled variants of one uber-shader.
+//  Every feature key becomes "#define KEY 1" in the variants that enable it, so the shader selects
+//  code paths with #ifdef instead of branching on uniforms. A variant is compiled the first time its
+//  key combination is requested and then reused.
+//
+//  ShaderPermutations phong(vs, fs, { "LIGHT_AMBIENT", "LIGHT_DIFFUSE", "LIGHT_SPECULAR" });
+//  Shader &shader = phong.get(0b011); // ambient + diffuse
+//
+
+#ifndef my_shader_permutations_h
+#define my_shader_permutations_h
+
+#include <my/shader_s.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ShaderPermutations
+{
+public:
+    ShaderPermutations(const std::string &vertexPath, const std::string &fragmentPath, const std::vector<std::string> &features);
+
+    // bit i of mask enables features[i]
+    Shader& get(uint32_t mask);
+    Shader& get(const std::vector<std::string> &enabled) { return get(maskOf(enabled)); }
+
+    uint32_t maskOf(const std::vector<std::string> &enabled) const;
+    std::string definesOf(uint32_t mask) const;
+
+    // number of variants compiled so far
+    size_t compiledCount() const { return variants.size(); }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::vector<std::string> features;
+
+    // Shader is referenced by address (e.g. ShaderReloader), so variants never move
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+};
+
+
+ShaderPermutations::ShaderPermutations(const std::string &vertexPath, const std::string &fragmentPath, const std::vector<std::string> &features): vertexPath(vertexPath), fragmentPath(fragmentPath), features(features)
+{
+    if (features.size() > 32)
+    {
+        std::cout << "ERROR::SHADER_PERMUTATIONS::TOO_MANY_FEATURES: " << features.size() << std::endl;
+        this->features.resize(32);
+    }
+}
+
+uint32_t ShaderPermutations::maskOf(const std::vector<std::string> &enabled) const
+{
+    uint32_t mask = 0;
+    for (const std::string &name : enabled)
+    {
+        bool found = false;
+        for (size_t i = 0; i < features.size(); i++)
+        {
+            if (features[i] == name)
+            {
+                mask |= 1u << i;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            std::cout << "ERROR::SHADER_PERMUTATIONS::UNKNOWN_FEATURE: " << name << std::endl;
+        }
+    }
+    return mask;
+}
+
+std::string ShaderPermutations::definesOf(uint32_t mask) const
+{
+    std::string defines;
+    for (size_t i = 0; i < features.size(); i++)
+    {
+        if (mask & (1u << i))
+        {
+            defines += "#define " + features[i] + " 1\n";
+        }
+    }
+    return defines;
+}
+
+Shader& ShaderPermutations::get(uint32_t mask)
+{
+    // bits without a feature would only produce duplicate variants
+    if (features.size() < 32)
+    {
+        mask &= (1u << features.size()) - 1;
+    }
+
+    auto found = variants.find(mask);
+    if (found != variants.end())
+    {
+        return *found->second;
+    }
+
+    std::unique_ptr<Shader> shader(new Shader(vertexPath.c_str(), fragmentPath.c_str(), definesOf(mask)));
+    Shader &result = *shader;
+    variants.emplace(mask, std::move(shader));
+    return result;
+}
+
+#endif /* my_shader_permutations_h */
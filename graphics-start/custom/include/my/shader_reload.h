@@ -0,0 +1,520 @@
+//
+//  shader_reload.h
+//  graphics-start
+//
+//  Live shader hot-reload.
+//  A worker thread watches the source files of the registered shaders and the files they #include
+//  (inotify on Linux, polling elsewhere),
+//  recompiles changed programs on a hidden GL context that shares objects with the main one, and the render
+//  loop swaps the new program in with apply() at the start of a frame. A program that fails to build is
+//  dropped and the old one keeps running.
+//
+//  ShaderReloader reloader(window);
+//  reloader.watch(lightingShader);
+//  while (...) { reloader.apply(); ... }
+//
+
+#ifndef my_shader_reload_h
+#define my_shader_reload_h
+
+#include <GLFW/glfw3.h>
+#include <my/shader_s.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+class ShaderReloader
+{
+public:
+    ShaderReloader(GLFWwindow* window);
+    ~ShaderReloader();
+
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    // starts watching the vertex/fragment (and geometry) files the shader was built from, and their includes
+    void watch(Shader &shader);
+
+    // swaps in every program finished since the last call, call it on the render thread between frames
+    void apply();
+
+    // stops the worker and releases its context, has to happen before glfwTerminate
+    void stop();
+
+private:
+    struct Watched
+    {
+        Shader* shader;
+        std::filesystem::path vertexPath;
+        std::filesystem::path fragmentPath;
+        // empty without a geometry stage
+        std::filesystem::path geometryPath;
+        std::string defines;
+        std::filesystem::file_time_type vertexTime;
+        std::filesystem::file_time_type fragmentTime;
+        std::filesystem::file_time_type geometryTime;
+        // #include files of every stage, taken again from each rebuild since edits can add or drop some
+        std::vector<std::filesystem::path> includePaths;
+        std::vector<std::filesystem::file_time_type> includeTimes;
+        bool dirty;
+
+        bool uses(const std::filesystem::path &file) const;
+    };
+    struct Pending
+    {
+        Shader* shader;
+        unsigned int program;
+    };
+
+    GLFWwindow* workerContext;
+    std::thread worker;
+    std::atomic<bool> running;
+
+    std::mutex mutex;
+    std::vector<Watched> watched;    // guarded by mutex
+    std::vector<Pending> pending;    // guarded by mutex
+
+#ifdef __linux__
+    int inotifyFd = -1;
+    std::vector<std::pair<int, std::filesystem::path>> watchedDirs; // guarded by mutex
+#endif
+
+    void workerLoop();
+    // both with mutex held
+    void setIncludes(Watched &entry, const std::vector<std::string> &includes);
+    void watchDirectory(const std::filesystem::path &file);
+    bool waitForChanges();
+    void rebuildDirty();
+
+    static std::filesystem::path normalize(const std::string &path);
+    static std::filesystem::file_time_type writeTime(const std::filesystem::path &path);
+    static void copyUniforms(unsigned int from, unsigned int to);
+};
+
+
+ShaderReloader::ShaderReloader(GLFWwindow* window): running(true)
+{
+    // hidden 1x1 window whose only purpose is a context sharing programs with the render context
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    workerContext = glfwCreateWindow(1, 1, "shader reload", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+    if (workerContext == NULL)
+    {
+        std::cout << "ERROR::SHADER_RELOAD::CANNOT_CREATE_WORKER_CONTEXT" << std::endl;
+        running = false;
+        return;
+    }
+
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        std::cout << "ERROR::SHADER_RELOAD::INOTIFY_INIT_FAILED, falling back to polling" << std::endl;
+    }
+#endif
+
+    worker = std::thread(&ShaderReloader::workerLoop, this);
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    stop();
+}
+
+void ShaderReloader::stop()
+{
+    running = false;
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+
+    // programs that were built but never applied
+    for (Pending &entry : pending)
+    {
+        glDeleteProgram(entry.program);
+    }
+    pending.clear();
+
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+    if (workerContext != NULL)
+    {
+        glfwDestroyWindow(workerContext);
+        workerContext = NULL;
+    }
+}
+
+std::filesystem::path ShaderReloader::normalize(const std::string &path)
+{
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::weakly_canonical(path, error);
+    return error ? std::filesystem::path(path).lexically_normal() : absolute;
+}
+
+std::filesystem::file_time_type ShaderReloader::writeTime(const std::filesystem::path &path)
+{
+    std::error_code error;
+    return std::filesystem::last_write_time(path, error);
+}
+
+bool ShaderReloader::Watched::uses(const std::filesystem::path &file) const
+{
+    if (vertexPath == file || fragmentPath == file || (!geometryPath.empty() && geometryPath == file))
+    {
+        return true;
+    }
+    return std::find(includePaths.begin(), includePaths.end(), file) != includePaths.end();
+}
+
+void ShaderReloader::setIncludes(Watched &entry, const std::vector<std::string> &includes)
+{
+    entry.includePaths.clear();
+    entry.includeTimes.clear();
+    for (const std::string &include : includes)
+    {
+        entry.includePaths.push_back(normalize(include));
+        entry.includeTimes.push_back(writeTime(entry.includePaths.back()));
+        watchDirectory(entry.includePaths.back());
+    }
+}
+
+void ShaderReloader::watchDirectory(const std::filesystem::path &file)
+{
+#ifdef __linux__
+    // watch the directories, editors usually save by writing a new file and renaming it over the old one
+    if (inotifyFd < 0 || file.empty())
+    {
+        return;
+    }
+    std::filesystem::path dir = file.parent_path();
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0)
+    {
+        std::cout << "ERROR::SHADER_RELOAD::CANNOT_WATCH " << dir << std::endl;
+        return;
+    }
+    for (auto &watchedDir : watchedDirs)
+    {
+        if (watchedDir.first == wd)
+        {
+            return;
+        }
+    }
+    watchedDirs.push_back({ wd, dir });
+#endif
+}
+
+void ShaderReloader::watch(Shader &shader)
+{
+    Watched entry;
+    entry.shader = &shader;
+    entry.vertexPath = normalize(shader.vertexSourcePath);
+    entry.fragmentPath = normalize(shader.fragmentSourcePath);
+    entry.geometryPath = shader.geometrySourcePath.empty() ? std::filesystem::path() : normalize(shader.geometrySourcePath);
+    entry.defines = shader.defines;
+    entry.vertexTime = writeTime(entry.vertexPath);
+    entry.fragmentTime = writeTime(entry.fragmentPath);
+    entry.geometryTime = writeTime(entry.geometryPath);
+    entry.dirty = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    setIncludes(entry, shader.includePaths);
+    for (const std::filesystem::path &file : { entry.vertexPath, entry.fragmentPath, entry.geometryPath })
+    {
+        watchDirectory(file);
+    }
+    watched.push_back(entry);
+}
+
+/**
+ Blocks for a short while and marks the shaders whose files changed, returns true if any did.
+ */
+bool ShaderReloader::waitForChanges()
+{
+    bool changed = false;
+
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        pollfd descriptor = { inotifyFd, POLLIN, 0 };
+        if (poll(&descriptor, 1, 100) <= 0)
+        {
+            return false;
+        }
+
+        // give the editor a moment to finish writing, then take every event that piled up
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (char* ptr = buffer; ptr < buffer + length; )
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+                if (event->len == 0)
+                {
+                    continue;
+                }
+
+                for (auto &watchedDir : watchedDirs)
+                {
+                    if (watchedDir.first != event->wd)
+                    {
+                        continue;
+                    }
+                    std::filesystem::path file = watchedDir.second / event->name;
+                    for (Watched &entry : watched)
+                    {
+                        if (entry.uses(file))
+                        {
+                            entry.dirty = true;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+        return changed;
+    }
+#endif
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Watched &entry : watched)
+    {
+        auto vertexTime = writeTime(entry.vertexPath);
+        auto fragmentTime = writeTime(entry.fragmentPath);
+        auto geometryTime = writeTime(entry.geometryPath);
+        bool includeChanged = false;
+        for (size_t i = 0; i < entry.includePaths.size(); i++)
+        {
+            auto includeTime = writeTime(entry.includePaths[i]);
+            includeChanged |= includeTime != entry.includeTimes[i];
+            entry.includeTimes[i] = includeTime;
+        }
+        if (vertexTime != entry.vertexTime || fragmentTime != entry.fragmentTime || geometryTime != entry.geometryTime || includeChanged)
+        {
+            entry.vertexTime = vertexTime;
+            entry.fragmentTime = fragmentTime;
+            entry.geometryTime = geometryTime;
+            entry.dirty = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void ShaderReloader::rebuildDirty()
+{
+    std::vector<Watched> jobs;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Watched &entry : watched)
+        {
+            if (entry.dirty)
+            {
+                jobs.push_back(entry);
+                entry.dirty = false;
+            }
+        }
+    }
+
+    for (const Watched &job : jobs)
+    {
+        CPU_ZONE("ShaderReloader::rebuild");
+        std::string vertexCode, fragmentCode, geometryCode;
+        std::vector<std::string> includes;
+        bool read = Shader::readSources(job.vertexPath.c_str(), job.fragmentPath.c_str(), vertexCode, fragmentCode, job.defines, &includes)
+                    && (job.geometryPath.empty() || Shader::readSource(job.geometryPath.c_str(), geometryCode, job.defines, &includes));
+        {
+            // an edit can add or drop includes, watch what this build read
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Watched &entry : watched)
+            {
+                if (entry.shader == job.shader)
+                {
+                    setIncludes(entry, includes);
+                }
+            }
+        }
+        if (!read)
+        {
+            continue;
+        }
+
+        unsigned int program = Shader::loadOrBuildProgram(vertexCode, fragmentCode, geometryCode);
+        if (program == 0)
+        {
+            std::cout << "SHADER_RELOAD::FAILED, keeping the old program: " << job.fragmentPath.string() << std::endl;
+            continue;
+        }
+
+        // the program has to be complete before the render context starts using it
+        glFinish();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Pending &entry : pending)
+        {
+            // an older build that was never applied, this one replaces it
+            if (entry.shader == job.shader)
+            {
+                glDeleteProgram(entry.program);
+                entry.program = program;
+                program = 0;
+            }
+        }
+        if (program != 0)
+        {
+            pending.push_back({ job.shader, program });
+        }
+    }
+}
+
+void ShaderReloader::workerLoop()
+{
+    glfwMakeContextCurrent(workerContext);
+    cpuProfiler.setThreadName("shader reload");
+
+    while (running)
+    {
+        if (waitForChanges())
+        {
+            rebuildDirty();
+        }
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+void ShaderReloader::apply()
+{
+    std::vector<Pending> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.empty())
+        {
+            return;
+        }
+        ready.swap(pending);
+    }
+
+    CPU_ZONE("ShaderReloader::apply");
+    GLint current = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+
+    for (Pending &entry : ready)
+    {
+        Shader &shader = *entry.shader;
+        unsigned int old = shader.ID;
+
+        // uniforms set once at startup (sampler units, projection...) must survive the swap
+        copyUniforms(old, entry.program);
+
+        shader.ID = entry.program;
+        shader.buildUniformTable();
+
+        if ((unsigned int)current == old)
+        {
+            current = entry.program;
+        }
+        glDeleteProgram(old);
+        std::cout << "SHADER_RELOAD::RELOADED " << shader.fragmentSourcePath << std::endl;
+    }
+
+    glUseProgram(current);
+    // copyUniforms bound programs behind the state cache's back
+    glState.invalidateProgram();
+}
+
+/**
+ Copies the value of every uniform that exists in both programs. It leaves the program `to` bound.
+ */
+void ShaderReloader::copyUniforms(unsigned int from, unsigned int to)
+{
+    if (from == 0)
+    {
+        return;
+    }
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(to, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(to, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> name(maxLength + 1);
+
+    glUseProgram(to);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(to, i, maxLength, NULL, &size, &type, name.data());
+
+        std::string base(name.data());
+        if (size > 1)
+        {
+            base = base.substr(0, base.rfind('['));
+        }
+
+        for (GLint element = 0; element < size; element++)
+        {
+            std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+            GLint source = glGetUniformLocation(from, elementName.c_str());
+            GLint target = glGetUniformLocation(to, elementName.c_str());
+            if (source == -1 || target == -1)
+            {
+                continue;
+            }
+
+            GLfloat f[16];
+            GLint n[4];
+            GLuint u[4];
+            switch (type)
+            {
+                case GL_FLOAT:      glGetUniformfv(from, source, f); glUniform1fv(target, 1, f); break;
+                case GL_FLOAT_VEC2: glGetUniformfv(from, source, f); glUniform2fv(target, 1, f); break;
+                case GL_FLOAT_VEC3: glGetUniformfv(from, source, f); glUniform3fv(target, 1, f); break;
+                case GL_FLOAT_VEC4: glGetUniformfv(from, source, f); glUniform4fv(target, 1, f); break;
+                case GL_FLOAT_MAT2: glGetUniformfv(from, source, f); glUniformMatrix2fv(target, 1, GL_FALSE, f); break;
+                case GL_FLOAT_MAT3: glGetUniformfv(from, source, f); glUniformMatrix3fv(target, 1, GL_FALSE, f); break;
+                case GL_FLOAT_MAT4: glGetUniformfv(from, source, f); glUniformMatrix4fv(target, 1, GL_FALSE, f); break;
+                case GL_INT_VEC2:
+                case GL_BOOL_VEC2:  glGetUniformiv(from, source, n); glUniform2iv(target, 1, n); break;
+                case GL_INT_VEC3:
+                case GL_BOOL_VEC3:  glGetUniformiv(from, source, n); glUniform3iv(target, 1, n); break;
+                case GL_INT_VEC4:
+                case GL_BOOL_VEC4:  glGetUniformiv(from, source, n); glUniform4iv(target, 1, n); break;
+                case GL_UNSIGNED_INT:      glGetUniformuiv(from, source, u); glUniform1uiv(target, 1, u); break;
+                case GL_UNSIGNED_INT_VEC2: glGetUniformuiv(from, source, u); glUniform2uiv(target, 1, u); break;
+                case GL_UNSIGNED_INT_VEC3: glGetUniformuiv(from, source, u); glUniform3uiv(target, 1, u); break;
+                case GL_UNSIGNED_INT_VEC4: glGetUniformuiv(from, source, u); glUniform4uiv(target, 1, u); break;
+                default:
+                    // int, bool and every sampler type are a single int
+                    glGetUniformiv(from, source, n); glUniform1iv(target, 1, n); break;
+            }
+        }
+    }
+}
+
+#endif /* my_shader_reload_h */
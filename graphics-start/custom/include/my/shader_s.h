@@ -9,50 +9,153 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <gl-state.h>
+#include <my/cpu_profiler.h>
+#include <my/hash.h>
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <filesystem>
+#include <algorithm>
 #include <glm/glm.hpp>
 
+// #include "file" and #inject in GLSL sources, with GLSL style #line directives
+#define STB_INCLUDE_LINE_GLSL
+#define STB_INCLUDE_IMPLEMENTATION
+#include <stb-master/stb_include.h>
+
+/**
+ FNV-1a hash of a uniform name. It is constexpr, so names can be hashed at compile time.
+ */
+constexpr uint32_t uniformHash(const char* name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<uint8_t>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Compile-time hashed uniform name: shader.setMat4("model"_uniform, model);
+// the text stays alongside, a hash hit is only trusted once the names match
+struct UniformName { uint32_t hash; const char* name; };
+
+constexpr UniformName operator"" _uniform(const char* name, size_t length)
+{
+    return UniformName{ uniformHash(name, length), name };
+}
+
+// Pre-resolved uniform handle: UniformLocation model = shader.getUniform("model");
+struct UniformLocation { GLint value = -1; };
+
+// Uniform blocks that get the same binding point in every program at link time
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint CLUSTERS_BLOCK_BINDING = 1;
+const GLuint SHADOWS_BLOCK_BINDING = 2;
+
+struct UniformBlockBinding { const char* name; GLuint binding; };
+const UniformBlockBinding UNIFORM_BLOCK_BINDINGS[] = {
+    { "Camera", CAMERA_BLOCK_BINDING },
+    { "Clusters", CLUSTERS_BLOCK_BINDING },
+    { "Shadows", SHADOWS_BLOCK_BINDING },
+};
+
 class Shader
 {
 private:
-    enum class CHECK_TYPE { PROGRAM, VERTEX, FRAGMENT };
-    void checkCompileErrors(unsigned int shader, CHECK_TYPE type);
+    enum class CHECK_TYPE { PROGRAM, VERTEX, GEOMETRY, FRAGMENT };
+    static bool checkCompileErrors(unsigned int shader, CHECK_TYPE type);
+    
+    // on-disk program binary cache, keyed by the sources and the driver
+    static std::string programCacheKey(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode);
+    static std::filesystem::path programCacheDirectory();
+    static unsigned int loadProgramBinary(const std::string &key);
+    static void saveProgramBinary(unsigned int program, const std::string &key);
+    
+    // flat open addressing table of active uniforms, filled once after link;
+    // nameOffset points into uniformNames, where the names are stored NUL terminated
+    struct UniformSlot { uint32_t hash; GLint location; uint32_t nameOffset; };
+    std::vector<UniformSlot> uniformTable;
+    std::string uniformNames;
+    void insertUniform(const char* name, GLint location);
+    
 public:
     
     // The Program ID
     unsigned int ID;
     
-    // constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath);
-    Shader(const std::string&& vertexPath, const std::string&& fragmentPath): Shader(vertexPath.c_str(), fragmentPath.c_str()){}
+    // where the sources came from, e.g. for hot reloading
+    std::string vertexSourcePath;
+    std::string fragmentSourcePath;
+    // empty for programs without a geometry stage
+    std::string geometrySourcePath;
+    // "#define KEY 1" lines injected into both sources, see preprocess()
+    std::string defines;
+    // every file the stages pull in with #include, nested ones included
+    std::vector<std::string> includePaths;
+    
+    // constructor reads and builds the shader, with a geometry stage when geometryPath is given
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = "", const std::string &geometryPath = "");
+    Shader(const std::string&& vertexPath, const std::string&& fragmentPath, const std::string &defines = "", const std::string &geometryPath = ""): Shader(vertexPath.c_str(), fragmentPath.c_str(), defines, geometryPath){}
+    
+    // reads and preprocesses both source files, returns false when one of them cannot be read;
+    // includes, when given, collects the #include files of both
+    static bool readSources(const char* vertexPath, const char* fragmentPath, std::string &vertexCode, std::string &fragmentCode, const std::string &defines = "", std::vector<std::string>* includes = NULL);
+    // reads and preprocesses one more stage, e.g. the geometry shader
+    static bool readSource(const char* path, std::string &code, const std::string &defines = "", std::vector<std::string>* includes = NULL);
+    // resolves #include "file" relative to path and replaces #inject (or the line after #version) with defines
+    static bool preprocess(const char* path, std::string &code, const std::string &defines, std::vector<std::string>* includes = NULL);
+    // adds the files code includes, and the ones they include, to includes; dir is where they are looked up
+    static void findIncludes(char* code, const std::string &dir, std::vector<std::string> &includes);
+    // compiles and links a program from source, returns 0 when it fails; an empty geometryCode means no geometry stage
+    static unsigned int buildProgram(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode = "");
+    // same as buildProgram, but goes through the program binary cache first
+    static unsigned int loadOrBuildProgram(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode = "");
     
     // activate the shader
     void use();
     
-    // utilify uniform functions
-    void setBool(const std::string &name, bool value) const;
-    void setInt(const std::string &name, int value) const;
-    void setFloat(const std::string &name, float value) const;
+    // enumerates the active uniforms of the linked program and binds its uniform blocks, call again whenever ID is relinked
+    void buildUniformTable();
+    void bindUniformBlocks();
+    
+    // uniform lookup without the driver: by name, by compile-time hash or by pre-resolved handle
+    GLint uniformLocation(UniformName name) const;
+    GLint uniformLocation(const char* name) const { return uniformLocation(UniformName{ uniformHash(name, strlen(name)), name }); }
+    GLint uniformLocation(const std::string &name) const { return uniformLocation(UniformName{ uniformHash(name.data(), name.size()), name.c_str() }); }
+    GLint uniformLocation(UniformLocation location) const { return location.value; }
+    UniformLocation getUniform(const std::string &name) const { return UniformLocation{ uniformLocation(name) }; }
+    
+    // utilify uniform functions, Key is a name (std::string or literal), UniformName or UniformLocation
+    template<typename Key> void setBool(const Key &name, bool value) const;
+    template<typename Key> void setInt(const Key &name, int value) const;
+    template<typename Key> void setFloat(const Key &name, float value) const;
     
-    void setVec2(const std::string &name, const glm::vec2 &value) const;
-    void setVec2(const std::string &name, float x, float y) const;
-    void setVec3(const std::string &name, const glm::vec3 &value) const;
-    void setVec3(const std::string &name, float x, float y, float z) const;
-    void setVec4(const std::string &name, const glm::vec4 &value) const;
+    template<typename Key> void setVec2(const Key &name, const glm::vec2 &value) const;
+    template<typename Key> void setVec2(const Key &name, float x, float y) const;
+    template<typename Key> void setVec3(const Key &name, const glm::vec3 &value) const;
+    template<typename Key> void setVec3(const Key &name, float x, float y, float z) const;
+    template<typename Key> void setVec4(const Key &name, const glm::vec4 &value) const;
     
-    void setMat2(const std::string &name, const glm::mat2 &mat) const;
-    void setMat3(const std::string &name, const glm::mat3 &mat) const;
-    void setVec4(const std::string &name, float x, float y, float z, float w) const;
-    void setMat4(const std::string &name, const glm::mat4 &mat) const;
+    template<typename Key> void setMat2(const Key &name, const glm::mat2 &mat) const;
+    template<typename Key> void setMat3(const Key &name, const glm::mat3 &mat) const;
+    template<typename Key> void setVec4(const Key &name, float x, float y, float z, float w) const;
+    template<typename Key> void setMat4(const Key &name, const glm::mat4 &mat) const;
     
     friend std::ostream& operator<<(std::ostream &out, const CHECK_TYPE type) {
         std::string typeString = "";
         switch (type) {
             case CHECK_TYPE::PROGRAM: typeString = "PROGRAM"; break;
             case CHECK_TYPE::VERTEX: typeString = "VERTEX"; break;
+            case CHECK_TYPE::GEOMETRY: typeString = "GEOMETRY"; break;
             case CHECK_TYPE::FRAGMENT: typeString = "FRAGMENT"; break;
         }
         
@@ -63,17 +166,17 @@ public:
 };
 
 
-void Shader::checkCompileErrors(unsigned int shader, CHECK_TYPE type)
+bool Shader::checkCompileErrors(unsigned int shader, CHECK_TYPE type)
 {
-    int success;
+    int success = 0;
     char infoLog[1024];
     
-    if (type == CHECK_TYPE::VERTEX || type == CHECK_TYPE::FRAGMENT)
+    if (type != CHECK_TYPE::PROGRAM)
     {
         glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
         if (success)
         {
-            return;
+            return true;
         }
         
         glGetShaderInfoLog(shader, 1024, NULL, infoLog);
@@ -84,18 +187,39 @@ void Shader::checkCompileErrors(unsigned int shader, CHECK_TYPE type)
         glGetProgramiv(shader, GL_LINK_STATUS, &success);
         if (success)
         {
-            return;
+            return true;
         }
         glGetProgramInfoLog(shader, 1024, NULL, infoLog);
         std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: PROGRAM\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
     }
+    return success;
 }
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines, const std::string &geometryPath): vertexSourcePath(vertexPath), fragmentSourcePath(fragmentPath), geometrySourcePath(geometryPath), defines(defines)
 {
+    CPU_ZONE("Shader::Shader");
+    std::cout << "current path: " << std::filesystem::current_path() << std::endl;
+    std::cout << "vertexPath: " << vertexPath << ", fragmentPath: " << fragmentPath << std::endl;
+    
     // 1. retrieve the source code from filepath
     std::string vertexCode;
     std::string fragmentCode;
+    std::string geometryCode;
+    readSources(vertexPath, fragmentPath, vertexCode, fragmentCode, defines, &includePaths);
+    if (!geometryPath.empty())
+    {
+        readSource(geometryPath.c_str(), geometryCode, defines, &includePaths);
+    }
+    
+    // 2. compile shaders, or take the program straight from the binary cache
+    ID = loadOrBuildProgram(vertexCode, fragmentCode, geometryCode);
+    
+    buildUniformTable();
+}
+
+bool Shader::readSources(const char* vertexPath, const char* fragmentPath, std::string &vertexCode, std::string &fragmentCode, const std::string &defines, std::vector<std::string>* includes)
+{
+    CPU_ZONE("Shader::readSources");
     std::ifstream vShaderFile;
     std::ifstream fShaderFile;
     
@@ -105,8 +229,6 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
     
     try
     {
-        std::cout << "current path: " << std::filesystem::current_path() << std::endl;
-        std::cout << "vertexPath: " << vertexPath << ", fragmentPath: " << fragmentPath << std::endl;
         vShaderFile.open(vertexPath);
         fShaderFile.open(fragmentPath);
         
@@ -124,95 +246,467 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
         std::cout << e.what() << std::endl;
+        return false;
+    }
+    return preprocess(vertexPath, vertexCode, defines, includes) && preprocess(fragmentPath, fragmentCode, defines, includes);
+}
+
+bool Shader::readSource(const char* path, std::string &code, const std::string &defines, std::vector<std::string>* includes)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+        return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    code = stream.str();
+    return preprocess(path, code, defines, includes);
+}
+
+bool Shader::preprocess(const char* path, std::string &code, const std::string &defines, std::vector<std::string>* includes)
+{
+    // without an explicit #inject the defines go right after #version, which has to stay the first line
+    if (!defines.empty() && code.find("#inject") == std::string::npos)
+    {
+        size_t version = code.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if (lineEnd == std::string::npos)
+        {
+            code.insert(0, "#inject\n");
+        }
+        else
+        {
+            code.insert(lineEnd + 1, "#inject\n");
+        }
+    }
+    
+    std::vector<char> source(code.begin(), code.end());
+    source.push_back('\0');
+    std::vector<char> inject(defines.begin(), defines.end());
+    inject.push_back('\0');
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    std::vector<char> includeDir(dir.begin(), dir.end());
+    includeDir.push_back('\0');
+    std::vector<char> filename(path, path + strlen(path) + 1);
+    if (includes)
+    {
+        findIncludes(source.data(), dir, *includes);
     }
     
+    char error[256] = "";
+    char* result = stb_include_string(source.data(), inject.data(), includeDir.data(), filename.data(), error);
+    if (result == NULL)
+    {
+        std::cout << "ERROR::SHADER::PREPROCESS_FAILED: " << path << "\n" << error << std::endl;
+        return false;
+    }
+    code = result;
+    free(result);
+    return true;
+}
+
+void Shader::findIncludes(char* code, const std::string &dir, std::vector<std::string> &includes)
+{
+    include_info* list;
+    int count = stb_include_find_includes(code, &list);
+    for (int i = 0; i < count; i++)
+    {
+        // #inject has no file
+        if (list[i].filename == NULL)
+        {
+            continue;
+        }
+        std::string path = dir + "/" + list[i].filename;
+        if (std::find(includes.begin(), includes.end(), path) != includes.end())
+        {
+            continue;
+        }
+        includes.push_back(path);
+        // nested includes resolve against the same directory, as in stb_include_string
+        if (char* text = stb_include_load_file(&path[0], NULL))
+        {
+            findIncludes(text, dir, includes);
+            free(text);
+        }
+    }
+    stb_include_free_includes(list, count);
+}
+
+unsigned int Shader::buildProgram(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode)
+{
     const char* vShaderCode = vertexCode.c_str();
     const char* fShaderCode = fragmentCode.c_str();
     
-    // 2. compile shaders
     unsigned int vertex, fragment;
+    bool success = true;
     
     vertex = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertex, 1, &vShaderCode, NULL);
     glCompileShader(vertex);
-    checkCompileErrors(vertex, CHECK_TYPE::VERTEX);
+    success &= checkCompileErrors(vertex, CHECK_TYPE::VERTEX);
     
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragment, 1, &fShaderCode, NULL);
     glCompileShader(fragment);
-    checkCompileErrors(fragment, CHECK_TYPE::FRAGMENT);
+    success &= checkCompileErrors(fragment, CHECK_TYPE::FRAGMENT);
+    
+    unsigned int geometry = 0;
+    if (!geometryCode.empty())
+    {
+        const char* gShaderCode = geometryCode.c_str();
+        geometry = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(geometry, 1, &gShaderCode, NULL);
+        glCompileShader(geometry);
+        success &= checkCompileErrors(geometry, CHECK_TYPE::GEOMETRY);
+    }
     
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    checkCompileErrors(ID, CHECK_TYPE::PROGRAM);
+    unsigned int program = glCreateProgram();
+#ifdef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    if (geometry != 0)
+    {
+        glAttachShader(program, geometry);
+    }
+    glLinkProgram(program);
+    success &= checkCompileErrors(program, CHECK_TYPE::PROGRAM);
     
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    if (geometry != 0)
+    {
+        glDeleteShader(geometry);
+    }
+    
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+unsigned int Shader::loadOrBuildProgram(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode)
+{
+    CPU_ZONE("Shader::loadOrBuildProgram");
+    std::string key = programCacheKey(vertexCode, fragmentCode, geometryCode);
+    
+    unsigned int program = loadProgramBinary(key);
+    if (program != 0)
+    {
+        return program;
+    }
+    
+    program = buildProgram(vertexCode, fragmentCode, geometryCode);
+    if (program != 0)
+    {
+        saveProgramBinary(program, key);
+    }
+    return program;
+}
+
+/**
+ Program binaries are only valid for the driver that produced them, so the renderer and version strings are part of the key.
+ */
+std::string Shader::programCacheKey(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode)
+{
+    // hashBytes mixes in every length, so "ab"+"c" and "a"+"bc" differ
+    uint64_t hash = hashBytes(vertexCode.data(), vertexCode.size());
+    hash = hashBytes(fragmentCode.data(), fragmentCode.size(), hash);
+    // only fed when present, so the keys of vertex/fragment programs stay what they were
+    if (!geometryCode.empty())
+    {
+        hash = hashBytes(geometryCode.data(), geometryCode.size(), hash);
+    }
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+    {
+        const char* value = reinterpret_cast<const char*>(glGetString(name));
+        if (value)
+        {
+            hash = hashBytes(value, strlen(value), hash);
+        }
+    }
+    return hashHex(hash);
+}
+
+/**
+ SHADER_CACHE_DIR overrides the cache location, set it to an empty string to disable the cache.
+ */
+std::filesystem::path Shader::programCacheDirectory()
+{
+    return cacheDirectory("SHADER_CACHE_DIR", "graphics-start-shader-cache");
+}
+
+// cache file layout: magic, binary format, binary length, binary
+const uint32_t PROGRAM_CACHE_MAGIC = 0x42505347; // "GSPB"
+
+unsigned int Shader::loadProgramBinary(const std::string &key)
+{
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    std::filesystem::path dir = programCacheDirectory();
+    if (formats == 0 || dir.empty())
+    {
+        return 0;
+    }
+    
+    std::filesystem::path path = dir / (key + ".bin");
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return 0;
+    }
+    
+    uint32_t magic = 0;
+    GLenum format = 0;
+    GLint length = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char*>(&format), sizeof(format));
+    file.read(reinterpret_cast<char*>(&length), sizeof(length));
+    
+    std::vector<char> binary(file && magic == PROGRAM_CACHE_MAGIC && length > 0 ? length : 0);
+    file.read(binary.data(), binary.size());
+    
+    unsigned int program = 0;
+    GLint success = 0;
+    if (file && !binary.empty())
+    {
+        program = glCreateProgram();
+        glProgramBinary(program, format, binary.data(), length);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+    }
+    
+    if (!success)
+    {
+        // truncated, stale or rejected by the driver after an update, rebuild it from source
+        if (program != 0)
+        {
+            glDeleteProgram(program);
+        }
+        file.close();
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        return 0;
+    }
+    return program;
+#else
+    return 0;
+#endif
+}
+
+void Shader::saveProgramBinary(unsigned int program, const std::string &key)
+{
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    std::filesystem::path dir = programCacheDirectory();
+    if (formats == 0 || dir.empty())
+    {
+        return;
+    }
+    
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    
+    writeFileAtomic(dir / (key + ".bin"), "ERROR::SHADER::PROGRAM_CACHE_WRITE_FAILED", [&](std::ofstream &file)
+    {
+        file.write(reinterpret_cast<const char*>(&PROGRAM_CACHE_MAGIC), sizeof(PROGRAM_CACHE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(binary.data(), length);
+    });
+#endif
 }
 
 // activate the shader
 void Shader::use()
 {
-    glUseProgram(ID);
+    glState.useProgram(ID);
+}
+
+void Shader::insertUniform(const char* name, GLint location)
+{
+    uint32_t hash = uniformHash(name, strlen(name));
+    size_t mask = uniformTable.size() - 1;
+    
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        UniformSlot &slot = uniformTable[i];
+        if (slot.location == -1)
+        {
+            slot.hash = hash;
+            slot.location = location;
+            slot.nameOffset = (uint32_t)uniformNames.size();
+            uniformNames.append(name);
+            uniformNames.push_back('\0');
+            return;
+        }
+        // two names with the same hash both get a slot, the lookup tells them apart by name
+        if (slot.hash == hash && strcmp(uniformNames.data() + slot.nameOffset, name) == 0)
+            return;
+    }
+}
+
+void Shader::bindUniformBlocks()
+{
+    for (const UniformBlockBinding &block : UNIFORM_BLOCK_BINDINGS)
+    {
+        GLuint index = glGetUniformBlockIndex(ID, block.name);
+        if (index != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(ID, index, block.binding);
+        }
+    }
+}
+
+void Shader::buildUniformTable()
+{
+    bindUniformBlocks();
+    
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    
+    // array uniforms get an entry per element, so count those to size the table
+    std::vector<char> name(maxLength + 1);
+    std::vector<GLint> sizes(count);
+    size_t entries = 0;
+    for (GLint i = 0; i < count; i++)
+    {
+        GLenum type;
+        glGetActiveUniform(ID, i, maxLength, NULL, &sizes[i], &type, name.data());
+        entries += sizes[i] > 1 ? sizes[i] + 1 : 1;
+    }
+    
+    // power of two, at most half full
+    size_t capacity = 8;
+    while (capacity < entries * 2)
+        capacity *= 2;
+    uniformTable.assign(capacity, UniformSlot{ 0, -1, 0 });
+    uniformNames.clear();
+    
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(ID, i, maxLength, NULL, &size, &type, name.data());
+        
+        // members of uniform blocks have no location
+        GLint location = glGetUniformLocation(ID, name.data());
+        if (location == -1)
+            continue;
+        insertUniform(name.data(), location);
+        
+        // arrays are reported as "name[0]", make "name" and every "name[i]" resolvable as well
+        if (size > 1)
+        {
+            std::string base(name.data());
+            base = base.substr(0, base.rfind('['));
+            insertUniform(base.c_str(), location);
+            for (GLint element = 1; element < size; element++)
+            {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                insertUniform(elementName.c_str(), glGetUniformLocation(ID, elementName.c_str()));
+            }
+        }
+    }
+}
+
+GLint Shader::uniformLocation(UniformName name) const
+{
+    if (uniformTable.empty())
+        return -1;
+    
+    size_t mask = uniformTable.size() - 1;
+    for (size_t i = name.hash & mask; ; i = (i + 1) & mask)
+    {
+        const UniformSlot &slot = uniformTable[i];
+        if (slot.location == -1)
+            return -1; // not an active uniform, GL ignores location -1 just like glGetUniformLocation would
+        if (slot.hash == name.hash && strcmp(uniformNames.data() + slot.nameOffset, name.name) == 0)
+            return slot.location;
+    }
 }
 
 // utilify uniform functions
-void Shader::setBool(const std::string &name, bool value) const
+template<typename Key>
+void Shader::setBool(const Key &name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(uniformLocation(name), (int)value);
 }
 
-void Shader::setInt(const std::string &name, int value) const
+template<typename Key>
+void Shader::setInt(const Key &name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(uniformLocation(name), value);
 }
 
-void Shader::setFloat(const std::string &name, float value) const
+template<typename Key>
+void Shader::setFloat(const Key &name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(uniformLocation(name), value);
 }
-void Shader::setVec2(const std::string &name, const glm::vec2 &value) const
+template<typename Key>
+void Shader::setVec2(const Key &name, const glm::vec2 &value) const
 {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform2fv(uniformLocation(name), 1, &value[0]);
 }
-void Shader::setVec2(const std::string &name, float x, float y) const
+template<typename Key>
+void Shader::setVec2(const Key &name, float x, float y) const
 {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    glUniform2f(uniformLocation(name), x, y);
 }
 // ------------------------------------------------------------------------
-void Shader::setVec3(const std::string &name, const glm::vec3 &value) const
+template<typename Key>
+void Shader::setVec3(const Key &name, const glm::vec3 &value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(uniformLocation(name), 1, &value[0]);
 }
-void Shader::setVec3(const std::string &name, float x, float y, float z) const
+template<typename Key>
+void Shader::setVec3(const Key &name, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    glUniform3f(uniformLocation(name), x, y, z);
 }
 // ------------------------------------------------------------------------
-void Shader::setVec4(const std::string &name, const glm::vec4 &value) const
+template<typename Key>
+void Shader::setVec4(const Key &name, const glm::vec4 &value) const
 {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform4fv(uniformLocation(name), 1, &value[0]);
 }
-void Shader::setVec4(const std::string &name, float x, float y, float z, float w) const
+template<typename Key>
+void Shader::setVec4(const Key &name, float x, float y, float z, float w) const
 {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+    glUniform4f(uniformLocation(name), x, y, z, w);
 }
 // ------------------------------------------------------------------------
-void Shader::setMat2(const std::string &name, const glm::mat2 &mat) const
+template<typename Key>
+void Shader::setMat2(const Key &name, const glm::mat2 &mat) const
 {
-    glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix2fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 // ------------------------------------------------------------------------
-void Shader::setMat3(const std::string &name, const glm::mat3 &mat) const
+template<typename Key>
+void Shader::setMat3(const Key &name, const glm::mat3 &mat) const
 {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix3fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 // ------------------------------------------------------------------------
-void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const
+template<typename Key>
+void Shader::setMat4(const Key &name, const glm::mat4 &mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 #endif /* shader_s_hpp */
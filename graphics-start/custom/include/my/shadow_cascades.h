@@ -0,0 +1,310 @@
+//
+//  shadow_cascades.h
+//  graphics-start
+//
+//  Cascaded shadow maps for one directional light.
+//  The view distance (camera near plane to far plane, or a shorter shadow distance) is split with the
+//  practical scheme, a blend of logarithmic and uniform splits. Each cascade renders the casters of its
+//  slice of the view frustum into one layer of a depth texture array:
+//    - the slice is enclosed in a sphere, so the ortho box has the same size whatever way the camera
+//      turns, and its center is snapped to whole shadow texels in light space; moving or turning the
+//      camera then never resamples the scene at other positions and shadow edges do not shimmer
+//    - the casters are culled per cascade against the box stretched towards the light, and the near
+//      plane is pulled in to the nearest caster, so the depth range is no longer than it needs to be
+//  The lighting shaders pick the cascade by view depth and take a 3x3 PCF lookup (custom/shaders/
+//  shadows.glsl). Per cascade the number of draws is recorded, wrap every beginCascade in a
+//  GpuProfileScope for the GPU time.
+//
+//  ShadowCascades shadows(4, 2048);
+//  shadows.setSamplers(shader);
+//  while (...)
+//  {
+//      shadows.update(camera, towardLight, color, casterBounds);
+//      for (int i = 0; i < shadows.cascadeCount(); i++)
+//      {
+//          shadows.beginCascade(i);
+//          for (uint32_t caster : shadows.casters(i)) { shadows.depthShader().setMat4("model", ...); draw(); }
+//      }
+//      shadows.end();
+//      shadows.bind();
+//      ...
+//  }
+//  shadows.release();
+//
+
+#ifndef my_shadow_cascades_h
+#define my_shadow_cascades_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <my/camera.h>
+#include <my/cpu_profiler.h>
+#include <my/depth_pass.h>
+#include <my/frustum.h>
+#include <my/path.h>
+#include <my/shader_s.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// std140 layout of the Shadows block
+struct ShadowsBlock
+{
+    glm::mat4 matrices[4];
+    // far view depth of each cascade
+    glm::vec4 splits;
+    // world size of a shadow texel in each cascade
+    glm::vec4 texelSizes;
+    // xyz towards the light, w is the number of cascades
+    glm::vec4 lightDirection;
+    // w is 1 / shadow map resolution
+    glm::vec4 lightColor;
+};
+static_assert(sizeof(ShadowsBlock) == 320, "ShadowsBlock has to match the std140 layout in shadows.glsl");
+
+class ShadowCascades
+{
+public:
+    static const int MAX_CASCADES = 4;
+    // texture unit of the shadow map, below the light cluster buffers
+    static const GLuint SHADOW_UNIT = 12;
+    // how far towards the light casters are searched for
+    static constexpr float CASTER_REACH = 500.0f;
+
+    // splitLambda blends logarithmic (1) and uniform (0) splits; maxDistance 0 shadows up to the far plane
+    ShadowCascades(int cascades = MAX_CASCADES, int resolution = 2048, float splitLambda = 0.75f, float maxDistance = 0.0f);
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    // fits the cascades to the camera, culls the casters per cascade and uploads the block, once per frame
+    void update(Camera &camera, const glm::vec3 &towardLight, const glm::vec3 &color, const BoundingSpheres &casterBounds);
+    // renders into the layer of a cascade with depthShader(), the following draws are its casters
+    void beginCascade(int cascade);
+    // back to the framebuffer and viewport that were current at the first beginCascade
+    void end();
+    // binds the shadow map to SHADOW_UNIT and the block to SHADOWS_BLOCK_BINDING
+    void bind();
+    // points the shadow sampler of a program at its unit, again after it is relinked
+    static void setSamplers(Shader &shader);
+
+    int cascadeCount() const { return count; }
+    // indices into the caster bounds of update() that touch the cascade
+    const std::vector<uint32_t>& casters(int cascade) const { return cascadeCasters[cascade]; }
+    // draws issued between beginCascade(cascade) and the next beginCascade / end
+    unsigned int lastDraws(int cascade) const { return draws[cascade]; }
+    float splitDepth(int cascade) const { return block.splits[cascade]; }
+    Shader& depthShader() { return shader; }
+
+    void printStats() const;
+    void release();
+
+private:
+    int count;
+    int resolution;
+    float splitLambda;
+    float maxDistance;
+
+    Shader shader;
+    GLuint depthTexture = 0;
+    GLuint framebuffer = 0;
+    GLuint blockBuffer = 0;
+    ShadowsBlock block = {};
+
+    std::vector<uint32_t> cascadeCasters[MAX_CASCADES];
+    unsigned int draws[MAX_CASCADES] = {};
+    // totals over every frame for printStats
+    uint64_t totalDraws[MAX_CASCADES] = {};
+    uint64_t totalCasters[MAX_CASCADES] = {};
+    uint64_t frames = 0;
+
+    // cascade being rendered, -1 outside beginCascade / end
+    int current = -1;
+    unsigned int drawsAtBegin = 0;
+    DepthPass pass;
+
+    void closeCascade();
+};
+
+
+ShadowCascades::ShadowCascades(int cascades, int resolution, float splitLambda, float maxDistance) :
+    count(std::min(std::max(cascades, 1), MAX_CASCADES)), resolution(resolution), splitLambda(splitLambda), maxDistance(maxDistance),
+    shader(shaderPath + "/shadow_depth.vs", shaderPath + "/shadow_depth.fs")
+{
+    glGenTextures(1, &depthTexture);
+    glState.bindTexture(SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, depthTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, count, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    // hardware compare with bilinear filtering, every PCF tap is already a 2x2 weighted test
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    // outside the map counts as lit
+    const float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+
+    GLint previous = DepthPass::currentFramebuffer();
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::SHADOW_CASCADES::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+    glGenBuffers(1, &blockBuffer);
+    glState.bindBuffer(GL_UNIFORM_BUFFER, blockBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowsBlock), NULL, GL_DYNAMIC_DRAW);
+}
+
+void ShadowCascades::update(Camera &camera, const glm::vec3 &towardLight, const glm::vec3 &color, const BoundingSpheres &casterBounds)
+{
+    CPU_ZONE("Shadow cascades update");
+    glm::vec3 direction = glm::normalize(towardLight);
+    float nearPlane = camera.NearPlane;
+    float farPlane = maxDistance > 0.0f ? std::min(maxDistance, camera.FarPlane) : camera.FarPlane;
+
+    // a fixed rotation: only the snapped translation of a cascade changes from frame to frame
+    glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -direction, up);
+
+    float tanY = std::tan(glm::radians(camera.Zoom) * 0.5f);
+    float tanX = tanY * camera.Aspect;
+    // squared distance from the view axis to a frustum corner, per unit of depth
+    float corner2 = tanX * tanX + tanY * tanY;
+
+    float sliceNear = nearPlane;
+    for (int i = 0; i < count; i++)
+    {
+        float t = (float)(i + 1) / count;
+        float logarithmic = nearPlane * std::pow(farPlane / nearPlane, t);
+        float uniform = nearPlane + (farPlane - nearPlane) * t;
+        float sliceFar = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+
+        // smallest sphere around the slice: its center sits on the view axis, the distances to the
+        // near and the far corners are equal unless that would put it beyond the far plane
+        float centerDepth = std::min(sliceFar, (sliceFar + sliceNear) * (1.0f + corner2) * 0.5f);
+        float radius = std::sqrt(std::max((centerDepth - sliceNear) * (centerDepth - sliceNear) + sliceNear * sliceNear * corner2,
+                                          (sliceFar - centerDepth) * (sliceFar - centerDepth) + sliceFar * sliceFar * corner2));
+        // rounded up, so float noise in the corners never changes the size of a texel
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        float texelSize = 2.0f * radius / resolution;
+
+        glm::vec3 center = glm::vec3(lightView * glm::vec4(camera.Position + camera.Front * centerDepth, 1.0f));
+        center.x = std::floor(center.x / texelSize + 0.5f) * texelSize;
+        center.y = std::floor(center.y / texelSize + 0.5f) * texelSize;
+
+        // light space looks down -z, depth is -z
+        float receiversNear = -center.z - radius;
+        float receiversFar = -center.z + radius;
+        glm::mat4 reach = glm::ortho(center.x - radius, center.x + radius, center.y - radius, center.y + radius, receiversNear - CASTER_REACH, receiversFar);
+        {
+            CPU_ZONE("Shadow cascade culling");
+            cullSpheres(Frustum::fromMatrix(reach * lightView), casterBounds, cascadeCasters[i]);
+        }
+
+        // casters between the light and the slice still have to land inside the depth range
+        float depthNear = receiversNear;
+        for (uint32_t caster : cascadeCasters[i])
+        {
+            glm::vec4 position = lightView * glm::vec4(casterBounds.x[caster], casterBounds.y[caster], casterBounds.z[caster], 1.0f);
+            depthNear = std::min(depthNear, -position.z - casterBounds.radius[caster]);
+        }
+        // whole units, so the depth quantization does not change with every small caster movement
+        depthNear = std::floor(depthNear);
+
+        glm::mat4 projection = glm::ortho(center.x - radius, center.x + radius, center.y - radius, center.y + radius, depthNear, receiversFar);
+        block.matrices[i] = projection * lightView;
+        block.splits[i] = sliceFar;
+        block.texelSizes[i] = texelSize;
+        totalCasters[i] += cascadeCasters[i].size();
+        sliceNear = sliceFar;
+    }
+    block.lightDirection = glm::vec4(direction, (float)count);
+    block.lightColor = glm::vec4(color, 1.0f / resolution);
+    frames++;
+
+    glState.bindBuffer(GL_UNIFORM_BUFFER, blockBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowsBlock), &block);
+}
+
+void ShadowCascades::beginCascade(int cascade)
+{
+    if (current < 0)
+    {
+        pass.begin(resolution, shader);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+    else
+    {
+        closeCascade();
+    }
+
+    current = cascade;
+    drawsAtBegin = glState.frame.draws;
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, cascade);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    shader.setMat4("lightViewProj", block.matrices[cascade]);
+}
+
+void ShadowCascades::closeCascade()
+{
+    draws[current] = glState.frame.draws - drawsAtBegin;
+    totalDraws[current] += draws[current];
+}
+
+void ShadowCascades::end()
+{
+    if (current < 0)
+    {
+        return;
+    }
+    closeCascade();
+    current = -1;
+    pass.end();
+}
+
+void ShadowCascades::bind()
+{
+    glState.bindBufferBase(GL_UNIFORM_BUFFER, SHADOWS_BLOCK_BINDING, blockBuffer);
+    glState.bindTexture(SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, depthTexture);
+}
+
+void ShadowCascades::setSamplers(Shader &shader)
+{
+    shader.use();
+    shader.setInt("shadowMap", SHADOW_UNIT);
+}
+
+void ShadowCascades::printStats() const
+{
+    std::cout << "SHADOW_CASCADES::STATS cascades=" << count << " resolution=" << resolution << " lambda=" << splitLambda << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (int i = 0; i < count; i++)
+    {
+        std::cout << "  cascade " << i << " split=" << block.splits[i] << " texel=" << block.texelSizes[i]
+                  << " casters=" << (frames ? (double)totalCasters[i] / frames : 0.0)
+                  << " draws=" << (frames ? (double)totalDraws[i] / frames : 0.0) << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+void ShadowCascades::release()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glState.deleteTextures(1, &depthTexture);
+    glState.deleteBuffers(1, &blockBuffer);
+    framebuffer = 0;
+    depthTexture = 0;
+    blockBuffer = 0;
+}
+
+#endif /* my_shadow_cascades_h */
@@ -0,0 +1,318 @@
+//
+//  texture_image.h
+//  graphics-start
+//
+//  Upload-ready texture images: decoded, with a full CPU mip chain (texture_mips.h), optionally block
+//  compressed, and cached on disk keyed by a hash of the source file and the options, so later runs
+//  only read the levels back.
+//
+//  Compression uses stb_dxt: every level is encoded in 4x4 blocks, the block rows split across
+//  threads. Opaque images become BC1 (8 bytes per block, 1/8 of RGBA8), images with any alpha below
+//  255 become BC3 (16 bytes per block, 1/4 of RGBA8).
+//
+//  TEXTURE_CACHE_DIR overrides the cache location, set it to an empty string to disable the cache.
+//
+//  TextureImage image;
+//  TextureImageOptions options;
+//  options.srgb = true;
+//  options.compress = true;
+//  if (loadTextureImage(texturePath + "/container.jpg", options, image))
+//  {
+//      for (size_t level = 0; level < image.levels.size(); level++)
+//          glCompressedTexImage2D(GL_TEXTURE_2D, level, compressedFormat(image.format, true), ...);
+//  }
+//
+
+#ifndef my_texture_image_h
+#define my_texture_image_h
+
+#define STB_DXT_IMPLEMENTATION
+#include <glad/glad.h>
+#include <my/cpu_profiler.h>
+#include <my/hash.h>
+#include <my/texture_mips.h>
+#include <stb-master/stb_dxt.h>
+// stb_image.h emits its implementation on every include after STB_IMAGE_IMPLEMENTATION
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb-master/stb_image.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// S3TC is an extension (EXT_texture_compression_s3tc, EXT_texture_sRGB), not every loader defines it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+enum TexturePixelFormat : uint32_t
+{
+    TEXTURE_RGBA8 = 0,
+    TEXTURE_BC1 = 1,
+    TEXTURE_BC3 = 3,
+};
+
+struct TextureImageOptions
+{
+    bool flipVertically = false;
+    // mips are filtered in linear light
+    bool srgb = false;
+    bool compress = false;
+    // alpha test value whose coverage every mip keeps, 0 for textures that are blended or opaque
+    float alphaCutoff = 0.0f;
+};
+
+struct TextureImage
+{
+    TexturePixelFormat format = TEXTURE_RGBA8;
+    std::vector<TextureLevel> levels;
+
+    bool compressed() const { return format != TEXTURE_RGBA8; }
+    size_t size() const;
+};
+
+// threads 0 uses every core
+bool loadTextureImage(const std::string &path, const TextureImageOptions &options, TextureImage &image, unsigned int threads = 0);
+
+void compressLevel(const TextureLevel &rgba, TexturePixelFormat format, TextureLevel &blocks, unsigned int threads);
+
+GLenum compressedFormat(TexturePixelFormat format, bool srgb);
+// with a current context
+bool s3tcSupported();
+
+
+size_t TextureImage::size() const
+{
+    size_t total = 0;
+    for (const TextureLevel &level : levels)
+    {
+        total += level.data.size();
+    }
+    return total;
+}
+
+GLenum compressedFormat(TexturePixelFormat format, bool srgb)
+{
+    if (format == TEXTURE_BC3)
+    {
+        return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+    return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+bool s3tcSupported()
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (name != nullptr && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void compressLevel(const TextureLevel &rgba, TexturePixelFormat format, TextureLevel &blocks, unsigned int threads)
+{
+    int blocksX = (rgba.width + 3) / 4;
+    int blocksY = (rgba.height + 3) / 4;
+    size_t blockBytes = format == TEXTURE_BC3 ? 16 : 8;
+    blocks.width = rgba.width;
+    blocks.height = rgba.height;
+    blocks.data.resize((size_t)blocksX * blocksY * blockBytes);
+
+    auto encodeRows = [&](int firstRow, int lastRow)
+    {
+        CPU_ZONE("Texture compress");
+        uint8_t block[16 * 4];
+        for (int by = firstRow; by < lastRow; by++)
+        {
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                // blocks past the edge repeat the last row and column
+                for (int y = 0; y < 4; y++)
+                {
+                    int sy = std::min(by * 4 + y, rgba.height - 1);
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int sx = std::min(bx * 4 + x, rgba.width - 1);
+                        std::memcpy(&block[(y * 4 + x) * 4], &rgba.data[((size_t)sy * rgba.width + sx) * 4], 4);
+                    }
+                }
+                stb_compress_dxt_block(&blocks.data[((size_t)by * blocksX + bx) * blockBytes], block, format == TEXTURE_BC3, STB_DXT_HIGHQUAL);
+            }
+        }
+    };
+
+    // small levels are not worth a thread
+    const int MIN_ROWS_PER_THREAD = 16;
+    unsigned int count = std::max(1u, std::min(threads, (unsigned int)(blocksY / MIN_ROWS_PER_THREAD)));
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 1; i < count; i++)
+    {
+        helpers.emplace_back(encodeRows, blocksY * (int)i / (int)count, blocksY * (int)(i + 1) / (int)count);
+    }
+    encodeRows(0, blocksY / (int)count);
+    for (std::thread &helper : helpers)
+    {
+        helper.join();
+    }
+}
+
+
+namespace texture_cache_detail
+{
+    // cache file layout: magic, version, format, level count, then width, height, size and data per level
+    const uint32_t TEXTURE_CACHE_MAGIC = 0x43545347; // "GSTC"
+    // bump when the decoder, the mip filter or the encoder changes
+    const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+    inline size_t levelBytes(TexturePixelFormat format, uint32_t width, uint32_t height)
+    {
+        if (format == TEXTURE_RGBA8)
+        {
+            return (size_t)width * height * 4;
+        }
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * (format == TEXTURE_BC3 ? 16 : 8);
+    }
+
+    bool readCache(const std::filesystem::path &path, TextureImage &image)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        uint32_t header[4] = {};
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!file || header[0] != TEXTURE_CACHE_MAGIC || header[1] != TEXTURE_CACHE_VERSION
+            || (header[2] != TEXTURE_RGBA8 && header[2] != TEXTURE_BC1 && header[2] != TEXTURE_BC3) || header[3] == 0 || header[3] > 32)
+        {
+            return false;
+        }
+        image.format = (TexturePixelFormat)header[2];
+        image.levels.resize(header[3]);
+        for (TextureLevel &level : image.levels)
+        {
+            uint32_t info[3] = {};
+            file.read(reinterpret_cast<char *>(info), sizeof(info));
+            if (!file || info[0] == 0 || info[1] == 0 || info[2] != levelBytes(image.format, info[0], info[1]))
+            {
+                return false;
+            }
+            level.width = (int)info[0];
+            level.height = (int)info[1];
+            level.data.resize(info[2]);
+            file.read(reinterpret_cast<char *>(level.data.data()), level.data.size());
+        }
+        return (bool)file;
+    }
+
+    void writeCache(const std::filesystem::path &path, const TextureImage &image)
+    {
+        writeFileAtomic(path, "ERROR::TEXTURE::CACHE_WRITE_FAILED", [&](std::ofstream &file)
+        {
+            uint32_t header[4] = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, image.format, (uint32_t)image.levels.size() };
+            file.write(reinterpret_cast<const char *>(header), sizeof(header));
+            for (const TextureLevel &level : image.levels)
+            {
+                uint32_t info[3] = { (uint32_t)level.width, (uint32_t)level.height, (uint32_t)level.data.size() };
+                file.write(reinterpret_cast<const char *>(info), sizeof(info));
+                file.write(reinterpret_cast<const char *>(level.data.data()), level.data.size());
+            }
+        });
+    }
+}
+
+bool loadTextureImage(const std::string &path, const TextureImageOptions &options, TextureImage &image, unsigned int threads)
+{
+    using namespace texture_cache_detail;
+    CPU_ZONE("loadTextureImage");
+
+    // the file is read once, for the hash and for the decoder
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << " (not found)" << std::endl;
+        return false;
+    }
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    uint64_t hash = hashBytes(bytes.data(), bytes.size());
+    uint32_t flags[4] = { options.flipVertically, options.srgb, options.compress, (uint32_t)(options.alphaCutoff * 255.0f + 0.5f) };
+    hash = hashBytes(flags, sizeof(flags), hash);
+    std::filesystem::path directory = cacheDirectory("TEXTURE_CACHE_DIR", "graphics-start-texture-cache");
+    std::filesystem::path cachePath;
+    if (!directory.empty())
+    {
+        cachePath = directory / (std::filesystem::path(path).stem().string() + "-" + hashHex(hash) + ".tex");
+        if (readCache(cachePath, image))
+        {
+            return true;
+        }
+    }
+
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+    stbi_uc *pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(bytes.data()), (int)bytes.size(), &width, &height, &channels, 4);
+    if (pixels == nullptr)
+    {
+        std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+        return false;
+    }
+
+    bool alpha = false;
+    for (size_t i = 3; i < (size_t)width * height * 4 && !alpha; i += 4)
+    {
+        alpha = pixels[i] != 255;
+    }
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<TextureLevel> mips = buildMipChain(pixels, width, height, options.srgb, options.alphaCutoff, threads);
+    stbi_image_free(pixels);
+
+    if (options.compress)
+    {
+        image.format = alpha ? TEXTURE_BC3 : TEXTURE_BC1;
+        image.levels.resize(mips.size());
+        for (size_t level = 0; level < mips.size(); level++)
+        {
+            compressLevel(mips[level], image.format, image.levels[level], threads);
+        }
+    }
+    else
+    {
+        image.format = TEXTURE_RGBA8;
+        image.levels = std::move(mips);
+    }
+
+    if (!cachePath.empty())
+    {
+        writeCache(cachePath, image);
+    }
+    return true;
+}
+
+#endif /* my_texture_image_h */
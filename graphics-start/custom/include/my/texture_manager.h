@@ -0,0 +1,530 @@
+//
+//  texture_manager.h
+//  graphics-start
+//
+//  Asynchronous 2D texture loading.
+//  load() returns a handle right away and queues the file on a pool of decode threads (stb_image).
+//  The workers also build the mip chain (texture_mips.h: gamma correct, alpha coverage preserving)
+//  and, with TextureOptions::compress, encode every level to BC1/BC3; the result is cached on disk
+//  (texture_image.h). Without S3TC support the compress option is ignored.
+//  update(), called once per frame on the render thread, uploads the prepared levels through pixel
+//  buffer objects until the frame's time budget is spent: RGBA8 levels in slices of rows, compressed
+//  levels one per step. The driver never generates mips. Until its upload is done a handle resolves to
+//  a small checkerboard placeholder, so the render loop never waits for a file.
+//
+//  TextureManager textures;
+//  TextureHandle container = textures.load(texturePath + "/container.jpg");
+//  while (...)
+//  {
+//      textures.update();
+//      glState.bindTexture(0, GL_TEXTURE_2D, textures.texture(container));
+//      ...
+//  }
+//  textures.release();
+//
+
+#ifndef my_texture_manager_h
+#define my_texture_manager_h
+
+#include <glad/glad.h>
+#include <gl-state.h>
+#include <my/cpu_profiler.h>
+#include <my/texture_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t TextureHandle;
+
+struct TextureOptions
+{
+    bool flipVertically = false;
+    // color textures are stored as sRGB, data textures (normals, masks) are not
+    bool srgb = false;
+    bool mipmaps = true;
+    // BC1/BC3, for color maps; normal maps lose too much with it
+    bool compress = false;
+    // alpha tested textures (foliage, fences): the alpha test value whose coverage every mip keeps
+    float alphaCutoff = 0.0f;
+    GLenum wrap = GL_REPEAT;
+};
+
+class TextureManager
+{
+public:
+    // PIXEL_BUFFER_COUNT staging buffers are used round robin, so an upload never waits for the previous one
+    static const unsigned int PIXEL_BUFFER_COUNT = 4;
+    static constexpr double DEFAULT_BUDGET_MS = 2.0;
+    // largest upload between two budget checks
+    static const size_t SLICE_BYTES = 4 << 20;
+
+    // workers 0 uses every core but one, which is left to the render thread
+    TextureManager(unsigned int workers = 0);
+    ~TextureManager();
+    TextureManager(const TextureManager&) = delete;
+    TextureManager& operator=(const TextureManager&) = delete;
+
+    // the same path and options give the same handle
+    TextureHandle load(const std::string &path, const TextureOptions &options = TextureOptions());
+
+    // render thread: uploads decoded images until budgetMs is spent, at least one per call
+    void update(double budgetMs = DEFAULT_BUDGET_MS);
+
+    // the texture once it is resident, the placeholder until then (and for files that failed to load)
+    GLuint texture(TextureHandle handle);
+    bool resident(TextureHandle handle) const;
+    // every requested texture is resident or failed
+    bool idle() const;
+    // blocks the render thread until idle, for tools and tests
+    void finish();
+
+    void printStats() const;
+    void release();
+
+private:
+    enum State { QUEUED, DECODED, RESIDENT, FAILED };
+
+    struct Entry
+    {
+        std::string path;
+        TextureOptions options;
+        State state = QUEUED;
+        GLuint texture = 0;
+        TextureImage image;
+        double decodeMs = 0.0;
+        // render thread only, the level being uploaded and the rows of it done so far
+        size_t uploadedLevels = 0;
+        int uploadedRows = 0;
+        bool complete = false;
+    };
+
+    // entries never move once created, the workers hold pointers to them
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::unordered_map<std::string, TextureHandle> handles;
+
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable decodedSignal;
+    std::deque<TextureHandle> decodeQueue;
+    std::deque<TextureHandle> uploadQueue;
+    size_t pending = 0;
+    // decodes in flight, a lone compression job gets the idle cores for its block rows
+    size_t decoding = 0;
+    bool stopping = false;
+    // -1 until the first compressed load asks the context
+    int compressionSupport = -1;
+
+    GLuint placeholder = 0;
+    GLuint pixelBuffers[PIXEL_BUFFER_COUNT] = {};
+    unsigned int nextPixelBuffer = 0;
+
+    // statistics
+    size_t uploaded = 0;
+    size_t uploadedBytes = 0;
+    size_t compressedCount = 0;
+    size_t compressedBytes = 0;
+    size_t compressedSourceBytes = 0;
+    double decodeMs = 0.0;
+    double uploadMs = 0.0;
+    double worstFrameMs = 0.0;
+
+    void decodeLoop();
+    bool uploadStep(Entry &entry);
+    const void *stage(const void *data, size_t size);
+    GLuint createPlaceholder();
+};
+
+
+TextureManager::TextureManager(unsigned int workerCount)
+{
+    if (workerCount == 0)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        workerCount = cores > 1 ? cores - 1 : 1;
+    }
+    for (unsigned int i = 0; i < workerCount; i++)
+    {
+        workers.emplace_back(&TextureManager::decodeLoop, this);
+    }
+}
+
+TextureManager::~TextureManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+TextureHandle TextureManager::load(const std::string &path, const TextureOptions &requested)
+{
+    TextureOptions options = requested;
+    if (options.compress)
+    {
+        if (compressionSupport < 0)
+        {
+            compressionSupport = s3tcSupported() ? 1 : 0;
+            if (!compressionSupport)
+            {
+                std::cout << "ERROR::TEXTURE::NO_S3TC: GL_EXT_texture_compression_s3tc is missing, textures stay uncompressed" << std::endl;
+            }
+        }
+        options.compress = compressionSupport == 1 && options.mipmaps;
+    }
+    if (!options.mipmaps)
+    {
+        options.alphaCutoff = 0.0f;
+    }
+    std::string key = path + (options.flipVertically ? "|flip" : "") + (options.srgb ? "|srgb" : "") + (options.mipmaps ? "" : "|nomips")
+                    + (options.compress ? "|bc" : "") + (options.alphaCutoff > 0.0f ? "|cutoff" + std::to_string(options.alphaCutoff) : "");
+    auto found = handles.find(key);
+    if (found != handles.end())
+    {
+        return found->second;
+    }
+
+    TextureHandle handle = (TextureHandle)entries.size();
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->path = path;
+    entry->options = options;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(std::move(entry));
+        decodeQueue.push_back(handle);
+        pending++;
+    }
+    handles.emplace(key, handle);
+    wake.notify_one();
+    return handle;
+}
+
+void TextureManager::decodeLoop()
+{
+    cpuProfiler.setThreadName("texture decode");
+    while (true)
+    {
+        Entry *entry = nullptr;
+        TextureHandle handle;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !decodeQueue.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+            handle = decodeQueue.front();
+            decodeQueue.pop_front();
+            entry = entries[handle].get();
+            decoding++;
+        }
+
+        CPU_ZONE("Texture decode");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool decoded;
+        if (entry->options.mipmaps)
+        {
+            unsigned int threads;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads = (unsigned int)std::max<size_t>(1, (workers.size() + 1) / (decoding + decodeQueue.size()));
+            }
+            TextureImageOptions imageOptions;
+            imageOptions.flipVertically = entry->options.flipVertically;
+            imageOptions.srgb = entry->options.srgb;
+            imageOptions.compress = entry->options.compress;
+            imageOptions.alphaCutoff = entry->options.alphaCutoff;
+            decoded = loadTextureImage(entry->path, imageOptions, entry->image, threads);
+        }
+        else
+        {
+            int width, height, channels;
+            stbi_set_flip_vertically_on_load_thread(entry->options.flipVertically);
+            stbi_uc *pixels = stbi_load(entry->path.c_str(), &width, &height, &channels, 4);
+            decoded = pixels != nullptr;
+            if (decoded)
+            {
+                entry->image.levels.resize(1);
+                entry->image.levels[0].width = width;
+                entry->image.levels[0].height = height;
+                entry->image.levels[0].data.assign(pixels, pixels + (size_t)width * height * 4);
+                stbi_image_free(pixels);
+            }
+            else
+            {
+                std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << entry->path << " (" << stbi_failure_reason() << ")" << std::endl;
+            }
+        }
+        entry->decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            decoding--;
+            entry->state = decoded ? DECODED : FAILED;
+            if (decoded)
+            {
+                uploadQueue.push_back(handle);
+            }
+            else
+            {
+                pending--;
+            }
+        }
+        decodedSignal.notify_all();
+    }
+}
+
+void TextureManager::update(double budgetMs)
+{
+    CPU_ZONE("TextureManager::update");
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    while (true)
+    {
+        Entry *entry = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (uploadQueue.empty())
+            {
+                break;
+            }
+            entry = entries[uploadQueue.front()].get();
+        }
+        if (uploadStep(*entry))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            uploadQueue.pop_front();
+            entry->state = RESIDENT;
+            pending--;
+        }
+        if (std::chrono::duration<double, std::milli>(Clock::now() - start).count() >= budgetMs)
+        {
+            break;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    uploadMs += elapsed;
+    worstFrameMs = std::max(worstFrameMs, elapsed);
+}
+
+/**
+ Copies data into the next staging buffer and leaves it bound to GL_PIXEL_UNPACK_BUFFER, so the
+ following glTex*Image2D call sources it and the driver can transfer without first copying client
+ memory inside the call. Returns the pointer to pass to that call: an offset of 0, or data itself
+ when mapping failed.
+ */
+const void *TextureManager::stage(const void *data, size_t size)
+{
+    if (pixelBuffers[0] == 0)
+    {
+        glGenBuffers(PIXEL_BUFFER_COUNT, pixelBuffers);
+    }
+    GLuint pixelBuffer = pixelBuffers[nextPixelBuffer];
+    nextPixelBuffer = (nextPixelBuffer + 1) % PIXEL_BUFFER_COUNT;
+
+    // orphan the previous storage, a transfer still reading it keeps it alive
+    glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (staging == nullptr)
+    {
+        // mapping failed, fall back to a client memory upload
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return data;
+    }
+    std::memcpy(staging, data, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    return nullptr;
+}
+
+/**
+ Uploads the next piece of an image: one compressed level, or SLICE_BYTES worth of rows of an RGBA8
+ level, so one large image cannot blow the frame budget. Returns true when the last level is complete.
+ */
+bool TextureManager::uploadStep(Entry &entry)
+{
+    CPU_ZONE("Texture upload");
+    TextureImage &image = entry.image;
+    GLenum internalFormat = entry.options.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    if (entry.texture == 0)
+    {
+        glGenTextures(1, &entry.texture);
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, entry.options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, entry.options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, entry.options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+        if (!image.compressed())
+        {
+            // storage for every level up front, the slices fill it in
+            glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            for (size_t level = 0; level < image.levels.size(); level++)
+            {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, image.levels[level].width, image.levels[level].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+    }
+
+    const TextureLevel &level = image.levels[entry.uploadedLevels];
+    if (image.compressed())
+    {
+        const void *source = stage(level.data.data(), level.data.size());
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.texture);
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)entry.uploadedLevels, compressedFormat(image.format, entry.options.srgb),
+                               level.width, level.height, 0, (GLsizei)level.data.size(), source);
+        uploadedBytes += level.data.size();
+        entry.uploadedLevels++;
+    }
+    else
+    {
+        size_t rowBytes = (size_t)level.width * 4;
+        int rows = std::min(level.height - entry.uploadedRows, (int)std::max<size_t>(1, SLICE_BYTES / rowBytes));
+        size_t size = rows * rowBytes;
+        const void *source = stage(&level.data[entry.uploadedRows * rowBytes], size);
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.texture);
+        // the small levels have rows narrower than 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, (GLint)entry.uploadedLevels, 0, entry.uploadedRows, level.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, source);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        uploadedBytes += size;
+        entry.uploadedRows += rows;
+        if (entry.uploadedRows == level.height)
+        {
+            entry.uploadedRows = 0;
+            entry.uploadedLevels++;
+        }
+    }
+    glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (entry.uploadedLevels < image.levels.size())
+    {
+        return false;
+    }
+
+    if (image.compressed())
+    {
+        // compared against the same levels as RGBA8, what the uncompressed path would take
+        compressedCount++;
+        compressedBytes += image.size();
+        for (const TextureLevel &uploadedLevel : image.levels)
+        {
+            compressedSourceBytes += (size_t)uploadedLevel.width * uploadedLevel.height * 4;
+        }
+    }
+    image.levels.clear();
+    image.levels.shrink_to_fit();
+    entry.complete = true;
+    uploaded++;
+    decodeMs += entry.decodeMs;
+    return true;
+}
+
+GLuint TextureManager::texture(TextureHandle handle)
+{
+    const Entry &entry = *entries[handle];
+    if (entry.complete)
+    {
+        return entry.texture;
+    }
+    if (placeholder == 0)
+    {
+        placeholder = createPlaceholder();
+    }
+    return placeholder;
+}
+
+bool TextureManager::resident(TextureHandle handle) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries[handle]->state == RESIDENT;
+}
+
+bool TextureManager::idle() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending == 0;
+}
+
+void TextureManager::finish()
+{
+    while (!idle())
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            decodedSignal.wait(lock, [this]() { return !uploadQueue.empty() || pending == 0; });
+        }
+        update(1e9);
+    }
+}
+
+// 2x2 grey checkerboard, visibly not the real texture
+GLuint TextureManager::createPlaceholder()
+{
+    const unsigned char pixels[] = {
+        96, 96, 96, 255,    160, 160, 160, 255,
+        160, 160, 160, 255, 96, 96, 96, 255,
+    };
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glState.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return texture;
+}
+
+void TextureManager::printStats() const
+{
+    std::cout << "TEXTURE::STATS uploaded=" << uploaded << " (" << std::fixed << std::setprecision(1) << uploadedBytes / (1024.0 * 1024.0) << " MB)"
+              << " decode=" << decodeMs << "ms on " << workers.size() << " threads"
+              << " upload=" << uploadMs << "ms, worst frame " << worstFrameMs << "ms" << std::defaultfloat << std::endl;
+    if (compressedCount > 0)
+    {
+        std::cout << "TEXTURE::STATS compressed=" << compressedCount << " " << std::fixed << std::setprecision(1) << compressedBytes / (1024.0 * 1024.0)
+                  << " MB instead of " << compressedSourceBytes / (1024.0 * 1024.0) << " MB RGBA8" << std::defaultfloat << std::endl;
+    }
+}
+
+void TextureManager::release()
+{
+    for (std::unique_ptr<Entry> &entry : entries)
+    {
+        if (entry->texture != 0)
+        {
+            glState.deleteTextures(1, &entry->texture);
+            entry->texture = 0;
+        }
+    }
+    if (placeholder != 0)
+    {
+        glState.deleteTextures(1, &placeholder);
+        placeholder = 0;
+    }
+    if (pixelBuffers[0] != 0)
+    {
+        glState.deleteBuffers(PIXEL_BUFFER_COUNT, pixelBuffers);
+        std::fill(pixelBuffers, pixelBuffers + PIXEL_BUFFER_COUNT, 0);
+    }
+}
+
+#endif /* my_texture_manager_h */
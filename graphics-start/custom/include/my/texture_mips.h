@@ -0,0 +1,288 @@
+//
+//  texture_mips.h
+//  graphics-start
+//
+//  CPU mip chains, filtered the same on every driver and ready to be cached or compressed.
+//  Every level is a 2x2 box of the level above:
+//    - color channels are averaged in linear light when the texture is sRGB (a plain average of
+//      sRGB bytes darkens every level)
+//    - colors are weighted by alpha, so transparent texels do not bleed their color into the edges
+//    - exact halvings take an SSE/NEON path with the rows split across threads; a level with an odd
+//      side goes through stb_image_resize with its box filter, which covers the fractional footprint
+//  Alpha tested textures (grass.png, window.png) lose coverage as alpha is averaged down and fade out
+//  in the distance. With an alpha cutoff every level's alpha is rescaled so that the fraction of texels
+//  passing the test matches level 0.
+//
+//  std::vector<TextureLevel> levels = buildMipChain(rgba, width, height, true, 0.5f, 4);
+//
+
+#ifndef my_texture_mips_h
+#define my_texture_mips_h
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <my/cpu_profiler.h>
+#include <stb-master/stb_image_resize.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MY_MIPS_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MY_MIPS_NEON 1
+#endif
+
+struct TextureLevel
+{
+    int width = 0;
+    int height = 0;
+    // RGBA8 pixels, or blocks once compressed
+    std::vector<uint8_t> data;
+};
+
+// level 0 is a copy of the RGBA8 image, every next level halves it down to 1x1
+// alphaCutoff 0 leaves alpha as filtered, otherwise the alpha test value whose coverage is kept
+std::vector<TextureLevel> buildMipChain(const uint8_t *rgba, int width, int height, bool srgb, float alphaCutoff, unsigned int threads);
+// fraction of texels with alpha above cutoff (0-255)
+float alphaCoverage(const TextureLevel &level, int cutoff);
+void preserveAlphaCoverage(TextureLevel &level, float coverage, int cutoff);
+
+
+namespace texture_mips_detail
+{
+    struct Tables
+    {
+        // byte to linear [0, 1]
+        float srgbToLinear[256];
+        float unormToFloat[256];
+        // linear quantized to 16 bits back to an sRGB byte, fine enough for the darkest values
+        uint8_t linearToSrgb[65536];
+
+        Tables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                unormToFloat[i] = c;
+            }
+            for (int i = 0; i < 65536; i++)
+            {
+                float l = i / 65535.0f;
+                float s = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                linearToSrgb[i] = (uint8_t)std::min(255.0f, s * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    inline const Tables &tables()
+    {
+        static const Tables instance;
+        return instance;
+    }
+
+    /**
+     Rows [firstRow, lastRow) of an exact 2:1 reduction. Each output texel is the alpha weighted mean of
+     four linear colors, computed four channels at a time.
+     */
+    void halveRows(const TextureLevel &source, TextureLevel &level, bool srgb, int firstRow, int lastRow)
+    {
+        CPU_ZONE("Texture mip rows");
+        const Tables &t = tables();
+        const float *toLinear = srgb ? t.srgbToLinear : t.unormToFloat;
+        const size_t sourceStride = (size_t)source.width * 4;
+
+        for (int y = firstRow; y < lastRow; y++)
+        {
+            const uint8_t *row0 = &source.data[(size_t)(y * 2) * sourceStride];
+            const uint8_t *row1 = row0 + sourceStride;
+            uint8_t *out = &level.data[(size_t)y * level.width * 4];
+            for (int x = 0; x < level.width; x++)
+            {
+                const uint8_t *p[4] = { row0 + x * 8, row0 + x * 8 + 4, row1 + x * 8, row1 + x * 8 + 4 };
+                float result[4];
+#if defined(MY_MIPS_SSE)
+                __m128 weighted = _mm_setzero_ps();
+                __m128 plain = _mm_setzero_ps();
+                for (int i = 0; i < 4; i++)
+                {
+                    float a = t.unormToFloat[p[i][3]];
+                    __m128 texel = _mm_set_ps(a, toLinear[p[i][2]], toLinear[p[i][1]], toLinear[p[i][0]]);
+                    weighted = _mm_add_ps(weighted, _mm_mul_ps(texel, _mm_set_ps(1.0f, a, a, a)));
+                    plain = _mm_add_ps(plain, texel);
+                }
+                float alphaSum = _mm_cvtss_f32(_mm_shuffle_ps(weighted, weighted, _MM_SHUFFLE(3, 3, 3, 3)));
+                // fully transparent texels keep the plain mean, the color still matters once alpha is rescaled
+                __m128 mean = alphaSum > 0.0f ? _mm_div_ps(weighted, _mm_set_ps(4.0f, alphaSum, alphaSum, alphaSum)) : _mm_mul_ps(plain, _mm_set1_ps(0.25f));
+                _mm_storeu_ps(result, mean);
+#elif defined(MY_MIPS_NEON)
+                float32x4_t weighted = vdupq_n_f32(0.0f);
+                float32x4_t plain = vdupq_n_f32(0.0f);
+                for (int i = 0; i < 4; i++)
+                {
+                    float a = t.unormToFloat[p[i][3]];
+                    float values[4] = { toLinear[p[i][0]], toLinear[p[i][1]], toLinear[p[i][2]], a };
+                    float weights[4] = { a, a, a, 1.0f };
+                    float32x4_t texel = vld1q_f32(values);
+                    weighted = vmlaq_f32(weighted, texel, vld1q_f32(weights));
+                    plain = vaddq_f32(plain, texel);
+                }
+                float alphaSum = vgetq_lane_f32(weighted, 3);
+                if (alphaSum > 0.0f)
+                {
+                    float inverse = 1.0f / alphaSum;
+                    float scales[4] = { inverse, inverse, inverse, 0.25f };
+                    vst1q_f32(result, vmulq_f32(weighted, vld1q_f32(scales)));
+                }
+                else
+                {
+                    vst1q_f32(result, vmulq_n_f32(plain, 0.25f));
+                }
+#else
+                float weighted[4] = {}, plain[4] = {};
+                for (int i = 0; i < 4; i++)
+                {
+                    float a = t.unormToFloat[p[i][3]];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        weighted[c] += toLinear[p[i][c]] * a;
+                        plain[c] += toLinear[p[i][c]];
+                    }
+                    weighted[3] += a;
+                    plain[3] += a;
+                }
+                for (int c = 0; c < 4; c++)
+                {
+                    result[c] = weighted[3] > 0.0f && c < 3 ? weighted[c] / weighted[3] : plain[c] * 0.25f;
+                }
+#endif
+                for (int c = 0; c < 3; c++)
+                {
+                    float v = std::min(std::max(result[c], 0.0f), 1.0f);
+                    out[x * 4 + c] = srgb ? t.linearToSrgb[(int)(v * 65535.0f + 0.5f)] : (uint8_t)(v * 255.0f + 0.5f);
+                }
+                out[x * 4 + 3] = (uint8_t)(std::min(std::max(result[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+float alphaCoverage(const TextureLevel &level, int cutoff)
+{
+    size_t passing = 0;
+    size_t count = (size_t)level.width * level.height;
+    for (size_t i = 0; i < count; i++)
+    {
+        passing += level.data[i * 4 + 3] > cutoff;
+    }
+    return count ? (float)passing / count : 0.0f;
+}
+
+/**
+ One histogram pass finds the alpha threshold t with the wanted share of texels above it, then alpha
+ is scaled so that t + 1 lands above the cutoff and t stays at or below it.
+ */
+void preserveAlphaCoverage(TextureLevel &level, float coverage, int cutoff)
+{
+    size_t count = (size_t)level.width * level.height;
+    size_t histogram[256] = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        histogram[level.data[i * 4 + 3]]++;
+    }
+
+    size_t target = (size_t)(coverage * count + 0.5f);
+    size_t above = 0;
+    int threshold = 255;
+    size_t bestError = SIZE_MAX;
+    int best = cutoff;
+    // above = texels with alpha > threshold
+    for (; threshold >= 0; threshold--)
+    {
+        size_t error = above > target ? above - target : target - above;
+        if (error < bestError)
+        {
+            bestError = error;
+            best = threshold;
+        }
+        above += histogram[threshold];
+    }
+    if (best == cutoff || best == 255)
+    {
+        return;
+    }
+
+    float scale = (cutoff + 0.5f) / (best + 0.5f);
+    uint8_t remap[256];
+    for (int a = 0; a < 256; a++)
+    {
+        remap[a] = (uint8_t)std::min(255.0f, a * scale + 0.5f);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        level.data[i * 4 + 3] = remap[level.data[i * 4 + 3]];
+    }
+}
+
+std::vector<TextureLevel> buildMipChain(const uint8_t *rgba, int width, int height, bool srgb, float alphaCutoff, unsigned int threads)
+{
+    using namespace texture_mips_detail;
+    CPU_ZONE("Texture mip chain");
+    std::vector<TextureLevel> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].data.assign(rgba, rgba + (size_t)width * height * 4);
+
+    int cutoff = (int)(alphaCutoff * 255.0f + 0.5f);
+    float coverage = alphaCutoff > 0.0f ? alphaCoverage(levels[0], cutoff) : 0.0f;
+
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        const TextureLevel &source = levels.back();
+        TextureLevel level;
+        level.width = std::max(1, source.width / 2);
+        level.height = std::max(1, source.height / 2);
+        level.data.resize((size_t)level.width * level.height * 4);
+
+        if (source.width == level.width * 2 && source.height == level.height * 2)
+        {
+            // small levels are not worth a thread
+            const int MIN_ROWS_PER_THREAD = 32;
+            unsigned int count = std::max(1u, std::min(threads, (unsigned int)(level.height / MIN_ROWS_PER_THREAD)));
+            std::vector<std::thread> helpers;
+            for (unsigned int i = 1; i < count; i++)
+            {
+                helpers.emplace_back(halveRows, std::cref(source), std::ref(level), srgb, level.height * (int)i / (int)count, level.height * (int)(i + 1) / (int)count);
+            }
+            halveRows(source, level, srgb, 0, level.height / (int)count);
+            for (std::thread &helper : helpers)
+            {
+                helper.join();
+            }
+        }
+        else
+        {
+            // an odd side (or a 1 pixel side): the box covers one and a half texels
+            CPU_ZONE("Texture mip resize");
+            stbir_resize(source.data.data(), source.width, source.height, source.width * 4,
+                         level.data.data(), level.width, level.height, level.width * 4,
+                         STBIR_TYPE_UINT8, 4, 3, 0, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP, STBIR_FILTER_BOX, STBIR_FILTER_BOX,
+                         srgb ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR, nullptr);
+        }
+
+        if (alphaCutoff > 0.0f)
+        {
+            preserveAlphaCoverage(level, coverage, cutoff);
+        }
+        levels.push_back(std::move(level));
+    }
+    return levels;
+}
+
+#endif /* my_texture_mips_h */
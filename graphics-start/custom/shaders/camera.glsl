@@ -0,0 +1,8 @@
+// Per-frame camera data, one uniform buffer shared by every program (see my/camera_buffer.h)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProj;
+    vec4 viewPos;   // w is unused
+};
@@ -0,0 +1,50 @@
+// Clustered light lists, filled every frame by LightClusters (see my/light_clusters.h)
+// needs camera.glsl for viewProj; the including shader defines directLight
+layout (std140) uniform Clusters
+{
+    uvec4 clusterGrid;  // clusters along x, y, z; w is the number of visible lights
+    vec4 clusterDepth;  // depth slice = log(view depth) * x + y
+};
+
+uniform samplerBuffer clusterLights;    // 2 texels per light: position + radius, color
+uniform usamplerBuffer clusterRanges;   // per cluster: first index, count
+uniform usamplerBuffer clusterIndices;  // light indices, grouped per cluster
+
+// first index and count of the lights of the cluster containing worldPos
+uvec2 clusterRange(vec3 worldPos)
+{
+    vec4 clip = viewProj * vec4(worldPos, 1.0);
+    // w of a perspective projection is the view depth
+    vec2 tile = clamp((clip.xy / clip.w * 0.5 + 0.5) * vec2(clusterGrid.xy), vec2(0.0), vec2(clusterGrid.xy) - 1.0);
+    float slice = clamp(log(clip.w) * clusterDepth.x + clusterDepth.y, 0.0, float(clusterGrid.z) - 1.0);
+    int cluster = (int(slice) * int(clusterGrid.y) + int(tile.y)) * int(clusterGrid.x) + int(tile.x);
+    return texelFetch(clusterRanges, cluster).xy;
+}
+
+// smooth window that reaches 0 at radius, times inverse square falloff
+float clusterAttenuation(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / (distance * distance + 1.0);
+}
+
+// the light one light adds to a surface, defined by the including shader
+vec3 directLight(vec3 norm, vec3 lightDir, vec3 viewDir, vec3 color, float specularStrength);
+
+// sum of directLight over the lights of worldPos's cluster
+vec3 clusteredLights(vec3 worldPos, vec3 norm, vec3 viewDir, float specularStrength)
+{
+    vec3 result = vec3(0.0);
+    uvec2 range = clusterRange(worldPos);
+    for (uint i = range.x; i < range.x + range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(i)).x) * 2;
+        vec4 positionRadius = texelFetch(clusterLights, light);
+        vec3 toLight = positionRadius.xyz - worldPos;
+        float distance = length(toLight);
+        vec3 color = texelFetch(clusterLights, light + 1).rgb * clusterAttenuation(distance, positionRadius.w);
+        result += directLight(norm, toLight / max(distance, 1e-4), viewDir, color, specularStrength);
+    }
+    return result;
+}
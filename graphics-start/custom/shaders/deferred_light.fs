@@ -0,0 +1,55 @@
+#version 330 core
+#inject
+// Lighting pass of the deferred path: runs once per pixel, whatever the overdraw of the geometry
+// pass, with the same Phong terms and cluster light lists as phong.fs; SHADOWS_CASCADED and LIGHT_IBL as in phong.fs
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProj;
+uniform vec3 ambientColor;
+
+#include "camera.glsl"
+#include "phong.glsl"
+#include "gbuffer.glsl"
+#include "clusters.glsl"
+#ifdef SHADOWS_CASCADED
+#include "shadows.glsl"
+#endif
+#ifdef LIGHT_IBL
+#include "ibl.glsl"
+#endif
+
+vec3 directLight(vec3 norm, vec3 lightDir, vec3 viewDir, vec3 color, float specularStrength)
+{
+    return phongDiffuse(norm, lightDir, color) + phongSpecular(norm, lightDir, viewDir, color, specularStrength, 32.0);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // nothing was drawn here, the framebuffer keeps its clear color
+    if (depth == 1.0)
+        discard;
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec3 norm = decodeNormal(texelFetch(gNormal, pixel, 0).xy);
+
+    vec4 world = inverseViewProj * vec4(TexCoords * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+    vec3 viewDir = normalize(viewPos.xyz - fragPos);
+
+#ifdef LIGHT_IBL
+    vec3 result = environmentLight(norm, viewDir, albedoSpecular.a, PHONG_ROUGHNESS);
+#else
+    vec3 result = phongAmbient(ambientColor, 0.1);
+#endif
+    result += clusteredLights(fragPos, norm, viewDir, albedoSpecular.a);
+#ifdef SHADOWS_CASCADED
+    result += directLight(norm, shadowLightDirection.xyz, viewDir, shadowLightColor.rgb, albedoSpecular.a) * cascadedShadow(fragPos, norm);
+#endif
+    FragColor = vec4(result * albedoSpecular.rgb, 1.0);
+}
@@ -0,0 +1,9 @@
+#version 330 core
+// One triangle covering the screen, no vertex buffer: vertices 0, 1, 2 map to (0,0), (2,0), (0,2)
+out vec2 TexCoords;
+
+void main()
+{
+    TexCoords = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(TexCoords * 2.0 - 1.0, 0.0, 1.0);
+}
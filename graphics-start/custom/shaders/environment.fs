@@ -0,0 +1,17 @@
+#version 330 core
+// The HDR environment of ImageBasedLighting behind the scene, on the fullscreen triangle of deferred_light.vs
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform samplerCube environmentMap;
+uniform mat4 inverseViewProj;
+
+#include "camera.glsl"
+
+void main()
+{
+    // the far plane point under the pixel, seen from the camera
+    vec4 world = inverseViewProj * vec4(TexCoords * 2.0 - 1.0, 1.0, 1.0);
+    FragColor = vec4(textureLod(environmentMap, world.xyz / world.w - viewPos.xyz, 0.0).rgb, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+// Geometry pass of the deferred path: surface attributes only, the lighting happens per pixel later
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec2 gNormal;
+
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform vec3 objectColor;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+    // 0.5 is the specular strength of the forward path (phong.fs)
+    gAlbedoSpecular = vec4(objectColor, 0.5);
+    gNormal = encodeNormal(normalize(Normal));
+}
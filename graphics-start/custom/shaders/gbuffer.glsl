@@ -0,0 +1,21 @@
+// G-buffer layout of the deferred path (see my/deferred.h)
+//   0: RGBA8  albedo, specular strength
+//   1: RG16F  world space normal, octahedral encoded
+//   depth: DEPTH_COMPONENT24, world position is rebuilt from it
+
+// unit vector to the [-1, 1]^2 square: the octahedron |x| + |y| + |z| = 1, lower half folded out
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : folded;
+}
+
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float fold = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -fold : fold;
+    n.y += n.y >= 0.0 ? -fold : fold;
+    return normalize(n);
+}
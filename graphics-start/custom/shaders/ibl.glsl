@@ -0,0 +1,20 @@
+// Image based lighting baked by ImageBasedLighting (see my/image_based_lighting.h)
+uniform samplerCube irradianceMap;
+uniform samplerCube prefilterMap;
+uniform sampler2D brdfLut;
+uniform float prefilterMaxLod;      // the roughest prefiltered level, roughness 1
+
+// GGX roughness whose highlight is about as wide as the shininess 32 of phongSpecular
+const float PHONG_ROUGHNESS = 0.49;
+// reflectance of a dielectric at normal incidence
+const vec3 DIELECTRIC_F0 = vec3(0.04);
+
+// light from the environment: diffuse irradiance plus the split-sum reflection,
+// scaled by the specular strength like phongSpecular
+vec3 environmentLight(vec3 norm, vec3 viewDir, float specularStrength, float roughness)
+{
+    vec3 diffuse = texture(irradianceMap, norm).rgb;
+    vec3 prefiltered = textureLod(prefilterMap, reflect(-viewDir, norm), roughness * prefilterMaxLod).rgb;
+    vec2 brdf = texture(brdfLut, vec2(max(dot(norm, viewDir), 0.0), roughness)).rg;
+    return diffuse + specularStrength * prefiltered * (DIELECTRIC_F0 * brdf.x + brdf.y);
+}
@@ -0,0 +1,72 @@
+#version 330 core
+#inject
+// Uber-shader for ch07-x, compiled per feature set through ShaderPermutations:
+// LIGHT_AMBIENT, LIGHT_DIFFUSE, LIGHT_SPECULAR, LIGHT_CLUSTERED, SHADOWS_CASCADED, SHADOWS_POINT, LIGHT_IBL
+// LIGHT_CLUSTERED replaces the single lightPos with the point lights of the fragment's cluster
+// SHADOWS_CASCADED adds the directional light of the Shadows block, shadowed by its cascades
+// SHADOWS_POINT shadows the single light at lightPos with its cube map
+// LIGHT_IBL replaces the flat ambient term with the irradiance and reflections of the environment maps
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPos;
+  
+uniform vec3 lightPos;
+uniform vec3 lightColor;
+uniform vec3 objectColor;
+
+#include "camera.glsl"
+#include "phong.glsl"
+#ifdef LIGHT_CLUSTERED
+#include "clusters.glsl"
+#endif
+#ifdef SHADOWS_CASCADED
+#include "shadows.glsl"
+#endif
+#ifdef SHADOWS_POINT
+#include "point_shadow.glsl"
+#endif
+#ifdef LIGHT_IBL
+#include "ibl.glsl"
+#endif
+
+// diffuse and specular light of one light
+vec3 directLight(vec3 norm, vec3 lightDir, vec3 viewDir, vec3 color, float specularStrength)
+{
+    vec3 light = vec3(0.0);
+#ifdef LIGHT_DIFFUSE
+    light += phongDiffuse(norm, lightDir, color);
+#endif
+#ifdef LIGHT_SPECULAR
+    light += phongSpecular(norm, lightDir, viewDir, color, specularStrength, 32.0);
+#endif
+    return light;
+}
+
+void main()
+{
+    vec3 result = vec3(0.0);
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    
+#ifdef LIGHT_IBL
+    result += environmentLight(norm, viewDir, 0.5, PHONG_ROUGHNESS);
+#elif defined(LIGHT_AMBIENT)
+    result += phongAmbient(lightColor, 0.1);
+#endif
+    
+#if defined(LIGHT_DIFFUSE) || defined(LIGHT_SPECULAR)
+#ifdef LIGHT_CLUSTERED
+    result += clusteredLights(FragPos, norm, viewDir, 0.5);
+#elif defined(SHADOWS_POINT)
+    result += directLight(norm, normalize(lightPos - FragPos), viewDir, lightColor, 0.5) * pointShadow(lightPos, FragPos, norm);
+#else
+    result += directLight(norm, normalize(lightPos - FragPos), viewDir, lightColor, 0.5);
+#endif
+#ifdef SHADOWS_CASCADED
+    result += directLight(norm, shadowLightDirection.xyz, viewDir, shadowLightColor.rgb, 0.5) * cascadedShadow(FragPos, norm);
+#endif
+#endif
+    
+    FragColor = vec4(result * objectColor, 1.0);
+}
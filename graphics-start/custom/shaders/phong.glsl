@@ -0,0 +1,20 @@
+// Phong lighting terms shared by the lighting shaders.
+// Every term returns the light it contributes, the caller multiplies the sum by the object color.
+
+vec3 phongAmbient(vec3 lightColor, float strength)
+{
+    return strength * lightColor;
+}
+
+vec3 phongDiffuse(vec3 norm, vec3 lightDir, vec3 lightColor)
+{
+    float diff = max(dot(norm, lightDir), 0.0);
+    return diff * lightColor;
+}
+
+vec3 phongSpecular(vec3 norm, vec3 lightDir, vec3 viewDir, vec3 lightColor, float strength, float shininess)
+{
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    return strength * spec * lightColor;
+}
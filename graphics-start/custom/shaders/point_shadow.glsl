@@ -0,0 +1,19 @@
+// Cube shadow map of the point light, rendered by PointShadows (see my/point_shadows.h)
+uniform samplerCubeShadow pointShadowMap;
+uniform vec3 pointShadowParams;     // near and far plane of the face projections, 1 / face resolution
+
+// 1 where the light at lightPos reaches worldPos, 0 in shadow
+float pointShadow(vec3 lightPos, vec3 worldPos, vec3 norm)
+{
+    vec3 toFragment = worldPos - lightPos;
+    // normal offset of about a texel, which grows with the distance like the texel footprint of a 90 degree face
+    toFragment += norm * (length(toFragment) * 2.0 * pointShadowParams.z);
+    // the face is picked by the major axis, which is also the view depth on that face
+    float depth = max(abs(toFragment.x), max(abs(toFragment.y), abs(toFragment.z)));
+    float n = pointShadowParams.x;
+    float f = pointShadowParams.y;
+    if (depth >= f)
+        return 1.0;
+    float ndc = (f + n) / (f - n) - 2.0 * f * n / ((f - n) * depth);
+    return texture(pointShadowMap, vec4(toFragment, ndc * 0.5 + 0.5));
+}
@@ -0,0 +1,6 @@
+#version 330 core
+// the cube map framebuffer has no color attachment, depth is all that is written
+
+void main()
+{
+}
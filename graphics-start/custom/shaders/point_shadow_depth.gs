@@ -0,0 +1,36 @@
+#version 330 core
+// Emits each triangle to the cube faces of faceMask (culled per object on the CPU), skipping the faces
+// whose frustum the triangle itself misses; gl_Layer selects the face of the layered framebuffer
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+uniform mat4 faceMatrices[6];
+uniform int faceMask;
+
+void main()
+{
+    for (int face = 0; face < 6; face++)
+    {
+        if ((faceMask & (1 << face)) == 0)
+            continue;
+
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+            clip[i] = faceMatrices[face] * gl_in[i].gl_Position;
+        // all three vertices beyond the same clip plane: nothing of the triangle lands on this face
+        bvec3 left = bvec3(clip[0].x < -clip[0].w, clip[1].x < -clip[1].w, clip[2].x < -clip[2].w);
+        bvec3 right = bvec3(clip[0].x > clip[0].w, clip[1].x > clip[1].w, clip[2].x > clip[2].w);
+        bvec3 bottom = bvec3(clip[0].y < -clip[0].w, clip[1].y < -clip[1].w, clip[2].y < -clip[2].w);
+        bvec3 top = bvec3(clip[0].y > clip[0].w, clip[1].y > clip[1].w, clip[2].y > clip[2].w);
+        if (all(left) || all(right) || all(bottom) || all(top))
+            continue;
+
+        for (int i = 0; i < 3; i++)
+        {
+            gl_Layer = face;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
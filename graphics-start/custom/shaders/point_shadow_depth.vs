@@ -0,0 +1,10 @@
+#version 330 core
+// Depth pass of a point light's cube map (see my/point_shadows.h), world positions for the geometry stage
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+
+void main()
+{
+    gl_Position = model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+// Depth pass of a shadow cascade (see my/shadow_cascades.h), positions only
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 lightViewProj;
+uniform mat4 model;
+
+void main()
+{
+    gl_Position = lightViewProj * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,36 @@
+// Cascaded shadow map of the directional light, filled every frame by ShadowCascades (see my/shadow_cascades.h)
+// needs camera.glsl for viewProj
+layout (std140) uniform Shadows
+{
+    mat4 shadowMatrices[4];
+    vec4 shadowSplits;          // far view depth of each cascade
+    vec4 shadowTexelSizes;      // world size of a shadow texel in each cascade
+    vec4 shadowLightDirection;  // xyz towards the light, w is the number of cascades
+    vec4 shadowLightColor;      // w is 1 / shadow map resolution
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+// 1 where the directional light reaches worldPos, 0 in full shadow; 3x3 PCF in the cascade covering it
+float cascadedShadow(vec3 worldPos, vec3 norm)
+{
+    // w of a perspective projection is the view depth
+    float depth = (viewProj * vec4(worldPos, 1.0)).w;
+    int count = int(shadowLightDirection.w);
+    int cascade = 0;
+    while (cascade < count - 1 && depth > shadowSplits[cascade])
+        cascade++;
+    // beyond the shadow distance everything is lit
+    if (depth > shadowSplits[count - 1])
+        return 1.0;
+
+    // normal offset: one texel off the surface, which scales the bias with the cascade's texel size
+    vec3 offsetPos = worldPos + norm * shadowTexelSizes[cascade];
+    vec3 coords = (shadowMatrices[cascade] * vec4(offsetPos, 1.0)).xyz * 0.5 + 0.5;
+
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * shadowLightColor.w, float(cascade), coords.z));
+    return lit / 9.0;
+}
@@ -0,0 +1,11 @@
+// sRGB transfer functions, for chapters that sample sRGB textures (decoded to linear by the sampler) and
+// write to a framebuffer without GL_FRAMEBUFFER_SRGB
+vec3 srgbToLinear(vec3 c)
+{
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(0.04045, c));
+}
+
+vec3 linearToSrgb(vec3 c)
+{
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, step(0.0031308, c));
+}